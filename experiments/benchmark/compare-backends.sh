@@ -0,0 +1,24 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Runs the same primitives and end-to-end sorts on the native and on the HEXL build, then compares
+# them: the rotations of rotsum and swap, the Chebyshev evaluations and bootstrapping dominate.
+# NATIVE_BUILD_DIR and HEXL_BUILD_DIR are two build directories of this repository, configured with
+# -DOPENFHE_ROOT=<native OpenFHE> and -DWITH_INTEL_HEXL=ON -DOPENFHE_HEXL_ROOT=<HEXL OpenFHE>.
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+NATIVE_BUILD_DIR="${NATIVE_BUILD_DIR:-$SCRIPT_DIR/../../build}"
+HEXL_BUILD_DIR="${HEXL_BUILD_DIR:-$SCRIPT_DIR/../../build-hexl}"
+LABEL="${1:-$(hostname)}"
+
+mkdir -p "$SCRIPT_DIR/results"
+
+for variant in native hexl; do
+    if [ "$variant" = native ]; then BUILD_DIR="$NATIVE_BUILD_DIR"; else BUILD_DIR="$HEXL_BUILD_DIR"; fi
+
+    "$BUILD_DIR/Benchmark" --primitives --end-to-end --n 16,64 --delta 0.01 --seed 42 \
+        --csv "$SCRIPT_DIR/results/backend-$variant-$LABEL.csv"
+done
+
+"$NATIVE_BUILD_DIR/Benchmark" --compare "$SCRIPT_DIR/results/backend-native-$LABEL.csv" \
+    "$SCRIPT_DIR/results/backend-hexl-$LABEL.csv"
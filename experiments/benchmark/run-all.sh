@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Machine-readable benchmarks: primitives in isolation and end-to-end sweeps.
+# Results of different builds can be compared by diffing the CSV/JSON files.
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+BUILD_DIR="${BUILD_DIR:-$SCRIPT_DIR/../../build}"
+LABEL="${1:-$(hostname)}"
+
+mkdir -p "$SCRIPT_DIR/results"
+
+"$BUILD_DIR/Benchmark" --primitives --n 8,16,32,64,128 --delta 0.01,0.001 --seed 42 \
+    --json "$SCRIPT_DIR/results/primitives-$LABEL.json" --csv "$SCRIPT_DIR/results/primitives-$LABEL.csv"
+
+"$BUILD_DIR/Benchmark" --end-to-end --permutation --n 8,16,32,64,128 --delta 0.01,0.001 --seed 42 \
+    --json "$SCRIPT_DIR/results/permutation-$LABEL.json" --csv "$SCRIPT_DIR/results/permutation-$LABEL.csv"
+
+"$BUILD_DIR/Benchmark" --end-to-end --network --n 16,32,64,128,256,512,1024 --delta 0.01,0.001 --seed 42 \
+    --json "$SCRIPT_DIR/results/network-$LABEL.json" --csv "$SCRIPT_DIR/results/network-$LABEL.csv"
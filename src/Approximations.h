@@ -0,0 +1,155 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_APPROXIMATIONS_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_APPROXIMATIONS_H
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "Utils.h"
+
+using namespace std;
+
+/*
+ * Functions approximated with Chebyshev polynomials over [-1, 1]. Both the FHE and the
+ * cleartext controllers take them from here, so that they approximate exactly the same thing.
+ */
+
+static inline function<double(double)> sigmoid_function(int n, int scaling) {
+    return [scaling, n](double x) -> double {
+        return 1/(n + n * exp(-scaling*x));
+    };
+}
+
+static inline function<double(double)> sinc_function(double n) {
+    return [n](double x) -> double { const double a = n * M_PI;
+        if (std::abs(x) < 1e-6)
+        {
+            double t = a * x;
+            return 1.0 - (t * t) / 6.0;  // Taylor 2° ordine
+        }
+        else
+        {
+            return std::sin(a * x) / (a * x);
+        } };
+}
+
+static inline function<double(double)> double_sinc_function(double n) {
+    return [n](double x) -> double { return sin(3.14159265358979323846 * x * n) / (3.14159265358979323846 * x * n) * sin(3.14159265358979323846 * x * n) / (3.14159265358979323846 * x * n); };
+}
+
+static inline function<double(double)> relu_function() {
+    return [](double x) -> double { if (x > 0) return x; return 0; };
+}
+
+// The even part of relu_function: relu(x) = x / 2 + |x| / 2
+static inline function<double(double)> relu_even_function() {
+    return [](double x) -> double { return abs(x) / 2; };
+}
+
+//Copy pasted from https://github.com/openfheorg/openfhe-development/blob/main/src/core/lib/math/chebyshev.cpp
+static inline std::vector<double> chebyshev_coefficients(const std::function<double(double)>& func, double a, double b, uint32_t degree) {
+    if (!degree) {
+        throw std::invalid_argument("The degree of approximation can not be zero");
+    }
+    // the number of coefficients to be generated should be degree+1 as zero is also included
+    size_t coeffTotal{degree + 1};
+    double bMinusA = 0.5 * (b - a);
+    double bPlusA  = 0.5 * (b + a);
+    double PiByDeg = M_PI / static_cast<double>(coeffTotal);
+    std::vector<double> functionPoints(coeffTotal);
+    for (size_t i = 0; i < coeffTotal; ++i)
+        functionPoints[i] = func(std::cos(PiByDeg * (i + 0.5)) * bMinusA + bPlusA);
+
+    double multFactor = 2.0 / static_cast<double>(coeffTotal);
+    std::vector<double> coefficients(coeffTotal);
+    for (size_t i = 0; i < coeffTotal; ++i) {
+        for (size_t j = 0; j < coeffTotal; ++j)
+            coefficients[i] += functionPoints[j] * std::cos(PiByDeg * i * (j + 0.5));
+        coefficients[i] *= multFactor;
+    }
+    return coefficients;
+}
+
+/*
+ * Clenshaw evaluation of c_0/2 + sum_i c_i T_i(y), with y the image of x in [-1, 1]
+ * (the same convention of OpenFHE's EvalChebyshevSeries)
+ */
+static inline double evaluate_chebyshev_series(const std::vector<double>& coefficients, double a, double b, double x) {
+    double y = (2 * x - a - b) / (b - a);
+    double b1 = 0, b2 = 0;
+
+    for (size_t k = coefficients.size() - 1; k >= 1; k--) {
+        double t = 2 * y * b1 - b2 + coefficients[k];
+        b2 = b1;
+        b1 = t;
+    }
+
+    return y * b1 - b2 + coefficients[0] / 2;
+}
+
+/*
+ * Odd polynomials whose compositions approximate sign(x) over [-1, 1], in the power basis
+ * (Cheon et al., "Efficient Homomorphic Comparison Methods with Optimal Complexity"). The f
+ * family fixes ±1 and refines values already close to them, the g family is minimax-tuned to
+ * move small inputs away from zero quickly. Degrees 3, 5 and 7 are available.
+ */
+static inline vector<double> sign_f_polynomial(int degree) {
+    if (degree == 3) return {0, 3.0 / 2, 0, -1.0 / 2};
+    if (degree == 5) return {0, 15.0 / 8, 0, -10.0 / 8, 0, 3.0 / 8};
+    if (degree == 7) return {0, 35.0 / 16, 0, -35.0 / 16, 0, 21.0 / 16, 0, -5.0 / 16};
+
+    throw invalid_argument("Sign polynomials are available for degrees 3, 5 and 7");
+}
+
+static inline vector<double> sign_g_polynomial(int degree) {
+    if (degree == 3) return {0, 2126.0 / 1024, 0, -1359.0 / 1024};
+    if (degree == 5) return {0, 3334.0 / 1024, 0, -6108.0 / 1024, 0, 3796.0 / 1024};
+    if (degree == 7) return {0, 4589.0 / 1024, 0, -16577.0 / 1024, 0, 25614.0 / 1024, 0, -12860.0 / 1024};
+
+    throw invalid_argument("Sign polynomials are available for degrees 3, 5 and 7");
+}
+
+static inline double evaluate_power_series(const vector<double>& coefficients, double x) {
+    double result = 0;
+    for (size_t k = coefficients.size(); k-- > 0;) result = result * x + coefficients[k];
+
+    return result;
+}
+
+/*
+ * A composite approximation of sign(x): g_iterations applications of the g polynomial of
+ * degree g_degree, followed by f_iterations applications of the f polynomial of degree f_degree
+ */
+struct CompositeSign {
+    int g_degree = 5;
+    int g_iterations = 0;
+    int f_degree = 5;
+    int f_iterations = 0;
+
+    // The polynomials to be applied, in order
+    vector<vector<double>> stages() const {
+        vector<vector<double>> result(g_iterations, sign_g_polynomial(g_degree));
+        result.insert(result.end(), f_iterations, sign_f_polynomial(f_degree));
+
+        return result;
+    }
+
+    int levels() const {
+        return g_iterations * poly_evaluation_cost(g_degree) + f_iterations * poly_evaluation_cost(f_degree);
+    }
+
+    // Products between ciphertexts: the even powers, then one product by x per stage
+    int products() const {
+        return g_iterations * (g_degree / 2 + 1) + f_iterations * (f_degree / 2 + 1);
+    }
+
+    double evaluate(double x) const {
+        for (const vector<double>& stage : stages()) x = evaluate_power_series(stage, x);
+
+        return x;
+    }
+};
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_APPROXIMATIONS_H
@@ -0,0 +1,678 @@
+#include "CostModel.h"
+#include "Trace.h"
+#include "SortingParameters.h"
+#include "PermutationSorting.h"
+#include "NetworkSorting.h"
+#include "CountingSorting.h"
+
+/*
+ * Products between ciphertexts performed by the Paterson-Stockmeyer evaluation of a
+ * Chebyshev series: the baby steps T_1..T_k, the giant steps T_2k, T_4k, ... and the
+ * recombination of the (d + 1) / k blocks
+ */
+static long chebyshev_multiplications(int degree) {
+    int m = ceil(log2(degree + 1));
+    int k = 1 << ((m + 1) / 2);
+
+    return (k - 1) + (m - (m + 1) / 2) + ((degree + 1) + k - 1) / k - 1;
+}
+
+/*
+ * Rotation keys generated by EvalBootstrapKeyGen: the baby-step/giant-step rotations of each
+ * level of CoeffsToSlots and SlotsToCoeffs, plus the conjugation key
+ */
+static int bootstrap_rotation_keys(int num_slots, const vector<int>& level_budget) {
+    int log_slots = ceil(log2(num_slots));
+    int keys = 1;
+
+    for (int budget : level_budget) {
+        int radix = 1 << (int) ceil(log_slots / (double) budget);
+        keys += budget * 2 * (int) ceil(sqrt(2.0 * radix));
+    }
+
+    return keys;
+}
+
+CostCalibration CostCalibration::load(const string &filename) {
+    CostCalibration calibration;
+
+    ifstream in(filename);
+    if (!in) {
+        cerr << "Could not read the calibration \"" << filename << "\", using the default latencies" << endl;
+        return calibration;
+    }
+
+    string name;
+    double value;
+
+    while (in >> name) {
+        if (name[0] == '#') {
+            getline(in, name);
+            continue;
+        }
+
+        in >> value;
+
+        if (name == "ring_dim") calibration.ring_dim = value;
+        else if (name == "limbs") calibration.limbs = value;
+        else if (name == "add_ms") calibration.add_ms = value;
+        else if (name == "plaintext_mult_ms") calibration.plaintext_mult_ms = value;
+        else if (name == "ciphertext_mult_ms") calibration.ciphertext_mult_ms = value;
+        else if (name == "rotation_ms") calibration.rotation_ms = value;
+        else if (name == "bootstrap_ms") calibration.bootstrap_ms = value;
+        else if (name == "rescale_ms") calibration.rescale_ms = value;
+        else if (name == "switch_ms") calibration.switch_ms = value;
+        else if (name == "memory_scale") calibration.memory_scale = value;
+        else if (name.rfind("chebyshev_ms.", 0) == 0) calibration.chebyshev_ms[stoi(name.substr(13))] = value;
+    }
+
+    calibration.calibrated = true;
+
+    return calibration;
+}
+
+void CostCalibration::save(const string &filename) const {
+    ofstream out(filename);
+    out << setprecision(6) << fixed;
+
+    out << "# Per-operation latencies, written by Benchmark --calibrate" << endl;
+    out << "ring_dim " << ring_dim << endl;
+    out << "limbs " << limbs << endl;
+    out << "add_ms " << add_ms << endl;
+    out << "plaintext_mult_ms " << plaintext_mult_ms << endl;
+    out << "ciphertext_mult_ms " << ciphertext_mult_ms << endl;
+    out << "rotation_ms " << rotation_ms << endl;
+    out << "bootstrap_ms " << bootstrap_ms << endl;
+    out << "rescale_ms " << rescale_ms << endl;
+    out << "switch_ms " << switch_ms << endl;
+    out << "memory_scale " << memory_scale << endl;
+
+    for (const auto& [degree, ms] : chebyshev_ms) {
+        out << "chebyshev_ms." << degree << " " << ms << endl;
+    }
+
+    cout << "Calibration written to " << filename << endl;
+}
+
+double CountingState::scaled(double ms, int level) const {
+    return ms * ((double) ring_dim / calibration.ring_dim) * ((double) limbs(level) / calibration.limbs);
+}
+
+shared_ptr<CountedCiphertext> CountingState::ciphertext(const shared_ptr<CountingState>& self, int level, uint32_t slots, int scale_degree) {
+    uint64_t bytes = 2ULL * limbs(level) * ring_dim * sizeof(uint64_t);
+
+    {
+        lock_guard<mutex> guard(lock);
+        live_bytes += bytes;
+        peak_bytes = max(peak_bytes, live_bytes);
+    }
+
+    return shared_ptr<CountedCiphertext>(new CountedCiphertext{level, slots, scale_degree, self}, [bytes](CountedCiphertext* c) {
+        {
+            lock_guard<mutex> guard(c->state->lock);
+            c->state->live_bytes -= bytes;
+        }
+        delete c;
+    });
+}
+
+shared_ptr<CountedPlaintext> CountingState::plaintext(const shared_ptr<CountingState>& self, int level, uint32_t slots) {
+    uint64_t bytes = 1ULL * limbs(level) * ring_dim * sizeof(uint64_t);
+
+    {
+        lock_guard<mutex> guard(lock);
+        live_bytes += bytes;
+        peak_bytes = max(peak_bytes, live_bytes);
+    }
+
+    return shared_ptr<CountedPlaintext>(new CountedPlaintext{level, slots}, [self, bytes](CountedPlaintext* p) {
+        {
+            lock_guard<mutex> guard(self->lock);
+            self->live_bytes -= bytes;
+        }
+        delete p;
+    });
+}
+
+shared_ptr<CountedCiphertext> CountedCiphertext::Clone() const {
+    return state->ciphertext(state, level, slots, scale_degree);
+}
+
+CountingController::CountingController(const CostCalibration &calibration, RescalingMode rescaling) : state(make_shared<CountingState>()) {
+    state->calibration = calibration;
+    state->rescaling = rescaling;
+}
+
+int CountingController::generate_context_network(int num_slots, int levels_required, bool toy_parameters, double delta) {
+    // The same parameters of FHEController::generate_context_network
+    vector<int> level_budget = {3, 3};
+    state->large_digits = 6;
+
+    if (delta == 0.001) {
+        level_budget = {2, 3};
+        state->large_digits = 7;
+    }
+
+    int bootstrap_depth = 9 + level_budget[0] + level_budget[1];
+
+    state->ring_dim = toy_parameters ? 1 << 12 : 1 << 16;
+    state->depth = levels_required + 1 + bootstrap_depth;
+    state->bootstrap_level = bootstrap_depth;
+    state->bootstrap_keys = bootstrap_rotation_keys(num_slots, level_budget);
+
+    return state->depth;
+}
+
+void CountingController::generate_rotation_keys_network(int num_slots) {
+    state->rotation_keys += network_plan(num_slots).rotation_count;
+}
+
+void CountingController::generate_context_permutation(int num_slots, int levels_required, bool toy, int n, double delta) {
+    // The same parameters of FHEController::generate_context_permutation
+    state->ring_dim = 1 << 16;
+
+    if (toy) {
+        if (num_slots <= 1 << 15) state->ring_dim = 1 << 16;
+        if (num_slots <= 1 << 14) state->ring_dim = 1 << 15;
+        if (num_slots <= 1 << 13) state->ring_dim = 1 << 14;
+        if (num_slots <= 1 << 12) state->ring_dim = 1 << 13;
+        if (num_slots <= 1 << 11) state->ring_dim = 1 << 12;
+    }
+
+    state->large_digits = 3;
+    if (delta == 0.001 && n == 128) state->large_digits = 4;
+    if (delta == 0.0001) state->large_digits = 9;
+
+    state->depth = levels_required;
+}
+
+void CountingController::generate_rotation_keys_permutation(int n) {
+    for (int i = 0; i < log2(n); i++) {
+        generate_rotation_key(pow(2, i) * n);
+        generate_rotation_key(pow(2, i));
+    }
+}
+
+void CountingController::generate_rotation_key(int index) {
+    state->rotation_keys++;
+}
+
+void CountingController::generate_scheme_switching_keys(int num_slots, bool toy_parameters) {
+    // Baby-step/giant-step rotations of the two linear transforms; the FHEW keys are not counted
+    state->switching_keys = 4 * (int) ceil(sqrt((double) num_slots));
+}
+
+void CountingController::fill(CostEstimate &estimate) const {
+    lock_guard<mutex> guard(state->lock);
+
+    estimate.ring_dim = state->ring_dim;
+    estimate.depth = state->depth;
+    estimate.large_digits = state->large_digits;
+    estimate.rotation_keys = state->rotation_keys + state->bootstrap_keys + state->switching_keys;
+    estimate.counts = state->counts;
+    estimate.seconds = state->predicted_ms / 1000;
+
+    // Hybrid key switching: every key holds `large_digits` pairs of polynomials over Q·P
+    uint64_t limbs_q = state->depth + 1;
+    uint64_t limbs_p = (limbs_q + state->large_digits - 1) / state->large_digits;
+    uint64_t key_bytes = 2ULL * state->large_digits * (limbs_q + limbs_p) * state->ring_dim * sizeof(uint64_t);
+
+    // The relinearization key, the rotation keys and the bootstrapping keys
+    estimate.key_bytes = key_bytes * (1 + estimate.rotation_keys);
+    estimate.peak_data_bytes = state->peak_bytes;
+    estimate.memory_scale = state->calibration.memory_scale;
+    estimate.calibrated = state->calibration.calibrated;
+    estimate.rescaling = state->rescaling;
+}
+
+void CountingController::record(long &counter, long count, double ms, int level) {
+    lock_guard<mutex> guard(state->lock);
+
+    counter += count;
+    state->predicted_ms += count * state->scaled(ms, level);
+}
+
+CountingController::Ptxt CountingController::encode(const vector<double> &vec, int level, int num_slots) {
+    return state->plaintext(state, level, num_slots > 0 ? num_slots : vec.size());
+}
+
+CountingController::Ptxt CountingController::encode(double value, int level, int num_slots) {
+    return state->plaintext(state, level, num_slots);
+}
+
+CountingController::Ctxt CountingController::encrypt(const vector<double> &vec, int level, int num_slots) {
+    return state->ciphertext(state, level, num_slots > 0 ? num_slots : vec.size());
+}
+
+CountingController::Ctxt CountingController::encrypt_expanded(const vector<double> &vec, int level, int num_slots, int repetitions) {
+    return state->ciphertext(state, level, num_slots > 0 ? num_slots : vec.size() * repetitions);
+}
+
+CountingController::Ctxt CountingController::encrypt_repeated(const vector<double> &vec, int level, int num_slots, int repetitions) {
+    return state->ciphertext(state, level, num_slots > 0 ? num_slots : vec.size() * repetitions);
+}
+
+vector<double> CountingController::decode(const Ptxt &p) {
+    return vector<double>(p->slots, 0);
+}
+
+CountingController::Ptxt CountingController::decrypt(const Ctxt &c) {
+    Ctxt x = rescaled(c);
+
+    return state->plaintext(state, x->level, x->slots);
+}
+
+CountingController::Ctxt CountingController::add(const Ctxt &a, const Ctxt &b) {
+    auto [x, y] = aligned(a, b);
+
+    int level = max(x->level, y->level);
+    record(state->counts.additions, 1, state->calibration.add_ms, level);
+
+    return state->ciphertext(state, level, x->slots, x->scale_degree);
+}
+
+CountingController::Ctxt CountingController::add(const Ctxt &c, const Ptxt &p) {
+    Ctxt x = rescaled(c);
+
+    int level = max(x->level, p->level);
+    record(state->counts.additions, 1, state->calibration.add_ms, level);
+
+    return state->ciphertext(state, level, x->slots);
+}
+
+CountingController::Ctxt CountingController::add(const Ctxt &c, double d) {
+    // FLEXIBLEAUTO encodes the constant at the scaling factor of the ciphertext instead
+    Ctxt x = state->rescaling == MANUAL_RESCALING ? rescaled(c) : c;
+    record(state->counts.additions, 1, state->calibration.add_ms, x->level);
+
+    return state->ciphertext(state, x->level, x->slots, x->scale_degree);
+}
+
+CountingController::Ctxt CountingController::add_tree(vector<Ctxt> v) {
+    bool mixed = false;
+    for (const Ctxt& c : v) mixed |= c->scale_degree != v[0]->scale_degree;
+
+    if (mixed) for (Ctxt& c : v) c = rescaled(c);
+
+    int level = 0;
+    for (const Ctxt& c : v) level = max(level, c->level);
+
+    record(state->counts.additions, v.size() - 1, state->calibration.add_ms, level);
+
+    return state->ciphertext(state, level, v[0]->slots, v[0]->scale_degree);
+}
+
+CountingController::Ctxt CountingController::sub(const Ctxt &a, const Ctxt &b) {
+    return add(a, b);
+}
+
+CountingController::Ctxt CountingController::sub(const Ctxt &c, const Ptxt &p) {
+    return add(c, p);
+}
+
+CountingController::Ctxt CountingController::sub(double a, const Ctxt &c) {
+    return add(c, a);
+}
+
+CountingController::Ctxt CountingController::mult(const Ctxt &c, const Ptxt &p) {
+    Ctxt x = rescaled(c);
+
+    int level = max(x->level, p->level);
+    record(state->counts.plaintext_mults, 1, state->calibration.plaintext_mult_ms, level);
+
+    return state->ciphertext(state, level + 1, x->slots, 2);
+}
+
+CountingController::Ctxt CountingController::mult(const Ctxt &c, double d) {
+    Ctxt x = rescaled(c);
+    record(state->counts.plaintext_mults, 1, state->calibration.plaintext_mult_ms, x->level);
+
+    return state->ciphertext(state, x->level + 1, x->slots, 2);
+}
+
+CountingController::Ctxt CountingController::mult(const Ctxt &c1, const Ctxt &c2) {
+    Ctxt x = rescaled(c1), y = rescaled(c2);
+
+    int level = max(x->level, y->level);
+    record(state->counts.ciphertext_mults, 1, state->calibration.ciphertext_mult_ms, level);
+
+    return state->ciphertext(state, level + 1, x->slots, 2);
+}
+
+CountingController::Ctxt CountingController::rot(const Ctxt &c, int index) {
+    // FLEXIBLEAUTO rotates a product before its rescaling, switching keys over one modulus more
+    Ctxt x = state->rescaling == MANUAL_RESCALING ? rescaled(c) : c;
+    record(state->counts.rotations, 1, state->calibration.rotation_ms, x->level - (x->scale_degree - 1));
+
+    return state->ciphertext(state, x->level, x->slots, x->scale_degree);
+}
+
+CountingController::Ctxt CountingController::rescaled(const Ctxt &c) {
+    if (c->scale_degree < 2) return c;
+
+    record(state->counts.rescales, 1, state->calibration.rescale_ms, c->level);
+
+    return state->ciphertext(state, c->level, c->slots);
+}
+
+pair<CountingController::Ctxt, CountingController::Ctxt> CountingController::aligned(const Ctxt &a, const Ctxt &b) {
+    if (a->scale_degree == b->scale_degree) return {a, b};
+
+    return {rescaled(a), rescaled(b)};
+}
+
+CountingController::Ctxt CountingController::bootstrap(const Ctxt &in) {
+    Ctxt c = rescaled(in);
+
+    {
+        lock_guard<mutex> guard(state->lock);
+
+        // Bootstrapping always runs over the same chain of levels, only the ring dimension matters
+        state->counts.bootstraps++;
+        state->predicted_ms += state->calibration.bootstrap_ms * state->ring_dim / state->calibration.ring_dim;
+    }
+
+    return state->ciphertext(state, state->bootstrap_level, c->slots);
+}
+
+CountingController::Ctxt CountingController::compress(const Ctxt &c, int slots, int precision_bits) {
+    // Dropping limbs costs nothing next to the circuit
+    rescaled(c);
+
+    return state->ciphertext(state, state->depth, slots);
+}
+
+CountingController::Ctxt CountingController::rotsum(const Ctxt &in, int n) {
+    Ctxt result = add(in, rot(in, n));
+
+    for (int i = 1; i < log2(n); i++) {
+        result = add(result, rot(result, n * pow(2, i)));
+    }
+
+    return result;
+}
+
+CountingController::Ctxt CountingController::chebyshev(const Ctxt &c, int degree) {
+    Ctxt in = rescaled(c);
+    int levels = poly_evaluation_cost(degree);
+    long products = chebyshev_multiplications(degree);
+
+    {
+        lock_guard<mutex> guard(state->lock);
+        const CostCalibration& calibration = state->calibration;
+
+        state->counts.chebyshev[degree]++;
+        state->counts.ciphertext_mults += products;
+
+        auto measured = calibration.chebyshev_ms.find(degree);
+
+        if (measured != calibration.chebyshev_ms.end()) {
+            state->predicted_ms += state->scaled(measured->second, in->level);
+        } else {
+            // Products at the average level of the evaluation, plus one scalar product and addition per coefficient
+            int level = in->level + levels / 2;
+            state->predicted_ms += products * state->scaled(calibration.ciphertext_mult_ms, level);
+            state->predicted_ms += (degree + 1) * state->scaled(calibration.plaintext_mult_ms + calibration.add_ms, level);
+        }
+    }
+
+    return state->ciphertext(state, in->level + levels, in->slots);
+}
+
+CountingController::Ctxt CountingController::cleaning(const Ctxt &c, int products, int levels) {
+    Ctxt in = rescaled(c);
+
+    {
+        lock_guard<mutex> guard(state->lock);
+        const CostCalibration& calibration = state->calibration;
+
+        state->counts.polynomials++;
+        state->counts.ciphertext_mults += products;
+        state->predicted_ms += products * state->scaled(calibration.ciphertext_mult_ms, in->level + 1);
+        state->predicted_ms += 2 * state->scaled(calibration.plaintext_mult_ms + calibration.add_ms, in->level);
+    }
+
+    return state->ciphertext(state, in->level + levels, in->slots);
+}
+
+CountingController::Ctxt CountingController::sigmoid(const Ctxt &in, int n, int degree, int scaling) {
+    return chebyshev(in, degree);
+}
+
+CountingController::Ctxt CountingController::even_chebyshev(const Ctxt &in, int degree) {
+    if (!even_evaluation_fits(degree)) return chebyshev(in, degree);
+
+    // The calibration measures relu, which takes the same path, squaring included
+    if (state->calibration.chebyshev_ms.count(degree)) return chebyshev(in, degree);
+
+    return chebyshev(mult(in, in), degree / 2);
+}
+
+CountingController::Ctxt CountingController::sinc(const Ctxt &in, int degree, double n) {
+    return even_chebyshev(in, degree);
+}
+
+CountingController::Ctxt CountingController::double_sinc(const Ctxt &in, int degree, double n) {
+    return even_chebyshev(in, degree);
+}
+
+CountingController::Ctxt CountingController::relu(const Ctxt &in, int degree, int n) {
+    if (even_evaluation_fits(degree)) return add(even_chebyshev(in, degree), mult(in, 0.5));
+
+    return chebyshev(in, degree);
+}
+
+CountingController::Ctxt CountingController::composite_sign(const Ctxt &in, const CompositeSign &sign) {
+    Ctxt result = in;
+
+    for (int i = 0; i < sign.g_iterations; i++) result = cleaning(result, sign.g_degree / 2 + 1, poly_evaluation_cost(sign.g_degree));
+    for (int i = 0; i < sign.f_iterations; i++) result = cleaning(result, sign.f_degree / 2 + 1, poly_evaluation_cost(sign.f_degree));
+
+    return result;
+}
+
+CountingController::Ctxt CountingController::compare_switch(const Ctxt &c1, const Ctxt &c2) {
+    rescaled(c1);
+    rescaled(c2);
+
+    {
+        lock_guard<mutex> guard(state->lock);
+
+        // FHEW runs over its own small ring, only the number of slots matters
+        state->counts.switched_values += c1->slots;
+        state->predicted_ms += c1->slots * state->calibration.switch_ms;
+    }
+
+    return state->ciphertext(state, SCHEME_SWITCH_LEVELS, c1->slots);
+}
+
+CountingController::Ctxt CountingController::clean_sigmoid(const Ctxt &in, double n, int iterations) {
+    Ctxt result = in;
+    for (int i = 0; i < iterations; i++) result = cleaning(result, 2, 2);
+
+    return result;
+}
+
+CountingController::Ctxt CountingController::clean_sigmoid_and_scale(const Ctxt &in, double n) {
+    return cleaning(in, 2, 2);
+}
+
+CountingController::Ctxt CountingController::clean_binary(const Ctxt &in, double scale) {
+    return cleaning(in, 2, 2);
+}
+
+CountingController::Ctxt CountingController::clean_sign(const Ctxt &in) {
+    return cleaning(in, 3, poly_evaluation_cost(5));
+}
+
+CostEstimate estimate_sort(SortingType method, int n, double delta, bool tieoffset, bool toy,
+                           const CostCalibration &calibration, NetworkComparator comparator, RescalingMode rescaling) {
+    CostEstimate estimate;
+    estimate.method = method;
+    estimate.n = n;
+    estimate.delta = delta;
+
+    if (n < 2 || (n & (n - 1)) != 0) {
+        estimate.feasible = false;
+        estimate.reason = "the number of values must be a power of two";
+        return estimate;
+    }
+
+    // The walk is not part of the traced run
+    Tracer& tracer = Tracer::instance();
+    bool tracing = tracer.enabled();
+    tracer.set_enabled(false);
+
+    CountingController controller(calibration, rescaling);
+    vector<double> input_values(n, 0);
+
+    bool scheme_switching = comparator == SWITCH_COMPARATOR;
+
+    if (scheme_switching && delta < pow(2, -SCHEME_SWITCH_PRECISION_BITS)) {
+        estimate.feasible = false;
+        estimate.reason = "scheme switching resolves differences down to 2^-" + to_string(SCHEME_SWITCH_PRECISION_BITS);
+    } else if (method == PERMUTATION) {
+        if (scheme_switching && tieoffset) {
+            estimate.feasible = false;
+            estimate.reason = "the tie-offset correction requires the sigmoid comparison";
+        } else if (!scheme_switching && delta != 0.1 && delta != 0.01 && delta != 0.001 && delta != 0.0001) {
+            estimate.feasible = false;
+            estimate.reason = "the permutation parameters only cover δ = 0.1, 0.01, 0.001, 0.0001";
+        } else if (n > 128) {
+            estimate.feasible = false;
+            estimate.reason = "n² slots do not fit a ciphertext for n > 128";
+        } else {
+            PermutationConfig config = permutation_config(n, delta, tieoffset, toy, false, scheme_switching);
+            const PermutationParameters& parameters = config.parameters;
+
+            controller.generate_context_permutation(n * n, parameters.circuit_depth, toy, n, delta);
+            controller.generate_rotation_keys_permutation(n);
+            if (scheme_switching) controller.generate_scheme_switching_keys(n * n, toy);
+
+            auto in_exp = controller.encrypt_expanded(input_values, 0, n*n, n);
+            auto in_rep = controller.encrypt_repeated(input_values, 0, n*n, n);
+
+            PermutationSorting sorting(controller, config);
+            sorting.sort(in_exp, in_rep);
+        }
+    } else if (method == NETWORK) {
+        if (delta < 0.001 && !scheme_switching) {
+            estimate.feasible = false;
+            estimate.reason = "the polynomial comparators require δ >= 0.001";
+        } else if (n > (toy ? 1 << 11 : 1 << 15)) {
+            estimate.feasible = false;
+            estimate.reason = "n values do not fit a ciphertext";
+        } else {
+            NetworkConfig config = network_config(n, delta, toy, false, comparator);
+            const NetworkParameters& parameters = config.parameters;
+            int levels_consumption = network_layer_levels(parameters);
+
+            int circuit_depth = controller.generate_context_network(n, levels_consumption, toy, delta);
+            controller.generate_rotation_keys_network(n);
+            if (scheme_switching) controller.generate_scheme_switching_keys(n, toy);
+
+            auto in = controller.encrypt(input_values, circuit_depth - levels_consumption - 3, n);
+
+            NetworkSorting sorting(controller, config);
+            sorting.sort(in);
+        }
+    } else if (method == COUNTING) {
+        if (grid_points(delta) > MAX_COUNTING_BUCKETS) {
+            estimate.feasible = false;
+            estimate.reason = "the grid of step δ has more than " + to_string(MAX_COUNTING_BUCKETS) + " buckets";
+        } else if (counting_parameters(n, delta).slots > MAX_COUNTING_SLOTS) {
+            estimate.feasible = false;
+            estimate.reason = "n slots per bucket do not fit a ciphertext";
+        } else {
+            CountingConfig config = counting_config(n, delta, toy);
+            const CountingParameters& parameters = config.parameters;
+
+            controller.generate_context_permutation(parameters.slots, parameters.circuit_depth, toy, n, delta);
+            controller.generate_rotation_keys_network(parameters.slots);
+
+            auto in = controller.encrypt_repeated(input_values, 0, parameters.slots, parameters.slots / (2 * n));
+
+            CountingSorting sorting(controller, config);
+            sorting.sort(in);
+        }
+    } else {
+        estimate.feasible = false;
+        estimate.reason = "no sorting method";
+    }
+
+    tracer.set_enabled(tracing);
+
+    if (estimate.feasible) controller.fill(estimate);
+
+    return estimate;
+}
+
+SortingType choose_method(int n, double delta, bool tieoffset, bool toy, const CostCalibration &calibration,
+                          NetworkComparator comparator, bool discretized) {
+    CostEstimate permutation = estimate_sort(PERMUTATION, n, delta, tieoffset, toy, calibration,
+                                             comparator == SWITCH_COMPARATOR ? SWITCH_COMPARATOR : RELU_COMPARATOR);
+    CostEstimate network = estimate_sort(NETWORK, n, delta, tieoffset, toy, calibration, comparator);
+
+    SortingType best = NONE;
+    if (permutation.feasible && (!network.feasible || permutation.seconds <= network.seconds)) best = PERMUTATION;
+    else if (network.feasible) best = NETWORK;
+
+    // Values on a coarse grid can be counted instead of compared
+    if (discretized) {
+        CostEstimate counting = estimate_sort(COUNTING, n, delta, tieoffset, toy, calibration);
+        double best_seconds = best == PERMUTATION ? permutation.seconds : network.seconds;
+
+        if (counting.feasible && (best == NONE || counting.seconds <= best_seconds)) best = COUNTING;
+    }
+
+    return best;
+}
+
+bool admit(const CostEstimate &estimate, double max_seconds, double max_memory_mb, string &reason) {
+    ostringstream why;
+
+    if (!estimate.feasible) {
+        why << "not feasible: " << estimate.reason;
+    } else if (max_seconds > 0 && estimate.seconds > max_seconds) {
+        why << "the predicted latency (" << estimate.seconds << "s) exceeds the limit of " << max_seconds << "s";
+    } else if (max_memory_mb > 0 && estimate.memory_mb() > max_memory_mb) {
+        why << "the predicted memory (" << estimate.memory_mb() << "MB) exceeds the limit of " << max_memory_mb << "MB";
+    }
+
+    reason = why.str();
+
+    return reason.empty();
+}
+
+void print_estimate(const CostEstimate &estimate, ostream &out) {
+    out << "Estimate for " << to_string(estimate.method) << " sorting, n: " << estimate.n << ", δ: " << estimate.delta << endl;
+
+    if (!estimate.feasible) {
+        out << "  Not feasible: " << estimate.reason << endl;
+        return;
+    }
+
+    const OperationCounts& c = estimate.counts;
+
+    out << "  Ring dimension: 2^" << (int) log2(estimate.ring_dim) << ", depth: " << estimate.depth
+        << ", large digits: " << estimate.large_digits << ", rotation keys: " << estimate.rotation_keys
+        << ", scaling: " << to_string(estimate.rescaling) << endl;
+    out << "  Key switches: " << c.key_switches() << " (" << c.rotations << " rotations, "
+        << c.ciphertext_mults << " ciphertext products)" << endl;
+    out << "  Plaintext products: " << c.plaintext_mults << ", additions: " << c.additions
+        << ", bootstraps: " << c.bootstraps << ", rescalings: " << c.rescales << ", cleaning polynomials: " << c.polynomials << endl;
+    if (c.switched_values > 0) out << "  Values compared by scheme switching: " << c.switched_values << endl;
+
+    out << "  Chebyshev evaluations: ";
+    for (auto it = c.chebyshev.begin(); it != c.chebyshev.end(); it++) {
+        out << (it == c.chebyshev.begin() ? "" : ", ") << it->second << " × degree " << it->first;
+    }
+    if (c.chebyshev.empty()) out << "none";
+    out << endl;
+
+    out << "  Predicted time: " << estimate.seconds << "s, memory: " << estimate.memory_mb() << "MB"
+        << " (keys: " << estimate.key_bytes / 1048576 << "MB, peak data: " << estimate.peak_data_bytes / 1048576 << "MB)"
+        << endl;
+
+    if (!estimate.calibrated) out << "  (default latencies: calibrate this machine with Benchmark --calibrate)" << endl;
+}
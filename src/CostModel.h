@@ -0,0 +1,292 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_COSTMODEL_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_COSTMODEL_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Utils.h"
+#include "Approximations.h"
+
+using namespace std;
+
+/*
+ * Operations performed by a sort, as counted by CountingController
+ */
+struct OperationCounts {
+    long additions = 0;             // Additions and subtractions
+    long plaintext_mults = 0;       // Products by plaintexts and scalars
+    long ciphertext_mults = 0;      // Products between ciphertexts, including those inside polynomial evaluations
+    long rotations = 0;
+    long bootstraps = 0;
+    long rescales = 0;              // Rescalings left to the sorters, outside the polynomials and the bootstrapping
+    long polynomials = 0;           // Cleaning polynomials (clean_sigmoid, clean_binary, ...)
+    long switched_values = 0;       // Slots compared in FHEW by scheme switching
+    map<int, long> chebyshev;       // Chebyshev evaluations, by degree
+
+    // Every product between ciphertexts is relinearized, every rotation is a key switch
+    long key_switches() const { return ciphertext_mults + rotations; }
+};
+
+/*
+ * Per-operation latencies of a machine. The defaults are rough figures for a 2^16 ring on a
+ * desktop CPU: run `Benchmark --calibrate <file>` once per machine and pass the file to the
+ * estimator for meaningful predictions.
+ */
+struct CostCalibration {
+    // The ring dimension and the number of RNS limbs of the ciphertexts the latencies were measured on
+    int ring_dim = 1 << 16;
+    int limbs = 30;
+
+    double add_ms = 0.5;
+    double plaintext_mult_ms = 1.5;
+    double ciphertext_mult_ms = 35;
+    double rotation_ms = 30;
+    double bootstrap_ms = 25000;
+    double rescale_ms = 6;
+
+    // One slot compared by scheme switching: its FHEW sign, plus its share of the CKKS-FHEW conversions
+    double switch_ms = 250;
+
+    // Measured Chebyshev evaluations, by degree (otherwise derived from the multiplications they perform)
+    map<int, double> chebyshev_ms;
+
+    // Measured peak RSS over the predicted size of keys and ciphertexts (allocator and context overheads)
+    double memory_scale = 1.0;
+
+    bool calibrated = false;
+
+    /**
+     * Read a calibration written by save(), one "name value" pair per line
+     *
+     * @param filename The calibration file
+     * @return The calibration, or the defaults if the file cannot be read
+     */
+    static CostCalibration load(const string& filename);
+
+    void save(const string& filename) const;
+};
+
+/*
+ * Predicted cost of sorting n values with a given method
+ */
+struct CostEstimate {
+    SortingType method = NONE;
+    int n = 0;
+    double delta = 0;
+
+    bool feasible = true;
+    string reason;                  // Why the configuration is not feasible
+
+    int ring_dim = 0;
+    int depth = 0;
+    int large_digits = 0;
+    int rotation_keys = 0;          // Including the bootstrapping ones
+    OperationCounts counts;
+
+    double seconds = 0;
+    uint64_t key_bytes = 0;
+    uint64_t peak_data_bytes = 0;   // Peak size of the live ciphertexts and plaintexts
+    double memory_scale = 1.0;
+    bool calibrated = false;
+    RescalingMode rescaling = AUTO_RESCALING;
+
+    double memory_mb() const { return (key_bytes + peak_data_bytes) * memory_scale / 1048576.0; }
+};
+
+struct CountingState;
+
+/*
+ * Stand-in for a ciphertext whose slots are never computed: only its level, its size and whether
+ * it carries a product not rescaled yet are tracked
+ */
+struct CountedCiphertext {
+    int level = 0;
+    uint32_t slots = 0;
+    int scale_degree = 1;
+    shared_ptr<CountingState> state;
+
+    size_t GetLevel() const { return level; }
+    uint32_t GetSlots() const { return slots; }
+    shared_ptr<CountedCiphertext> Clone() const;
+};
+
+struct CountedPlaintext {
+    int level = 0;
+    uint32_t slots = 0;
+
+    size_t GetLevel() const { return level; }
+    uint32_t GetSlots() const { return slots; }
+};
+
+/*
+ * Shared state of a CountingController: the context shape, the counters and the memory in use
+ */
+struct CountingState {
+    CostCalibration calibration;
+
+    int ring_dim = 1 << 16;
+    int depth = 0;
+    int large_digits = 3;
+    int bootstrap_level = 0;
+    int rotation_keys = 0;
+    int bootstrap_keys = 0;
+    int switching_keys = 0;         // Rotation keys of the CKKS-FHEW linear transforms
+    RescalingMode rescaling = AUTO_RESCALING;
+
+    OperationCounts counts;
+    double predicted_ms = 0;
+
+    uint64_t live_bytes = 0;
+    uint64_t peak_bytes = 0;
+
+    mutex lock;
+
+    // RNS limbs left to a ciphertext at the given level
+    int limbs(int level) const { return max(depth + 1 - level, 1); }
+
+    // Latency of an operation measured at the calibration limbs, rescaled to a ciphertext at `level`
+    double scaled(double ms, int level) const;
+
+    shared_ptr<CountedCiphertext> ciphertext(const shared_ptr<CountingState>& self, int level, uint32_t slots, int scale_degree = 1);
+    shared_ptr<CountedPlaintext> plaintext(const shared_ptr<CountingState>& self, int level, uint32_t slots);
+};
+
+/*
+ * Third backend of the sorting algorithms, next to FHEController and PlainController. It does
+ * not compute anything: running a sort over it walks the exact sequence of operations of the
+ * encrypted circuit, counting them and accumulating their predicted latency and memory.
+ */
+class CountingController {
+public:
+    using Ctxt = shared_ptr<CountedCiphertext>;
+    using Ptxt = shared_ptr<CountedPlaintext>;
+
+    /**
+     * @param rescaling The scaling technique of FHEController being modelled: the rescalings it
+     * performs, and the modulus the rotations run over
+     */
+    explicit CountingController(const CostCalibration& calibration = CostCalibration(), RescalingMode rescaling = AUTO_RESCALING);
+
+    int generate_context_network(int num_slots, int levels_required, bool toy_parameters, double delta);
+    void generate_rotation_keys_network(int num_slots);
+    void generate_context_permutation(int num_slots, int levels_required, bool toy, int n, double delta);
+    void generate_rotation_keys_permutation(int n);
+    void generate_rotation_key(int index);
+    void generate_scheme_switching_keys(int num_slots, bool toy_parameters);
+    void use_rotations(const vector<int>& indexes) {}
+    void prefetch_rotations(const vector<int>& indexes) {}
+
+    /**
+     * Collect what was counted so far
+     *
+     * @param estimate The estimate to be filled with the counts, the latency and the memory
+     */
+    void fill(CostEstimate& estimate) const;
+
+    Ptxt encode(const vector<double>& vec, int level, int num_slots);
+    Ptxt encode(double value, int level, int num_slots);
+    Ctxt encrypt(const vector<double>& vec, int level = 0, int plaintext_num_slots = 0);
+    Ctxt encrypt_expanded(const vector<double>& vec, int level = 0, int plaintext_num_slots = 0, int repetitions = 1);
+    Ctxt encrypt_repeated(const vector<double>& vec, int level = 0, int plaintext_num_slots = 0, int repetitions = 1);
+    vector<double> decode(const Ptxt& p);
+    Ptxt decrypt(const Ctxt& c);
+
+    Ctxt add(const Ctxt& c1, const Ctxt& c2);
+    Ctxt add(const Ctxt& c, const Ptxt& p);
+    Ctxt add(const Ctxt& c, double d);
+    Ctxt add_tree(vector<Ctxt> v);
+
+    Ctxt sub(const Ctxt& c1, const Ctxt& c2);
+    Ctxt sub(const Ctxt& c, const Ptxt& p);
+    Ctxt sub(double a, const Ctxt& c2);
+
+    Ctxt mult(const Ctxt& c, const Ptxt& p);
+    Ctxt mult(const Ctxt& c, double d);
+    Ctxt mult(const Ctxt& c1, const Ctxt& c2);
+
+    Ctxt rot(const Ctxt& c, int index);
+    Ctxt bootstrap(const Ctxt& c);
+    Ctxt compress(const Ctxt& c, int slots, int precision_bits);
+
+    Ctxt sigmoid(const Ctxt& in, int n, int degree, int scaling);
+    Ctxt rotsum(const Ctxt& in, int n);
+    Ctxt sinc(const Ctxt& in, int degree, double n);
+    Ctxt double_sinc(const Ctxt& in, int degree, double n);
+    Ctxt clean_binary(const Ctxt& in, double scale);
+    Ctxt clean_sign(const Ctxt& in);
+    Ctxt clean_sigmoid(const Ctxt& in, double n, int iterations = 1);
+    Ctxt clean_sigmoid_and_scale(const Ctxt& in, double n);
+
+    Ctxt relu(const Ctxt& in, int degree, int n);
+    Ctxt composite_sign(const Ctxt& in, const CompositeSign& sign);
+    Ctxt compare_switch(const Ctxt& c1, const Ctxt& c2);
+
+    void print(const Ctxt& c, int slots = 0, string prefix = "") {}
+
+    // Writing a ciphertext to disk costs no FHE operation; a counted ciphertext cannot be read back
+    void save(const Ctxt& c, const string& filename) {}
+    Ctxt load(const string& filename) { throw logic_error("A counted circuit has no ciphertext to load from " + filename); }
+
+private:
+    shared_ptr<CountingState> state;
+
+    // Records `count` operations at `level` costing `ms` each (at the calibration limbs)
+    void record(long& counter, long count, double ms, int level);
+
+    /*
+     * The input of an operation that needs a single scaling factor: rescaled if it carries a
+     * product, as both FLEXIBLEAUTO and FHEController::rescaled do
+     */
+    Ctxt rescaled(const Ctxt& c);
+
+    // The operands of a sum: the one carrying a product is rescaled only if the other does not
+    pair<Ctxt, Ctxt> aligned(const Ctxt& a, const Ctxt& b);
+
+    Ctxt chebyshev(const Ctxt& in, int degree);
+    Ctxt even_chebyshev(const Ctxt& in, int degree);
+    Ctxt cleaning(const Ctxt& in, int products, int levels);
+};
+
+/**
+ * Predict the cost of a sort, walking the same circuit that Sort would evaluate
+ *
+ * @param method PERMUTATION, NETWORK or COUNTING
+ * @param n The number of values to be sorted
+ * @param delta The minimum distance δ between the values (the step of their grid for COUNTING)
+ * @param tieoffset Whether the permutation-based sorting evaluates the tie-offset correction
+ * @param toy Whether the toy parameters are used
+ * @param calibration The per-operation latencies of the machine
+ * @param comparator The comparator of the network-based sorting; SWITCH_COMPARATOR also switches
+ * the comparisons of the permutation-based sorting
+ * @param rescaling The scaling technique of the contexts
+ * @return The estimate, possibly marked as not feasible
+ */
+CostEstimate estimate_sort(SortingType method, int n, double delta, bool tieoffset, bool toy,
+                           const CostCalibration& calibration, NetworkComparator comparator = RELU_COMPARATOR,
+                           RescalingMode rescaling = AUTO_RESCALING);
+
+/**
+ * Pick the feasible method with the lowest predicted latency
+ *
+ * @param discretized Whether the values lie on the grid of step δ, so that they can be counted
+ * @return PERMUTATION, NETWORK, COUNTING, or NONE if none is feasible
+ */
+SortingType choose_method(int n, double delta, bool tieoffset, bool toy, const CostCalibration& calibration,
+                          NetworkComparator comparator = RELU_COMPARATOR, bool discretized = false);
+
+/**
+ * Admission control: whether the estimated job fits the given limits
+ *
+ * @param max_seconds Maximum predicted latency (0 for no limit)
+ * @param max_memory_mb Maximum predicted memory (0 for no limit)
+ * @param reason Filled with the violated limit, if any
+ */
+bool admit(const CostEstimate& estimate, double max_seconds, double max_memory_mb, string& reason);
+
+void print_estimate(const CostEstimate& estimate, ostream& out = cout);
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_COSTMODEL_H
@@ -0,0 +1,90 @@
+#include "CountingSorting.h"
+#include "PlainController.h"
+#include "CostModel.h"
+
+template <class Controller>
+auto CountingSorting<Controller>::sort(const Ctxt& in) -> Ctxt {
+    TracePhase phase("counting.sort");
+
+    return compute_output(compute_offsets(compute_indicators(in)));
+}
+
+template <class Controller>
+auto CountingSorting<Controller>::compute_indicators(const Ctxt& in) -> Ctxt {
+    TracePhase phase("indicators");
+
+    /*
+     * The padding buckets repeat the last point of the grid, and the empty half is compared with
+     * the point δ: both give differences on the grid, where the sinc is exact
+     */
+    vector<double> grid(slots);
+    for (int s = 0; s < slots; s++) {
+        grid[s] = s < slots / 2 ? min(s / n, buckets - 1) * delta : delta;
+    }
+
+    Ctxt indicators = controller.sinc(controller.sub(in, controller.encode(grid, in->GetLevel(), slots)), degree_sinc, 1 / delta);
+
+    if (cleanings > 0) indicators = controller.clean_sigmoid(indicators, 1, cleanings);
+
+    return indicators;
+}
+
+template <class Controller>
+auto CountingSorting<Controller>::compute_offsets(const Ctxt& indicators) -> Ctxt {
+    TracePhase phase("offsets");
+
+    // Exclusive prefix sum over the slots: the rotations wrap into the empty half
+    Ctxt counts = controller.rot(indicators, -1);
+
+    for (int i = 0; i < log2(slots / 2); i++) {
+        int rotindex = pow(2, i);
+        counts = controller.add(counts, controller.rot(counts, -rotindex));
+    }
+
+    /*
+     * C_b sits at the start of block b: it is scaled by 1/n and repeated over the block. The padding
+     * buckets count the last point of the grid again and would leave [-1, 1]: they keep C_b = 0
+     */
+    vector<double> starts(slots, 0), positions(slots, 0);
+    for (int b = 0; b < padded_buckets; b++) {
+        if (b < buckets) starts[b * n] = 1.0 / n;
+
+        for (int p = 0; p < n; p++) positions[b * n + p] = (p + 0.5) / n;
+    }
+
+    counts = controller.mult(counts, controller.encode(starts, counts->GetLevel(), slots));
+
+    for (int i = 0; i < log2(n); i++) {
+        int rotindex = pow(2, i);
+        counts = controller.add(counts, controller.rot(counts, -rotindex));
+    }
+
+    return controller.sub(counts, controller.encode(positions, counts->GetLevel(), slots));
+}
+
+template <class Controller>
+auto CountingSorting<Controller>::compute_output(const Ctxt& offsets) -> Ctxt {
+    TracePhase phase("output");
+
+    // -1 where bucket b starts at or before position p
+    Ctxt starts = controller.composite_sign(offsets, sign);
+
+    // Position p holds the sum of the steps of the buckets started: (1 - sign) / 2 per step
+    vector<double> steps(slots, 0);
+    for (int b = 1; b < buckets; b++) {
+        for (int p = 0; p < n; p++) steps[b * n + p] = -delta / 2;
+    }
+
+    Ctxt values = controller.mult(starts, controller.encode(steps, starts->GetLevel(), slots));
+
+    for (int i = 0; i < log2(padded_buckets); i++) {
+        int rotindex = pow(2, i);
+        values = controller.add(values, controller.rot(values, n * rotindex));
+    }
+
+    return controller.add(values, (buckets - 1) * delta / 2);
+}
+
+template class CountingSorting<FHEController>;
+template class CountingSorting<PlainController>;
+template class CountingSorting<CountingController>;
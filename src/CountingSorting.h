@@ -0,0 +1,78 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_COUNTINGSORTING_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_COUNTINGSORTING_H
+
+#include "../src/FHEController.h"
+#include "SortingParameters.h"
+
+using namespace lbcrypto;
+using namespace std;
+
+
+/*
+ * Sorts values lying on the grid of step δ by counting them. Block b of n slots compares every
+ * value with the point b δ of the grid, giving the indicators of its bucket; their prefix sum
+ * counts, for every bucket, the values before it, and position p of the output takes the value of
+ * the last bucket starting at or before p. The cost depends on the 1/δ buckets, not on the
+ * distance between the values: n 1/δ slots instead of the n^2 of the permutation-based sorting,
+ * and no bootstrapping
+ */
+template <class Controller>
+class CountingSorting {
+    using Ctxt = typename Controller::Ctxt;
+    using Ptxt = typename Controller::Ptxt;
+
+    Controller controller;
+    int n;
+    double delta;
+    int buckets;
+    int padded_buckets;
+    int slots;
+    int degree_sinc;
+    int cleanings;
+    CompositeSign sign;
+    bool verbose;
+
+public:
+    /**
+     * @param controller The controller, a handle that can be shared with other sorts
+     * @param config The input shape and the parameters chosen by counting_parameters()
+     */
+    CountingSorting(Controller controller, const CountingConfig& config)
+            : controller(controller),
+              n(config.n),
+              delta(config.delta),
+              buckets(config.parameters.buckets),
+              padded_buckets(config.parameters.slots / (2 * config.n)),
+              slots(config.parameters.slots),
+              degree_sinc(config.parameters.degree_sinc),
+              cleanings(config.parameters.cleanings),
+              sign(config.parameters.sign),
+              verbose(config.verbose) {}
+
+    /**
+     * Sort values on the grid of step δ, repeated values included. It requires a context of
+     * config.parameters.slots slots and circuit_depth levels, and the rotation keys of
+     * generate_rotation_keys_network over the same slots
+     *
+     * @param in The n values, repeated once per padded bucket (encrypt_repeated) in the first
+     * half of the slots, the second half empty
+     * @return The sorted values, in the first n slots
+     */
+    Ctxt sort(const Ctxt& in);
+
+    /*
+     * The stages of sort(), exposed so that they can be measured in isolation
+     */
+
+    // Slot b n + i: 1 if x_i lies on the point b δ of the grid
+    Ctxt compute_indicators(const Ctxt& in);
+
+    // Slot b n + p: (C_b - p - 1/2) / n, with C_b the values in the buckets before b
+    Ctxt compute_offsets(const Ctxt& indicators);
+
+    // Slot p: the value of the last bucket with C_b <= p
+    Ctxt compute_output(const Ctxt& offsets);
+};
+
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_COUNTINGSORTING_H
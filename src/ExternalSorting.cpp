@@ -0,0 +1,253 @@
+#include "ExternalSorting.h"
+#include "PlainController.h"
+
+#include <filesystem>
+#include <set>
+
+// Reads up to `count` values, skipping separators; fewer are returned at the end of the input
+static vector<double> read_chunk(istream& input, int count) {
+    vector<double> chunk;
+
+    while ((int) chunk.size() < count) {
+        int c = input.peek();
+
+        if (c == EOF) break;
+
+        if (isspace(c) || c == ',' || c == '[' || c == ']') {
+            input.get();
+            continue;
+        }
+
+        double value;
+        if (!(input >> value)) break;
+
+        chunk.push_back(value);
+    }
+
+    return chunk;
+}
+
+template <class Controller>
+ExternalSorting<Controller>::ExternalSorting(Controller controller, const ExternalConfig& config, int circuit_depth)
+        : controller(controller),
+          config(config),
+          network(controller, config.network),
+          circuit_depth(circuit_depth),
+          layer_levels(network_layer_levels(config.network.parameters)) {
+    filesystem::create_directories(config.directory);
+}
+
+template <class Controller>
+long ExternalSorting<Controller>::generate_runs(istream &input) {
+    TracePhase phase("external.runs");
+
+    int n = config.run_size;
+    double scale = config.network.parameters.input_scale;
+
+    // The next chunk is read while the current one is sorted
+    future<vector<double>> next = async(launch::async, read_chunk, ref(input), n);
+
+    while (true) {
+        vector<double> chunk = next.get();
+        if (chunk.empty()) break;
+
+        values += chunk.size();
+        next = async(launch::async, read_chunk, ref(input), n);
+
+        chunk.resize(n, 1.0);
+        for (double& v : chunk) v *= scale;
+
+        // The network sorts the second half of the slots in descending order: odd runs go there
+        int first = runs % 2 == 0 ? 0 : n;
+        vector<double> slots(2 * n, 0);
+        copy(chunk.begin(), chunk.end(), slots.begin() + first);
+
+        Ctxt sorted = network.sort(controller.encrypt(slots, circuit_depth - layer_levels - 3, 2 * n));
+
+        // The other half only holds the approximation errors of the comparisons of zeros
+        store(runs++, controller.mult(sorted, range_mask(first, first + n, sorted->GetLevel())));
+
+        if (config.verbose) cout << "Run " << runs << " written (" << values << " values so far)" << endl;
+    }
+
+    // The merge network needs a power of two of runs: padding runs are already sorted, either way
+    while (runs < 2 || (runs & (runs - 1)) != 0) {
+        int first = runs % 2 == 0 ? 0 : n;
+        vector<double> slots(2 * n, 0);
+        fill(slots.begin() + first, slots.begin() + first + n, scale);
+
+        store(runs++, controller.encrypt(slots, circuit_depth - layer_levels - 3, 2 * n));
+    }
+
+    wait_writes();
+
+    return values;
+}
+
+template <class Controller>
+void ExternalSorting<Controller>::merge_runs() {
+    TracePhase phase("external.merge");
+
+    struct Comparator {
+        int low, high;
+        bool ascending;
+        bool descending_outputs;
+    };
+
+    /*
+     * Bitonic network over the runs. The next comparator of run i pairs it with run i ^ next, so the
+     * outputs are descending where i has the bit `next`: the runs it pairs then differ in order.
+     * The last comparators leave every run in ascending order
+     */
+    vector<Comparator> schedule;
+    for (int k = 2; k <= runs; k *= 2) {
+        for (int j = k / 2; j > 0; j /= 2) {
+            int next = j > 1 ? j / 2 : (2 * k <= runs ? k : 0);
+
+            for (int i = 0; i < runs; i++) {
+                int l = i ^ j;
+                if (l > i) schedule.push_back({i, l, (i & k) == 0, (i & next) != 0});
+            }
+        }
+    }
+
+    // Two runs are being merged, two more may be written behind: the rest of the budget is prefetched
+    int max_prefetched = max(0, config.max_resident - 4);
+    map<int, shared_future<Ctxt>> loaded;
+
+    for (size_t c = 0; c < schedule.size(); c++) {
+        const Comparator& comparator = schedule[c];
+
+        if (!loaded.count(comparator.low)) loaded[comparator.low] = fetch(comparator.low);
+        if (!loaded.count(comparator.high)) loaded[comparator.high] = fetch(comparator.high);
+
+        // Runs of the following comparators, up to the first one that depends on a run not written yet
+        set<int> busy = {comparator.low, comparator.high};
+
+        for (size_t d = c + 1; d < schedule.size(); d++) {
+            int low = schedule[d].low, high = schedule[d].high;
+
+            if (busy.count(low) || busy.count(high)) break;
+            if ((int) loaded.size() - 2 >= max_prefetched) break;
+
+            if (!loaded.count(low)) loaded[low] = fetch(low);
+            if (!loaded.count(high)) loaded[high] = fetch(high);
+            busy.insert(low);
+            busy.insert(high);
+        }
+
+        Ctxt first = loaded[comparator.low].get();
+        Ctxt second = loaded[comparator.high].get();
+        loaded.erase(comparator.low);
+        loaded.erase(comparator.high);
+
+        auto [lower, upper] = merge_split(first, second, comparator.descending_outputs);
+
+        // Outputs of the previous comparator are written while this one is computed
+        wait_writes();
+
+        store(comparator.low, comparator.ascending ? lower : upper);
+        store(comparator.high, comparator.ascending ? upper : lower);
+
+        if (config.verbose) cout << "Merge " << c + 1 << " / " << schedule.size() << " done." << endl;
+    }
+
+    wait_writes();
+}
+
+template <class Controller>
+vector<double> ExternalSorting<Controller>::read_run(int index) {
+    wait_writes();
+
+    vector<double> slots = controller.decode(controller.decrypt(controller.load(run_path(index))));
+    slots.resize(config.run_size);
+
+    for (double& v : slots) v /= config.network.parameters.input_scale;
+
+    return slots;
+}
+
+template <class Controller>
+void ExternalSorting<Controller>::remove_runs() {
+    wait_writes();
+
+    for (int i = 0; i < runs; i++) filesystem::remove(run_path(i));
+}
+
+template <class Controller>
+string ExternalSorting<Controller>::run_path(int index) const {
+    return config.directory + "/run-" + to_string(index) + ".bin";
+}
+
+template <class Controller>
+auto ExternalSorting<Controller>::fetch(int index) -> shared_future<Ctxt> {
+    shared_future<void> pending;
+
+    auto it = writes.find(index);
+    if (it != writes.end()) pending = it->second;
+
+    Controller loader = controller;
+    string path = run_path(index);
+
+    return async(launch::async, [loader, path, pending]() mutable {
+        if (pending.valid()) pending.wait();
+        return loader.load(path);
+    }).share();
+}
+
+template <class Controller>
+void ExternalSorting<Controller>::store(int index, const Ctxt &c) {
+    Controller writer = controller;
+    string path = run_path(index);
+
+    if (config.max_resident < 4) {
+        writer.save(c, path);
+        return;
+    }
+
+    writes[index] = async(launch::async, [writer, c, path]() mutable { writer.save(c, path); }).share();
+}
+
+template <class Controller>
+void ExternalSorting<Controller>::wait_writes() {
+    for (auto& [index, write] : writes) write.get();
+
+    writes.clear();
+}
+
+template <class Controller>
+auto ExternalSorting<Controller>::merge_split(const Ctxt &first, const Ctxt &second, bool descending) -> pair<Ctxt, Ctxt> {
+    TracePhase phase("merge_split");
+
+    int n = config.run_size;
+
+    // One run ascending in the first half, the other descending in the second: a bitonic sequence
+    Ctxt joined = controller.add(first, second);
+    Ctxt merged = network.merge(refresh(joined, layer_levels), descending);
+
+    // The lower half of an ascending merge is in the first half of the slots, of a descending one in the second
+    int lower_first = descending ? n : 0, upper_first = n - lower_first;
+
+    Ctxt lower = controller.mult(merged, range_mask(lower_first, lower_first + n, merged->GetLevel()));
+    Ctxt upper = controller.rot(controller.mult(merged, range_mask(upper_first, upper_first + n, merged->GetLevel())), n);
+
+    return {lower, upper};
+}
+
+template <class Controller>
+auto ExternalSorting<Controller>::refresh(const Ctxt &in, int levels) -> Ctxt {
+    if (circuit_depth - (int) in->GetLevel() > levels) return in;
+
+    return controller.bootstrap(in);
+}
+
+template <class Controller>
+auto ExternalSorting<Controller>::range_mask(int first, int last, int level) -> Ptxt {
+    vector<double> mask(2 * config.run_size, 0);
+    for (int i = first; i < last; i++) mask[i] = 1;
+
+    return controller.encode(mask, level, 2 * config.run_size);
+}
+
+template class ExternalSorting<FHEController>;
+template class ExternalSorting<PlainController>;
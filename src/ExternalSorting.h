@@ -0,0 +1,115 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_EXTERNALSORTING_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_EXTERNALSORTING_H
+
+#include <future>
+#include <istream>
+#include <map>
+
+#include "../src/FHEController.h"
+#include "NetworkSorting.h"
+#include "SortingParameters.h"
+
+using namespace lbcrypto;
+using namespace std;
+
+
+/*
+ * Sorts more values than fit a ciphertext, or memory. The input is streamed in runs of
+ * run_size values: each run is encrypted, sorted by the network-based sorting and written to
+ * disk. The runs are then merged by a bitonic network whose comparators are merge-split
+ * operations on two whole runs (merge them, keep the lower half in one and the upper half in
+ * the other), which sorts the concatenation of the runs as a comparator network sorts values.
+ *
+ * Only a bounded number of run ciphertexts is in memory: the two being merged, the ones
+ * prefetched for the following comparators and the ones still being written behind. Every run
+ * lives in a ciphertext of 2 * run_size slots, either in ascending order in the first half or in
+ * descending order in the second one. The two runs of a comparator are always one of each, so
+ * their sum is a bitonic sequence, and each comparator writes its outputs in the order that the
+ * next comparator of its runs needs: no run is ever reversed.
+ */
+template <class Controller>
+class ExternalSorting {
+    using Ctxt = typename Controller::Ctxt;
+    using Ptxt = typename Controller::Ptxt;
+
+    Controller controller;
+    ExternalConfig config;
+    NetworkSorting<Controller> network;
+    int circuit_depth;
+    int layer_levels;
+
+    int runs = 0;
+    long values = 0;
+
+    // Writes in progress, by run
+    map<int, shared_future<void>> writes;
+
+public:
+    /**
+     * @param controller A controller whose context was generated by generate_context_network for
+     * 2 * config.run_size slots, together with the corresponding rotation keys
+     * @param config The run size, the working set and the sorter of a single run
+     * @param circuit_depth The depth returned by generate_context_network
+     */
+    ExternalSorting(Controller controller, const ExternalConfig& config, int circuit_depth);
+
+    /**
+     * Stream the input in runs, sorting each of them and writing it to disk: the even runs in
+     * ascending order, the odd ones in descending order, as the first merges need them. The last run
+     * is padded with the largest admitted value (1), and padding runs are added up to a power of two
+     *
+     * @param input Space-, comma- or newline-separated values in [0, 1)
+     * @return The number of values read
+     */
+    long generate_runs(istream& input);
+
+    /**
+     * Merge the runs written by generate_runs: afterwards, the concatenation of the runs is sorted
+     */
+    void merge_runs();
+
+    /**
+     * Decrypt a run
+     *
+     * @param index The run, in [0, run_count())
+     * @return Its run_size values, in ascending order and in the scale of the input
+     */
+    vector<double> read_run(int index);
+
+    int run_count() const { return runs; }
+    long value_count() const { return values; }
+
+    /**
+     * Delete the run files
+     */
+    void remove_runs();
+
+private:
+    string run_path(int index) const;
+
+    // Loads a run in the background, after its pending write (if any) is done
+    shared_future<Ctxt> fetch(int index);
+
+    // Writes a run in the background, or in the foreground without write-behind
+    void store(int index, const Ctxt& c);
+    void wait_writes();
+
+    /**
+     * Merge-split of two runs, one ascending in the first half of the slots and the other
+     * descending in the second half
+     *
+     * @param descending Whether the two halves of the merge are returned in descending order, in
+     * the second half of the slots, or in ascending order, in the first half
+     * @return The lower and the upper half of their merge
+     */
+    pair<Ctxt, Ctxt> merge_split(const Ctxt& first, const Ctxt& second, bool descending);
+
+    // Bootstraps the ciphertext unless `levels` levels are left (plus the one bootstrapping requires)
+    Ctxt refresh(const Ctxt& in, int levels);
+
+    // One over the slots [first, last) of a ciphertext, zero elsewhere
+    Ptxt range_mask(int first, int last, int level);
+};
+
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_EXTERNALSORTING_H
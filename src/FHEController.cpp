@@ -3,8 +3,93 @@
 //
 
 #include "FHEController.h"
+#include "SortingPlan.h"
+
+#include <fstream>
+
+// Size in memory of a ciphertext, as reported in the operation traces
+static uint64_t ciphertext_bytes(const Ctxt& c) {
+    const auto& elements = c->GetElements();
+    if (elements.empty()) return 0;
+
+    return elements.size() * elements[0].GetNumOfElements() * elements[0].GetRingDimension() * sizeof(uint64_t);
+}
+
+/*
+ * Evaluates `f` recording its duration, the input/output levels and the output size in the Tracer
+ */
+template <typename F>
+static Ctxt traced(OperationKind kind, const Ctxt& in, F&& f) {
+    Tracer& tracer = Tracer::instance();
+    if (!tracer.enabled()) return f();
+
+    int64_t start = tracer.now();
+    tracer.begin_operation();
+
+    Ctxt out;
+    try {
+        out = f();
+    } catch (...) {
+        tracer.end_operation(kind, start, in->GetLevel(), in->GetLevel(), 0);
+        throw;
+    }
+
+    tracer.end_operation(kind, start, in->GetLevel(), out->GetLevel(), ciphertext_bytes(out));
+    return out;
+}
+
+template <typename F>
+static Ptxt traced_plaintext(OperationKind kind, int level, F&& f) {
+    Tracer& tracer = Tracer::instance();
+    if (!tracer.enabled()) return f();
+
+    int64_t start = tracer.now();
+    tracer.begin_operation();
+
+    Ptxt out;
+    try {
+        out = f();
+    } catch (...) {
+        tracer.end_operation(kind, start, level, level, 0);
+        throw;
+    }
+
+    tracer.end_operation(kind, start, level, level, 0);
+    return out;
+}
+
+template <typename F>
+static Ctxt traced_encryption(int level, F&& f) {
+    Tracer& tracer = Tracer::instance();
+    if (!tracer.enabled()) return f();
+
+    int64_t start = tracer.now();
+    tracer.begin_operation();
+
+    Ctxt out;
+    try {
+        out = f();
+    } catch (...) {
+        tracer.end_operation(OP_ENCRYPT, start, level, level, 0);
+        throw;
+    }
+
+    tracer.end_operation(OP_ENCRYPT, start, level, out->GetLevel(), ciphertext_bytes(out));
+    return out;
+}
+
+static ScalingTechnique scaling_technique(RescalingMode mode) {
+    switch (mode) {
+        case AUTO_EXT_RESCALING: return FLEXIBLEAUTOEXT;
+        case MANUAL_RESCALING: return FIXEDMANUAL;
+        default: return FLEXIBLEAUTO;
+    }
+}
 
 int FHEController::generate_context_network(int num_slots, int levels_required, bool toy_parameters, double delta) {
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+    state->rotation_indexes.clear();
+
     CCParams<CryptoContextCKKSRNS> parameters;
 
     parameters.SetSecretKeyDist(SPARSE_TERNARY);
@@ -38,7 +123,7 @@ int FHEController::generate_context_network(int num_slots, int levels_required,
 
     parameters.SetBatchSize(num_slots);
 
-    ScalingTechnique rescaleTech = FLEXIBLEAUTO;
+    ScalingTechnique rescaleTech = scaling_technique(state->rescaling);
 
     parameters.SetScalingModSize(dcrtBits);
     parameters.SetScalingTechnique(rescaleTech);
@@ -50,29 +135,40 @@ int FHEController::generate_context_network(int num_slots, int levels_required,
 
     parameters.SetMultiplicativeDepth(circuit_depth);
 
-    context = GenCryptoContext(parameters);
-    context->Enable(PKE);
-    context->Enable(KEYSWITCH);
-    context->Enable(LEVELEDSHE);
-    context->Enable(ADVANCEDSHE);
-    context->Enable(FHE);
+    state->context = GenCryptoContext(parameters);
+    state->context->Enable(PKE);
+    state->context->Enable(KEYSWITCH);
+    state->context->Enable(LEVELEDSHE);
+    state->context->Enable(ADVANCEDSHE);
+    state->context->Enable(FHE);
 
-    key_pair = context->KeyGen();
+    state->key_pair = state->context->KeyGen();
 
-    print_moduli_chain(key_pair.publicKey->GetPublicElements()[0]);
+    print_moduli_chain(state->key_pair.publicKey->GetPublicElements()[0]);
     cout << endl;
 
-    context->EvalMultKeyGen(key_pair.secretKey);
+    state->context->EvalMultKeyGen(state->key_pair.secretKey);
+
+    state->context->EvalBootstrapSetup(level_budget, {0, 0}, num_slots);
+    state->context->EvalBootstrapKeyGen(state->key_pair.secretKey, num_slots);
 
-    context->EvalBootstrapSetup(level_budget, {0, 0}, num_slots);
-    context->EvalBootstrapKeyGen(key_pair.secretKey, num_slots);
+    state->circuit_depth = circuit_depth;
+    state->level_budget = level_budget;
+    state->bootstrap_slots = num_slots;
 
+    state->bootstrap_keys.clear();
+    for (const auto& [automorphism, key] : state->context->GetEvalAutomorphismKeyMap(state->key_pair.secretKey->GetKeyTag())) {
+        state->bootstrap_keys.insert(automorphism);
+    }
 
     return circuit_depth;
 }
 
 
 void FHEController::generate_context_permutation(int num_slots, int levels_required, bool toy, int n, double delta) {
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+    state->rotation_indexes.clear();
+
     CCParams<CryptoContextCKKSRNS> parameters;
 
     parameters.SetSecretKeyDist(lbcrypto::SPARSE_ENCAPSULATED);
@@ -83,6 +179,7 @@ void FHEController::generate_context_permutation(int num_slots, int levels_requi
     if (toy) {
         parameters.SetSecurityLevel(lbcrypto::HEStd_NotSet);
 
+        if (num_slots <= 1 << 15) parameters.SetRingDim(1 << 16);
         if (num_slots <= 1 << 14) parameters.SetRingDim(1 << 15);
         if (num_slots <= 1 << 13) parameters.SetRingDim(1 << 14);
         if (num_slots <= 1 << 12) parameters.SetRingDim(1 << 13);
@@ -97,7 +194,7 @@ void FHEController::generate_context_permutation(int num_slots, int levels_requi
 
     parameters.SetBatchSize(num_slots);
 
-    ScalingTechnique rescaleTech = FLEXIBLEAUTO;
+    ScalingTechnique rescaleTech = scaling_technique(state->rescaling);
 
     parameters.SetScalingModSize(dcrtBits);
     parameters.SetScalingTechnique(rescaleTech);
@@ -126,47 +223,177 @@ void FHEController::generate_context_permutation(int num_slots, int levels_requi
 
     parameters.SetMultiplicativeDepth(levels_required);
 
-    context = GenCryptoContext(parameters);
-    context->Enable(PKE);
-    context->Enable(KEYSWITCH);
-    context->Enable(LEVELEDSHE);
-    context->Enable(ADVANCEDSHE);
-    //context->Enable(FHE);
+    state->circuit_depth = levels_required;
+    state->level_budget.clear();
+    state->bootstrap_slots = 0;
+    state->bootstrap_keys.clear();
+
+    state->context = GenCryptoContext(parameters);
+    state->context->Enable(PKE);
+    state->context->Enable(KEYSWITCH);
+    state->context->Enable(LEVELEDSHE);
+    state->context->Enable(ADVANCEDSHE);
+    //state->context->Enable(FHE);
 
-    key_pair = context->KeyGen();
+    state->key_pair = state->context->KeyGen();
 
-    print_moduli_chain(key_pair.publicKey->GetPublicElements()[0]);
+    print_moduli_chain(state->key_pair.publicKey->GetPublicElements()[0]);
 
     cout << ", λ >= 128 bits" << endl;
 
-    context->EvalMultKeyGen(key_pair.secretKey);
+    state->context->EvalMultKeyGen(state->key_pair.secretKey);
 
 }
 
 void FHEController::generate_rotation_keys_network(int num_slots) {
-    vector<int> rotations;
+    generate_rotation_keys(network_plan(num_slots).rotation_indexes());
+}
 
-    for (int i = 0; i < log2(num_slots); i++) {
-        rotations.push_back(pow(2, i));
-        rotations.push_back(-pow(2, i));
+void FHEController::generate_rotation_keys_permutation(int n) {
+    for (int i = 0; i < log2(n); i++) {
+        generate_rotation_key(pow(2, i) * n);
+        generate_rotation_key(pow(2, i));
     }
+}
 
-    context->EvalRotateKeyGen(key_pair.secretKey, rotations);
+void FHEController::generate_scheme_switching_keys(int num_slots, bool toy_parameters) {
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+
+    state->context->Enable(SCHEMESWITCH);
+
+    SchSwchParams parameters;
+    parameters.SetSecurityLevelCKKS(toy_parameters ? HEStd_NotSet : HEStd_128_classic);
+    parameters.SetSecurityLevelFHEW(toy_parameters ? TOY : STD128);
+    parameters.SetCtxtModSizeFHEWLargePrec(25);
+    parameters.SetNumSlotsCKKS(num_slots);
+    parameters.SetNumValues(num_slots);
+
+    auto lwe_secret_key = state->context->EvalSchemeSwitchingSetup(parameters);
+    state->context->EvalSchemeSwitchingKeyGen(state->key_pair, lwe_secret_key);
+
+    // Plaintext modulus of the switched differences, within the large-precision space of FHEW (2^25 / 2β).
+    // A CKKS value d is read as the FHEW message d * scaleSign mod pLWE: the differences in (-1, 1) take
+    // the whole half-range, not a fraction of one step
+    state->context->EvalCompareSwitchPrecompute(1 << (SCHEME_SWITCH_PRECISION_BITS + 1), 1 << SCHEME_SWITCH_PRECISION_BITS);
 }
 
 void FHEController::generate_rotation_key(int index) {
+    generate_rotation_keys({index});
+}
+
+void FHEController::generate_rotation_keys(const vector<int>& indexes) {
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+
     vector<int> rotations;
 
-    rotations.push_back(index);
+    for (int index : indexes) {
+        if (state->rotation_indexes.insert(index).second) rotations.push_back(index);
+    }
 
-    context->EvalRotateKeyGen(key_pair.secretKey, rotations);
+    if (!rotations.empty()) state->context->EvalRotateKeyGen(state->key_pair.secretKey, rotations);
+
+    if (!state->offload_directory.empty()) offload(rotations);
+}
+
+void FHEController::offload_rotation_keys(const string &directory) {
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+
+    state->offload_directory = directory;
+    offload(vector<int>(state->rotation_indexes.begin(), state->rotation_indexes.end()));
+}
+
+void FHEController::use_rotations(const vector<int> &indexes) {
+    if (state->offload_directory.empty()) return;
+
+    TracePhase phase("load keys");
+
+    // Waits for the rotations in progress, which hold the keys under the shared lock
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+
+    auto& keys = state->context->GetEvalAutomorphismKeyMap(state->key_pair.secretKey->GetKeyTag());
+    set<uint32_t> needed = offloaded_automorphisms(indexes);
+
+    for (uint32_t automorphism : offloaded_automorphisms(vector<int>(state->rotation_indexes.begin(), state->rotation_indexes.end()))) {
+        if (!needed.count(automorphism)) keys.erase(automorphism);
+    }
+
+    for (uint32_t automorphism : needed) {
+        if (keys.count(automorphism)) continue;
+
+        auto prefetched = state->prefetched.find(automorphism);
+
+        if (prefetched != state->prefetched.end()) {
+            keys[automorphism] = prefetched->second.get();
+        } else {
+            EvalKey<DCRTPoly> key;
+            if (!Serial::DeserializeFromFile(offloaded_key_path(automorphism), key, SerType::BINARY)) {
+                throw runtime_error("Could not read the rotation key " + offloaded_key_path(automorphism));
+            }
+            keys[automorphism] = key;
+        }
+    }
+
+    // Prefetched keys are only kept until the stage they were loaded for
+    state->prefetched.clear();
+}
+
+void FHEController::prefetch_rotations(const vector<int> &indexes) {
+    if (state->offload_directory.empty()) return;
+
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+
+    for (uint32_t automorphism : offloaded_automorphisms(indexes)) {
+        if (state->prefetched.count(automorphism)) continue;
+
+        string path = offloaded_key_path(automorphism);
+
+        state->prefetched[automorphism] = async(launch::async, [path]() {
+            EvalKey<DCRTPoly> key;
+            if (!Serial::DeserializeFromFile(path, key, SerType::BINARY)) {
+                throw runtime_error("Could not read the rotation key " + path);
+            }
+            return key;
+        }).share();
+    }
+}
+
+set<uint32_t> FHEController::offloaded_automorphisms(const vector<int> &indexes) const {
+    set<uint32_t> automorphisms;
+
+    for (int index : indexes) {
+        uint32_t automorphism = FindAutomorphismIndex2nComplex(index, state->context->GetCyclotomicOrder());
+        if (!state->bootstrap_keys.count(automorphism)) automorphisms.insert(automorphism);
+    }
+
+    return automorphisms;
+}
+
+string FHEController::offloaded_key_path(uint32_t automorphism) const {
+    return state->offload_directory + "/rotation-" + to_string(automorphism) + ".bin";
+}
+
+void FHEController::offload(const vector<int> &indexes) {
+    auto& keys = state->context->GetEvalAutomorphismKeyMap(state->key_pair.secretKey->GetKeyTag());
+
+    for (uint32_t automorphism : offloaded_automorphisms(indexes)) {
+        auto key = keys.find(automorphism);
+        if (key == keys.end()) continue;
+
+        if (!Serial::SerializeToFile(offloaded_key_path(automorphism), key->second, SerType::BINARY)) {
+            throw runtime_error("Could not write the rotation key " + offloaded_key_path(automorphism));
+        }
+
+        keys.erase(key);
+    }
 }
 
 Ptxt FHEController::encode(const vector<double> &vec, int level, int num_slots) {
-    Ptxt p = context->MakeCKKSPackedPlaintext(vec, 1, level, nullptr, num_slots);
-    p->SetLength(num_slots);
+    return traced_plaintext(OP_ENCODE, level, [&] {
+        Ptxt p = state->context->MakeCKKSPackedPlaintext(vec, 1, level, nullptr, num_slots);
+        p->SetLength(num_slots);
 
-    return p;
+        return p;
+    });
 }
 
 Ptxt FHEController::encode(double value, int level, int num_slots) {
@@ -177,9 +404,11 @@ Ptxt FHEController::encode(double value, int level, int num_slots) {
 }
 
 Ctxt FHEController::encrypt(const vector<double> &vec, int level, int num_slots) {
-    Ptxt p = encode(vec, level, num_slots);
+    return traced_encryption(level, [&] {
+        Ptxt p = encode(vec, level, num_slots);
 
-    return context->Encrypt(p, key_pair.publicKey);
+        return state->context->Encrypt(p, state->key_pair.publicKey);
+    });
 }
 
 Ctxt FHEController::encrypt_expanded(const vector<double> &vec, int level, int num_slots, int repetitions) {
@@ -191,9 +420,11 @@ Ctxt FHEController::encrypt_expanded(const vector<double> &vec, int level, int n
         }
     }
 
-    Ptxt p = encode(repeated, level, num_slots);
+    return traced_encryption(level, [&] {
+        Ptxt p = encode(repeated, level, num_slots);
 
-    return context->Encrypt(p, key_pair.publicKey);
+        return state->context->Encrypt(p, state->key_pair.publicKey);
+    });
 }
 
 Ctxt FHEController::encrypt_repeated(const vector<double> &vec, int level, int num_slots, int repetitions) {
@@ -205,9 +436,11 @@ Ctxt FHEController::encrypt_repeated(const vector<double> &vec, int level, int n
         }
     }
 
-    Ptxt p = encode(repeated, level, num_slots);
+    return traced_encryption(level, [&] {
+        Ptxt p = encode(repeated, level, num_slots);
 
-    return context->Encrypt(p, key_pair.publicKey);
+        return state->context->Encrypt(p, state->key_pair.publicKey);
+    });
 }
 
 vector<double> FHEController::decode(const Ptxt& p) {
@@ -215,63 +448,143 @@ vector<double> FHEController::decode(const Ptxt& p) {
 }
 
 Ptxt FHEController::decrypt(const Ctxt &c) {
-    Ptxt p;
-    context->Decrypt(key_pair.secretKey, c, &p);
+    return traced_plaintext(OP_DECRYPT, c->GetLevel(), [&] {
+        Ptxt p;
+        state->context->Decrypt(state->key_pair.secretKey, rescaled(c), &p);
 
-    return p;
+        return p;
+    });
 }
 
 Ctxt FHEController::add(const Ctxt &a, const Ctxt &b) {
-    return context->EvalAdd(a, b);
+    auto [x, y] = aligned(a, b);
+
+    return traced(OP_ADD, x, [&] { return state->context->EvalAdd(x, y); });
 }
 
+// Plaintexts are encoded at the scaling factor of a rescaled ciphertext
 Ctxt FHEController::add(const Ctxt &a, const Ptxt &b) {
-    Ptxt temp(b);
-    return context->EvalAdd(a, temp);
+    Ctxt x = rescaled(a);
+
+    return traced(OP_ADD, x, [&] {
+        Ptxt temp(b);
+        return state->context->EvalAdd(x, temp);
+    });
 }
 
 Ctxt FHEController::add(const Ctxt &a, double d) {
-    Ptxt temp(encode(d, a->GetLevel(), a->GetSlots()));
-    return context->EvalAdd(a, temp);
+    Ctxt x = rescaled(a);
+
+    return traced(OP_ADD, x, [&] {
+        Ptxt temp(encode(d, x->GetLevel(), x->GetSlots()));
+        return state->context->EvalAdd(x, temp);
+    });
 }
 
 Ctxt FHEController::add_tree(vector<Ctxt> v) {
-    return context->EvalAddMany(v);
+    // Terms that are all products not rescaled yet are summed as they are, and rescaled once
+    bool mixed = false;
+    for (const Ctxt& c : v) mixed |= c->GetNoiseScaleDeg() != v[0]->GetNoiseScaleDeg();
+
+    if (mixed) for (Ctxt& c : v) c = rescaled(c);
+
+    return traced(OP_ADD, v[0], [&] { return state->context->EvalAddMany(v); });
 }
 
 Ctxt FHEController::sub(double a, const Ctxt &b) {
-    return context->EvalSub(a, b);
+    Ctxt y = rescaled(b);
+
+    return traced(OP_SUB, y, [&] { return state->context->EvalSub(a, y); });
 }
 
 Ctxt FHEController::sub(const Ctxt &a, const Ctxt &b) {
-    return context->EvalSub(a, b);
+    auto [x, y] = aligned(a, b);
+
+    return traced(OP_SUB, x, [&] { return state->context->EvalSub(x, y); });
 }
 
 Ctxt FHEController::sub(const Ctxt &c, const Ptxt &p) {
-    Ptxt temp(p);
-    return context->EvalSub(c, temp);
+    Ctxt x = rescaled(c);
+
+    return traced(OP_SUB, x, [&] {
+        Ptxt temp(p);
+        return state->context->EvalSub(x, temp);
+    });
 }
 
 Ctxt FHEController::mult(const Ctxt &c, const Ptxt& p) {
-    return context->EvalMult(c, p);
+    Ctxt x = rescaled(c);
+
+    return traced(OP_MULT, x, [&] { return state->context->EvalMult(x, p); });
 }
 
 Ctxt FHEController::mult(const Ctxt &c1, const Ctxt &c2) {
-    return context->EvalMult(c1, c2);
+    Ctxt x = rescaled(c1), y = rescaled(c2);
+
+    return traced(OP_MULT, x, [&] { return state->context->EvalMult(x, y); });
 }
 
 Ctxt FHEController::mult(const Ctxt &c, double v) {
-    return context->EvalMult(c, encode(v, c->GetLevel(), c->GetSlots()));
+    Ctxt x = rescaled(c);
+
+    return traced(OP_MULT, x, [&] { return state->context->EvalMult(x, encode(v, x->GetLevel(), x->GetSlots())); });
 }
 
+// A rotation after the rescaling switches keys over one modulus less
 Ctxt FHEController::rot(const Ctxt& c, int index) {
-    return context->EvalRotate(c, index);
+    Ctxt x = rescaled(c);
+
+    shared_lock<shared_mutex> lock(state->keys_mutex);
+
+    return traced(OP_ROT, x, [&] { return state->context->EvalRotate(x, index); });
 }
 
 Ctxt FHEController::bootstrap(const Ctxt &c) {
-    return context->EvalBootstrap(c);
+    Ctxt x = rescaled(c);
+
+    shared_lock<shared_mutex> lock(state->keys_mutex);
+
+    return traced(OP_BOOTSTRAP, x, [&] { return state->context->EvalBootstrap(x); });
+}
+
+Ctxt FHEController::rescaled(const Ctxt &c) {
+    if (state->rescaling != MANUAL_RESCALING || c->GetNoiseScaleDeg() < 2) return c;
+
+    return traced(OP_RESCALE, c, [&] { return state->context->Rescale(c); });
+}
+
+pair<Ctxt, Ctxt> FHEController::aligned(const Ctxt &a, const Ctxt &b) {
+    if (a->GetNoiseScaleDeg() == b->GetNoiseScaleDeg()) return {a, b};
+
+    return {rescaled(a), rescaled(b)};
 }
 
+Ctxt FHEController::compress(const Ctxt &c, int slots, int precision_bits) {
+    Ctxt x = rescaled(c);
+
+    /*
+     * Dropping towers keeps the scaling factor, and with it the precision: the lowest modulus that
+     * keeps precision_bits is the first one that still holds the scaled values, in [-1, 1], with
+     * their sign. With the default moduli the first tower is enough
+     */
+    double scale_bits = log2(x->GetScalingFactor());
+    if (scale_bits < precision_bits) {
+        cerr << "The scaling factor (" << scale_bits << " bits) cannot keep " << precision_bits << " bits of precision" << endl;
+    }
+
+    const auto& towers = x->GetElements()[0].GetParams()->GetParams();
+    uint32_t towers_left = 0;
+    double modulus_bits = 0;
+
+    while (towers_left < towers.size() && modulus_bits < scale_bits + 2) {
+        modulus_bits += log2(towers[towers_left++]->GetModulus().ConvertToDouble());
+    }
+
+    Ctxt result = state->context->Compress(x, max(towers_left, 1u));
+    result->SetSlots(slots);
+
+    return result;
+}
 
 Ctxt FHEController::rotsum(const Ctxt &in, int n) {
     Ctxt result = add(in, rot(in, n));
@@ -284,91 +597,234 @@ Ctxt FHEController::rotsum(const Ctxt &in, int n) {
 }
 
 Ctxt FHEController::sigmoid(const Ctxt &in, int n, int degree, int scaling) {
-    return context->EvalChebyshevFunction([scaling, n](double x) -> double {
-        return 1/(n + n * exp(-scaling*x));
+    Ctxt x = rescaled(in);
 
-    }, in, -1, 1, degree);
+    return traced(OP_CHEBYSHEV, x, [&] {
+        return state->context->EvalChebyshevFunction(sigmoid_function(n, scaling), x, -1, 1, degree);
+    });
 }
 
-Ctxt FHEController::clean_sigmoid(const Ctxt &in, double n) {
-    //(-n^2 * 2)x^3 + (n * 3)x^2
-    Ctxt sq = context->EvalSquare(in);
-    double t1 = n * 3;
-    double t2 = -n * n * 2;
-    Ctxt t2end = context->EvalMult(in, t2);
-    t2end = context->EvalMult(t2end, sq);
+Ctxt FHEController::cubic_cleaning(const Ctxt &in, double a, double b) {
+    Ctxt x = rescaled(in);
+    Ctxt square = state->context->EvalSquare(x);
+
+    Ctxt linear = state->context->EvalMult(x, b);
+    state->context->EvalAddInPlace(linear, a);
 
-    return context->EvalAdd(context->EvalMult(sq, t1), t2end);
+    return state->context->EvalMult(rescaled(square), rescaled(linear));
 }
 
-Ctxt FHEController::clean_sigmoid_and_scale(const Ctxt &in, double n) {
-    //(-n^2 * 2)x^3 + (n * 3)x^2
-    Ctxt sq = context->EvalSquare(in);
-    double t1 = n * 3;
-    double t2 = -n * 2;
-    Ctxt t2end = context->EvalMult(in, t2);
-    t2end = context->EvalMult(t2end, sq);
+Ctxt FHEController::clean_sigmoid(const Ctxt &in, double n, int iterations) {
+    return traced(OP_POLY, in, [&] {
+        //(-n^2 * 2)x^3 + (n * 3)x^2
+        Ctxt result = in;
+        for (int i = 0; i < iterations; i++) result = cubic_cleaning(result, n * 3, -n * n * 2);
 
-    return context->EvalAdd(context->EvalMult(sq, t1), t2end);
+        return result;
+    });
+}
+
+Ctxt FHEController::clean_sigmoid_and_scale(const Ctxt &in, double n) {
+    return traced(OP_POLY, in, [&] {
+        //(-n * 2)x^3 + (n * 3)x^2
+        return cubic_cleaning(in, n * 3, -n * 2);
+    });
 }
 
 
 Ctxt FHEController::sinc(const Ctxt &in, int poly_degree, double n) {
-    return context->EvalChebyshevFunction([n](double x) -> double { const double a = n * M_PI;
-                                              if (std::abs(x) < 1e-6)
-                                              {
-                                                  double t = a * x;
-                                                  return 1.0 - (t * t) / 6.0;  // Taylor 2° ordine
-                                              }
-                                              else
-                                              {
-                                                  return std::sin(a * x) / (a * x);
-                                              } },
-                                          in,
-                                          -1,
-                                          1, poly_degree);
+    if (even_evaluation_fits(poly_degree)) return even_chebyshev(in, sinc_function(n), poly_degree);
+
+    Ctxt x = rescaled(in);
+
+    return traced(OP_CHEBYSHEV, x, [&] {
+        return state->context->EvalChebyshevFunction(sinc_function(n), x, -1, 1, poly_degree);
+    });
 }
 
 
 
 Ctxt FHEController::double_sinc(const Ctxt &in, int poly_degree, double n) {
-    return context->EvalChebyshevFunction([n](double x) -> double { return sin(3.14159265358979323846 * x * n) / (3.14159265358979323846 * x * n) * sin(3.14159265358979323846 * x * n) / (3.14159265358979323846 * x * n); },
-                                          in,
-                                          -1,
-                                          1, poly_degree);
+    if (even_evaluation_fits(poly_degree)) return even_chebyshev(in, double_sinc_function(n), poly_degree);
+
+    Ctxt x = rescaled(in);
+
+    return traced(OP_CHEBYSHEV, x, [&] {
+        return state->context->EvalChebyshevFunction(double_sinc_function(n), x, -1, 1, poly_degree);
+    });
 }
 
 Ctxt FHEController::relu(const Ctxt &in, int poly_degree, int n) {
-    return context->EvalChebyshevFunction([](double x) -> double { if (x > 0) return x; return 0; },
-                                          in,
-                                          -1,
-                                          1, poly_degree);
+    // x / 2 costs a level on the input only, far less deep than the series
+    if (even_evaluation_fits(poly_degree)) return add(even_chebyshev(in, relu_even_function(), poly_degree), mult(in, 0.5));
+
+    Ctxt x = rescaled(in);
+
+    return traced(OP_CHEBYSHEV, x, [&] {
+        return state->context->EvalChebyshevFunction(relu_function(), x, -1, 1, poly_degree);
+    });
 }
 
-Ctxt FHEController::clean_binary(const Ctxt &in, double scale) {
-    //3x^2 - 2x^3
+Ctxt FHEController::even_chebyshev(const Ctxt &in, const function<double(double)> &f, int degree) {
+    Ctxt square = rescaled(mult(in, in));
 
+    return traced(OP_CHEBYSHEV, square, [&] {
+        return state->context->EvalChebyshevFunction([f](double y) { return f(sqrt(y)); }, square, 0, 1, degree / 2);
+    });
+}
 
-    //Scalato sarebbe 3/scale * (scale*x)^2 - 2/scale * (scale*x)^3
+Ctxt FHEController::composite_sign(const Ctxt &in, const CompositeSign &sign) {
+    Ctxt result = in;
 
-    cout << "Livello in: " << in->GetLevel() << endl;
+    for (const vector<double>& stage : sign.stages()) {
+        result = rescaled(result);
+        result = traced(OP_POLY, result, [&] { return state->context->EvalPoly(result, stage); });
+    }
 
-    Ctxt square = context->EvalSquare(in);
-    Ctxt twox = context->EvalMult(in, 2.0/scale);
+    return result;
+}
 
-    Ctxt term1 = context->EvalMult(square, 3.0/scale);
-    Ctxt term2 = context->EvalMult(twox, square);
+Ctxt FHEController::compare_switch(const Ctxt &c1, const Ctxt &c2) {
+    Ctxt x = rescaled(c1), y = rescaled(c2);
 
-    cout << "Livello out: " << context->EvalSub(term1, term2)->GetLevel() << endl;
+    shared_lock<shared_mutex> lock(state->keys_mutex);
 
-    return context->EvalSub(term1, term2);
+    return traced(OP_SWITCH, x, [&] {
+        return state->context->EvalCompareSchemeSwitching(x, y, x->GetSlots(), x->GetSlots(),
+                                                          1 << (SCHEME_SWITCH_PRECISION_BITS + 1),
+                                                          1 << SCHEME_SWITCH_PRECISION_BITS);
+    });
+}
+
+Ctxt FHEController::clean_binary(const Ctxt &in, double scale) {
+    return traced(OP_POLY, in, [&] {
+        //3x^2 - 2x^3, scaled: 3/scale * (scale*x)^2 - 2/scale * (scale*x)^3
+        return cubic_cleaning(in, 3.0 / scale, -2.0 / scale);
+    });
 }
 
 
 Ctxt FHEController::clean_sign(const Ctxt &in) {
-    //return context->EvalPoly(in, {-24, 60, -50, 15, 0, 0});
-    //c, x, x^2, ...
-    return context->EvalPoly(in, {0, 0, 15, -50, 60, -24});
+    //15x^2 - 50x^3 + 60x^4 - 24x^5 = x^2 ((15 - 50x) + x^2 (60 - 24x)), three products instead of EvalPoly's
+    Ctxt x = rescaled(in);
+
+    return traced(OP_POLY, x, [&] {
+        Ctxt square = rescaled(state->context->EvalSquare(x));
+
+        Ctxt high = state->context->EvalMult(x, -24.0);
+        state->context->EvalAddInPlace(high, 60.0);
+
+        Ctxt low = state->context->EvalMult(x, -50.0);
+        state->context->EvalAddInPlace(low, 15.0);
+
+        Ctxt inner = state->context->EvalAdd(rescaled(state->context->EvalMult(square, rescaled(high))), rescaled(low));
+
+        return state->context->EvalMult(square, rescaled(inner));
+    });
+}
+
+void FHEController::save(const Ctxt &c, const string &filename) {
+    if (!Serial::SerializeToFile(filename, c, SerType::BINARY)) {
+        throw runtime_error("Could not write the ciphertext to " + filename);
+    }
+}
+
+Ctxt FHEController::load(const string &filename) {
+    Ctxt c;
+
+    if (!Serial::DeserializeFromFile(filename, c, SerType::BINARY)) {
+        throw runtime_error("Could not read a ciphertext from " + filename);
+    }
+
+    return c;
+}
+
+void FHEController::save_keys(const string &directory) {
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+
+    bool written = Serial::SerializeToFile(directory + "/context.bin", state->context, SerType::BINARY) &&
+                   Serial::SerializeToFile(directory + "/public-key.bin", state->key_pair.publicKey, SerType::BINARY) &&
+                   Serial::SerializeToFile(directory + "/secret-key.bin", state->key_pair.secretKey, SerType::BINARY);
+
+    ofstream mult_keys(directory + "/mult-keys.bin", ios::binary);
+    written = written && state->context->SerializeEvalMultKey(mult_keys, SerType::BINARY);
+
+    // The rotation and the bootstrapping keys, all automorphisms
+    ofstream rotation_keys(directory + "/rotation-keys.bin", ios::binary);
+    written = written && state->context->SerializeEvalAutomorphismKey(rotation_keys, SerType::BINARY);
+
+    ofstream description(directory + "/keys.txt");
+    description << "depth " << state->circuit_depth << endl;
+    description << "bootstrap_slots " << state->bootstrap_slots << endl;
+    description << "level_budget " << state->level_budget.size();
+    for (uint32_t budget : state->level_budget) description << " " << budget;
+    description << endl << "rotations " << state->rotation_indexes.size();
+    for (int index : state->rotation_indexes) description << " " << index;
+    description << endl << "bootstrap_keys " << state->bootstrap_keys.size();
+    for (uint32_t automorphism : state->bootstrap_keys) description << " " << automorphism;
+    description << endl << "rescaling " << state->rescaling << endl;
+
+    if (!written || !mult_keys || !rotation_keys || !description) {
+        throw runtime_error("Could not write the keys to " + directory);
+    }
+}
+
+int FHEController::load_keys(const string &directory) {
+    unique_lock<shared_mutex> lock(state->keys_mutex);
+
+    ifstream description(directory + "/keys.txt");
+    string field;
+    size_t count;
+
+    description >> field >> state->circuit_depth >> field >> state->bootstrap_slots;
+
+    description >> field >> count;
+    state->level_budget.resize(count);
+    for (uint32_t& budget : state->level_budget) description >> budget;
+
+    description >> field >> count;
+    state->rotation_indexes.clear();
+    for (size_t i = 0; i < count; i++) {
+        int index;
+        description >> index;
+        state->rotation_indexes.insert(index);
+    }
+
+    description >> field >> count;
+    state->bootstrap_keys.clear();
+    for (size_t i = 0; i < count; i++) {
+        uint32_t automorphism;
+        description >> automorphism;
+        state->bootstrap_keys.insert(automorphism);
+    }
+
+    // The context decides how ciphertexts are rescaled, whatever this controller was constructed with
+    int rescaling;
+    description >> field >> rescaling;
+    state->rescaling = (RescalingMode) rescaling;
+
+    if (!description) throw runtime_error("Could not read the key description in " + directory);
+
+    CryptoContextImpl<DCRTPoly>::ClearEvalMultKeys();
+    CryptoContextImpl<DCRTPoly>::ClearEvalAutomorphismKeys();
+
+    bool read = Serial::DeserializeFromFile(directory + "/context.bin", state->context, SerType::BINARY) &&
+                Serial::DeserializeFromFile(directory + "/public-key.bin", state->key_pair.publicKey, SerType::BINARY) &&
+                Serial::DeserializeFromFile(directory + "/secret-key.bin", state->key_pair.secretKey, SerType::BINARY);
+
+    ifstream mult_keys(directory + "/mult-keys.bin", ios::binary);
+    read = read && state->context->DeserializeEvalMultKey(mult_keys, SerType::BINARY);
+
+    ifstream rotation_keys(directory + "/rotation-keys.bin", ios::binary);
+    read = read && state->context->DeserializeEvalAutomorphismKey(rotation_keys, SerType::BINARY);
+
+    if (!read) throw runtime_error("Could not read the keys in " + directory);
+
+    if (!state->level_budget.empty()) {
+        state->context->EvalBootstrapSetup(state->level_budget, {0, 0}, state->bootstrap_slots);
+    }
+
+    return state->circuit_depth;
 }
 
 void FHEController::print(const Ctxt &c, int slots, string prefix) {
@@ -379,7 +835,7 @@ void FHEController::print(const Ctxt &c, int slots, string prefix) {
     cout << prefix;
 
     Ptxt result;
-    context->Decrypt(key_pair.secretKey, c, &result);
+    state->context->Decrypt(state->key_pair.secretKey, rescaled(c), &result);
     result->SetSlots(slots);
     vector<double> v = result->GetRealPackedValue();
 
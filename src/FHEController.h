@@ -7,6 +7,13 @@
 #include "ciphertext-ser.h"
 #include "cryptocontext-ser.h"
 #include "key/key-ser.h"
+#include "Trace.h"
+#include "Approximations.h"
+
+#include <future>
+#include <map>
+#include <set>
+#include <shared_mutex>
 
 using namespace lbcrypto;
 using namespace std;
@@ -16,11 +23,27 @@ using namespace std::chrono;
 using Ptxt = Plaintext;
 using Ctxt = Ciphertext<DCRTPoly>;
 
+/*
+ * Copies of a controller are handles to the same context and keys, so that many sorts
+ * (even concurrent ones) share a single key set. Evaluation is thread-safe; generating
+ * rotation keys waits for the rotations in progress, and keys already present are not
+ * generated again.
+ */
 class FHEController {
-    CryptoContext<DCRTPoly> context; // Crypto context for the FHE system
-
 public:
-    FHEController() {}
+    // Ciphertext and plaintext types, as seen by the sorting algorithms
+    using Ctxt = ::Ctxt;
+    using Ptxt = ::Ptxt;
+
+    /**
+     * @param rescaling How the contexts of this controller manage the scaling factor. With
+     * MANUAL_RESCALING the products are not rescaled: a ciphertext is rescaled only before an
+     * operation that needs it (a product, a rotation, a polynomial, bootstrapping or decryption),
+     * so sums of products, e.g. the masked values of a swap, take a single rescaling
+     */
+    explicit FHEController(RescalingMode rescaling = AUTO_RESCALING) : state(make_shared<State>()) {
+        state->rescaling = rescaling;
+    }
 
     /**
      * Generate the cryptocontext for the evaluation of the bitonic sorting network
@@ -49,6 +72,13 @@ public:
      */
     void generate_context_permutation(int num_slots, int levels_required, bool toy_parameters, int n, double delta);
 
+    /**
+     * Generate the rotation keys required by the permutation-based sorting
+     *
+     * @param n The number of values to be sorted
+     */
+    void generate_rotation_keys_permutation(int n);
+
     /**
      * Generate a rotation key
      *
@@ -56,6 +86,15 @@ public:
      */
     void generate_rotation_key(int index);
 
+    /**
+     * Enable compare_switch over the current context: generates the FHEW context and the keys
+     * that switch ciphertexts from CKKS to FHEW and back
+     *
+     * @param num_slots The number of slots compared at once
+     * @param toy_parameters Choose whether FHEW uses toy parameters (true) or 128-bit security parameters (false)
+     */
+    void generate_scheme_switching_keys(int num_slots, bool toy_parameters);
+
     /**
       * Basic FHE operations
       */
@@ -106,6 +145,17 @@ public:
     // Perform bootstrapping operation on a ciphertext
     Ctxt bootstrap(const Ctxt& c);
 
+    /**
+     * Drop a result to the lowest modulus of the chain that keeps its precision, the one whose bits
+     * above the scaling factor still hold values in [-1, 1]: it is sent and decrypted as the
+     * smallest ciphertext
+     *
+     * @param slots The slots to decode, fewer than the ones of the ciphertext only if its values
+     * repeat with that period (then it is decoded as a sparsely packed ciphertext)
+     * @param precision_bits The bits of the values to keep, see output_precision_bits()
+     */
+    Ctxt compress(const Ctxt& c, int slots, int precision_bits);
+
     /**
       * Permutation-based operations
       */
@@ -122,10 +172,11 @@ public:
     // Approximation of sinc function
     Ctxt double_sinc(const Ctxt& in, int degree, double n);
 
-    // Cleaning à-la discrete CKKS
+    // Cleaning à-la discrete CKKS, each one a fused kernel (see cubic_cleaning). The iterations
+    // of clean_sigmoid run back to back in a single traced operation
     Ctxt clean_binary(const Ctxt& in, double scale);
     Ctxt clean_sign(const Ctxt& in);
-    Ctxt clean_sigmoid(const Ctxt& in, double n);
+    Ctxt clean_sigmoid(const Ctxt& in, double n, int iterations = 1);
     Ctxt clean_sigmoid_and_scale(const Ctxt& in, double n);
 
     /**
@@ -135,6 +186,17 @@ public:
     // Approximation of the ReLU function
     Ctxt relu(const Ctxt& in, int degree, int n);
 
+    // Composite approximation of sign(x), one EvalPoly per stage
+    Ctxt composite_sign(const Ctxt& in, const CompositeSign& sign);
+
+    /**
+     * Exact comparison by scheme switching: every slot of c1 - c2 is switched to an FHEW ciphertext,
+     * whose sign is computed by a functional bootstrapping, and the results are switched back
+     *
+     * @return 1 where c1 < c2, 0 elsewhere, at level SCHEME_SWITCH_LEVELS
+     */
+    Ctxt compare_switch(const Ctxt& c1, const Ctxt& c2);
+
 
     /**
       * Utilities
@@ -143,8 +205,121 @@ public:
     // Print the values of slots in a ciphertext
     void print(const Ctxt& c, int slots = 0, string prefix = "");
 
+    /**
+     * Write a ciphertext to disk, in OpenFHE's binary serialization
+     *
+     * @param c The ciphertext
+     * @param filename The destination file, overwritten
+     */
+    void save(const Ctxt& c, const string& filename);
+
+    /**
+     * Read a ciphertext written by save(), encrypted under this controller's context
+     *
+     * @param filename The source file
+     * @return The ciphertext
+     */
+    Ctxt load(const string& filename);
+
+    /**
+     * Write the context and every key to a directory, so that another process can continue an
+     * evaluation (e.g. NetworkSorting::resume) over ciphertexts written by save(). The rescaling
+     * mode is written with them; the scheme-switching keys are not included
+     *
+     * @param directory An existing directory, whose key files are overwritten
+     */
+    void save_keys(const string& directory);
+
+    /**
+     * Read the context and the keys written by save_keys(), in place of generating them. The
+     * rescaling mode of the saved context replaces the one given to the constructor
+     *
+     * @param directory The directory given to save_keys()
+     * @return The circuit depth of the saved context, as returned by generate_context_network
+     */
+    int load_keys(const string& directory);
+
+    /**
+     * Low-memory mode: the rotation keys, those generated so far and those generated later, are
+     * written to one file each in `directory` and dropped from memory, to be loaded back by
+     * use_rotations() only for the stage that needs them. The bootstrapping keys stay resident
+     *
+     * @param directory An existing directory, whose key files are overwritten
+     */
+    void offload_rotation_keys(const string& directory);
+
+    /**
+     * Make the given rotation keys resident, dropping the other offloaded ones. Rotating by any
+     * other index fails until the next call. The keys requested by prefetch_rotations() are taken
+     * from memory instead of disk. Without offload_rotation_keys() it does nothing
+     *
+     * @param indexes The rotations of the next stage
+     */
+    void use_rotations(const vector<int>& indexes);
+
+    /**
+     * Start loading the given offloaded rotation keys in the background, for the next use_rotations()
+     */
+    void prefetch_rotations(const vector<int>& indexes);
+
 private:
-    KeyPair<DCRTPoly> key_pair; // Key pair for the FHE system
+    struct State {
+        CryptoContext<DCRTPoly> context;    // Crypto context for the FHE system
+        KeyPair<DCRTPoly> key_pair;         // Key pair for the FHE system
+        set<int> rotation_indexes;          // Rotation keys generated so far
+        RescalingMode rescaling = AUTO_RESCALING;
+
+        // What save_keys() needs to rebuild the context elsewhere: the bootstrapping precomputations
+        // are not serialized, so they are set up again from the level budget and the slots
+        int circuit_depth = 0;
+        vector<uint32_t> level_budget;      // Empty without bootstrapping
+        int bootstrap_slots = 0;
+        set<uint32_t> bootstrap_keys;       // Automorphisms of the bootstrapping keys, never offloaded
+
+        // Low-memory mode: rotation keys kept on disk by automorphism, and the ones being loaded ahead
+        string offload_directory;
+        map<uint32_t, shared_future<EvalKey<DCRTPoly>>> prefetched;
+
+        // OpenFHE keeps the evaluation keys in process-wide maps: they are written under an
+        // exclusive lock, and read (by rotations and bootstrapping) under a shared one
+        shared_mutex keys_mutex;
+    };
+
+    shared_ptr<State> state;
+
+    void generate_rotation_keys(const vector<int>& indexes);
+
+    // Low-memory mode: the automorphisms of the rotations that are offloaded, and where they are
+    set<uint32_t> offloaded_automorphisms(const vector<int>& indexes) const;
+    string offloaded_key_path(uint32_t automorphism) const;
+
+    // Writes the resident keys of the given rotations to disk and drops them, under the keys lock
+    void offload(const vector<int>& indexes);
+
+    // With MANUAL_RESCALING, the ciphertext rescaled if it carries a product not rescaled yet
+    Ctxt rescaled(const Ctxt& c);
+
+    // With MANUAL_RESCALING, the two operands of a sum brought to the same scaling factor
+    pair<Ctxt, Ctxt> aligned(const Ctxt& a, const Ctxt& b);
+
+    /*
+     * a x^2 + b x^3 evaluated as x^2 (a + b x): one square and one product between ciphertexts
+     * (two relinearizations, the minimum for a cubic), a single product by a constant, and the
+     * rescalings deferred by FLEXIBLEAUTO until the two factors meet at the same level
+     */
+    Ctxt cubic_cleaning(const Ctxt& in, double a, double b);
+
+    /*
+     * An even function f over [-1, 1] as g(x^2), g(y) = f(sqrt(y)) over [0, 1]: the series has half
+     * the degree, so about a third fewer products between ciphertexts, at the same depth when
+     * even_evaluation_fits(degree)
+     *
+     * The sigmoid is 1/(2n) plus an odd function, but it is not split this way: x g(x^2) needs the
+     * square and a last product by x, one level more than the series at every degree of
+     * permutation_parameters (495 to 4030). Only degrees just past a step of poly_evaluation_cost,
+     * such as 121 or 497, would break even
+     */
+    Ctxt even_chebyshev(const Ctxt& in, const function<double(double)>& f, int degree);
 
     void print_moduli_chain(const DCRTPoly& poly);
 };
@@ -0,0 +1,150 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_METRICS_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_METRICS_H
+
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <ctime>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+/*
+ * Resources consumed by a measured block of code
+ */
+struct Measurement {
+    double wall_ms = 0;             // Elapsed wall-clock time
+    double cpu_ms = 0;              // CPU time of the whole process (all threads)
+    double thread_cpu_ms = 0;       // CPU time of the calling thread
+    double max_thread_cpu_ms = 0;   // CPU time of the busiest thread (Linux only)
+    int active_threads = 0;         // Threads that consumed CPU during the block (Linux only)
+    long peak_rss_kb = 0;           // Peak resident set size during the block
+};
+
+static inline double process_cpu_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static inline double thread_cpu_ms() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * CPU time (ms) consumed so far by every thread of the process, indexed by thread id.
+ * Threads of OpenMP pools survive between parallel regions, so deltas between two
+ * snapshots give the per-thread split of a measured block.
+ */
+static inline map<long, double> per_thread_cpu_ms() {
+    map<long, double> result;
+
+#ifdef __linux__
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == nullptr) return result;
+
+    double ms_per_tick = 1e3 / sysconf(_SC_CLK_TCK);
+
+    while (dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+
+        ifstream stat("/proc/self/task/" + string(entry->d_name) + "/stat");
+        string line;
+        if (!getline(stat, line)) continue;
+
+        // The command name may contain spaces, the remaining fields start after ')'
+        istringstream fields(line.substr(line.rfind(')') + 2));
+        string field;
+        long utime = 0, stime = 0;
+        for (int i = 3; i <= 15 && fields >> field; i++) {
+            if (i == 14) utime = stol(field);
+            if (i == 15) stime = stol(field);
+        }
+
+        result[stol(entry->d_name)] = (utime + stime) * ms_per_tick;
+    }
+
+    closedir(dir);
+#endif
+
+    return result;
+}
+
+/*
+ * Peak resident set size in KB. On Linux the high-water mark can be reset, so that
+ * it refers to the last measured block instead of the whole process lifetime.
+ */
+static inline long peak_rss_kb() {
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return stol(line.substr(6));
+        }
+    }
+#endif
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static inline void reset_peak_rss() {
+#ifdef __linux__
+    ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+#endif
+}
+
+class ResourceProbe {
+public:
+    void start() {
+        reset_peak_rss();
+        threads_start = per_thread_cpu_ms();
+        cpu_start = process_cpu_ms();
+        thread_start = thread_cpu_ms();
+        wall_start = chrono::steady_clock::now();
+    }
+
+    Measurement stop() const {
+        Measurement m;
+        m.wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - wall_start).count();
+        m.thread_cpu_ms = thread_cpu_ms() - thread_start;
+        m.cpu_ms = process_cpu_ms() - cpu_start;
+
+        for (const auto& [tid, ms] : per_thread_cpu_ms()) {
+            auto it = threads_start.find(tid);
+            double used = ms - (it == threads_start.end() ? 0 : it->second);
+            if (used > 0) {
+                m.active_threads++;
+                m.max_thread_cpu_ms = max(m.max_thread_cpu_ms, used);
+            }
+        }
+
+        m.peak_rss_kb = peak_rss_kb();
+
+        return m;
+    }
+
+private:
+    chrono::steady_clock::time_point wall_start;
+    double cpu_start = 0;
+    double thread_start = 0;
+    map<long, double> threads_start;
+};
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_METRICS_H
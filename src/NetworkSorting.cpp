@@ -3,117 +3,506 @@
 //
 
 #include "NetworkSorting.h"
+#include "PlainController.h"
+#include "CostModel.h"
+#include "Threading.h"
 
-Ctxt NetworkSorting::sort(const Ctxt& in) {
-    int iterations = (log2(n) * (log2(n) + 1)) / 2;
+#include <filesystem>
+#include <fstream>
 
-    Ctxt clone_in = in->Clone();
+template <class Controller>
+auto NetworkSorting<Controller>::sort(const Ctxt& in) -> Ctxt {
+    TracePhase phase("network.sort");
+
+    return sort_layers(in, 1);
+}
+
+template <class Controller>
+auto NetworkSorting<Controller>::resume() -> Ctxt {
+    TracePhase phase("network.sort");
+
+    int layer = checkpoint_layer();
+    if (layer == 0) throw runtime_error("No checkpoint to resume from in " + checkpoint_directory);
+
+    ifstream index(checkpoint_directory + "/checkpoint.txt");
+    string saved;
+    index >> layer >> ws;
+    getline(index, saved);
+
+    if (saved != circuit_description()) {
+        throw runtime_error("The checkpoint in " + checkpoint_directory + " was written by another sort (" + saved
+                            + "), not by this one (" + circuit_description() + ")");
+    }
+
+    if (verbose) cout << "Resuming after layer " << layer << endl;
 
-    int current_iteration = 1;
+    return sort_layers(controller.load(checkpoint_path(layer)), layer + 1);
+}
+
+template <class Controller>
+bool NetworkSorting<Controller>::has_checkpoint() const {
+    return checkpoint_layer() > 0;
+}
+
+template <class Controller>
+auto NetworkSorting<Controller>::sort_layers(const Ctxt& in, int first_layer) -> Ctxt {
+    // The first rounds of the network over all the slots sort each lane on its own
+    const NetworkSchedule& plan = network_plan(in->GetSlots());
+    int iterations = last_sorting_layer(plan);
+
+    Ctxt clone_in = in->Clone();
 
     /*
-     * These loops represent the actual bitonic sorting network
+     * The layers of the bitonic sorting network, as scheduled by the plan
      */
-    for (int i = 0; i < log2(n); i++) {
-        for (int j = 0; j < i + 1; j++) {
-            int arrowsdelta = pow(2, i - j);
-            int stage = i - j;
-            int round = j;
+    for (int current_iteration = first_layer; current_iteration <= iterations; current_iteration++) {
+        const NetworkLayer& l = plan.layers[current_iteration - 1];
 
-            auto start_time_local = steady_clock::now();
+        if (layer_skipped(l)) continue;
 
-            clone_in = swap(clone_in, arrowsdelta, stage, round);
+        TracePhase layer("layer");
 
-            if (verbose) print_duration(start_time_local, "Swap");
-            start_time_local = steady_clock::now();
+        auto start_time_local = steady_clock::now();
 
-            if (current_iteration < iterations) clone_in = controller.bootstrap(clone_in);
+        stage_rotations(plan, current_iteration - 1);
+        clone_in = swap(clone_in, l.arrowsdelta, l.round, l.stage);
 
-            if (verbose) print_duration(start_time_local, "Bootstrapping");
+        if (verbose) print_duration(start_time_local, "Swap");
+        start_time_local = steady_clock::now();
 
-            if (verbose) controller.print(clone_in, n);
+        if (current_iteration < iterations) clone_in = controller.bootstrap(clone_in);
 
-            if (verbose) cout << "Layer " << current_iteration << " / " << iterations << " done." << endl;
-            current_iteration++;
+        if (verbose) print_duration(start_time_local, "Bootstrapping");
 
+        if (!checkpoint_directory.empty() && current_iteration < iterations && current_iteration % checkpoint_interval == 0) {
+            checkpoint(clone_in, current_iteration);
         }
+
+        if (verbose) controller.print(clone_in, n * lanes);
+
+        if (verbose) cout << "Layer " << current_iteration << " / " << iterations << " done." << endl;
     }
 
+    if (pending_checkpoint.valid()) pending_checkpoint.get();
+
     return clone_in;
 }
 
+template <class Controller>
+bool NetworkSorting<Controller>::layer_skipped(const NetworkLayer& layer) const {
+    // The round of a layer merges blocks of 2^(round + stage + 1) slots: the last one merges n
+    return layer.round + layer.stage == log2(n) - 1 && layer.round < truncated_stages;
+}
+
+template <class Controller>
+int NetworkSorting<Controller>::last_sorting_layer(const NetworkSchedule& plan) const {
+    int last = plan.sorting_layers(n);
+
+    while (last > 1 && layer_skipped(plan.layers[last - 1])) last--;
+
+    return last;
+}
 
-Ctxt NetworkSorting::swap(const Ctxt &in, int arrowsdelta, int round, int stage) {
-    Ctxt rot_pos = controller.rot(in, arrowsdelta);
-    Ctxt rot_neg = controller.rot(in, -arrowsdelta);
+template <class Controller>
+void NetworkSorting<Controller>::checkpoint(const Ctxt &c, int layer) {
+    TracePhase phase("checkpoint");
 
-    // This performs the evaluation of the min function
-    Ctxt m1 = controller.sub(in, controller.relu(controller.sub(in, rot_pos), relu_degree, n));
+    // A layer takes far longer than a write: waiting for the previous one rarely stalls
+    if (pending_checkpoint.valid()) pending_checkpoint.get();
 
-    // The other values are obtained in function of m1
-    Ctxt m3 = controller.sub(controller.add(in, rot_pos), m1);
-    Ctxt m4 = controller.rot(m1, -arrowsdelta);
-    Ctxt m2 = controller.sub(controller.add(in, rot_neg), m4);
+    Controller writer = controller;
+    string directory = checkpoint_directory;
+    string path = checkpoint_path(layer);
+    string previous = checkpoint_path(checkpoint_layer());
+    string description = circuit_description();
 
-    vector<Ptxt> masks = generate_layer_masks(m1->GetLevel(), m1->GetSlots(), round, stage);
+    pending_checkpoint = async(launch::async, [writer, c, directory, path, previous, layer, description]() mutable {
+        writer.save(c, path);
 
-    return controller.add_tree({controller.mult(m1, masks[0]),
-                                controller.mult(m2, masks[1]),
-                                controller.mult(m3, masks[2]),
-                                controller.mult(m4, masks[3])});
+        ofstream index(directory + "/checkpoint.tmp");
+        index << layer << endl << description << endl;
+        index.close();
 
+        if (!index) throw runtime_error("Could not write the checkpoint index in " + directory);
+
+        filesystem::rename(directory + "/checkpoint.tmp", directory + "/checkpoint.txt");
+        if (previous != path) filesystem::remove(previous);
+    }).share();
 }
 
+template <class Controller>
+int NetworkSorting<Controller>::checkpoint_layer() const {
+    ifstream index(checkpoint_directory + "/checkpoint.txt");
+    int layer = 0;
 
-vector<Ptxt> NetworkSorting::generate_layer_masks(int encoding_level, int num_slots, int round, int stage, double mask_value) {
-    vector<double> mask_1, mask_2, mask_3, mask_4;
+    if (!(index >> layer)) return 0;
 
-    for (int i = 0; i < num_slots / (pow(2, round + 2)); i++) {
+    return layer;
+}
 
-        for (int times = 0; times < pow(2, stage); times++) {
-            for (int j = 0; j < pow(2, round); j++) {
-                mask_1.push_back(mask_value);
-                mask_2.push_back(0);
-                mask_3.push_back(0);
-                mask_4.push_back(0);
-            }
+template <class Controller>
+string NetworkSorting<Controller>::checkpoint_path(int layer) const {
+    return checkpoint_directory + "/layer-" + to_string(layer) + ".bin";
+}
+
+template <class Controller>
+string NetworkSorting<Controller>::circuit_description() const {
+    ostringstream description;
+
+    description << setprecision(17) << "n " << n << " lanes " << lanes << " delta " << delta << " comparator " << comparator
+                << " relu " << relu_degree << " schedule";
+    for (int degree : relu_schedule) description << " " << degree;
+    description << " sign " << sign.g_degree << " " << sign.g_iterations << " " << sign.f_degree << " " << sign.f_iterations
+                << " truncated " << truncated_stages;
+
+    return description.str();
+}
+
+template <class Controller>
+auto NetworkSorting<Controller>::sort_lexicographic(const vector<Ctxt>& keys) -> vector<Ctxt> {
+    TracePhase phase("network.lexicographic");
+
+    if (comparator != SIGN_COMPARATOR) {
+        throw invalid_argument("A lexicographic sort requires the sign comparator, whose signs select the records");
+    }
+    if (keys.size() < 2) {
+        throw invalid_argument("A lexicographic sort takes two or more keys");
+    }
 
-            for (int j = 0; j < pow(2, round); j++) {
-                mask_1.push_back(0);
-                mask_2.push_back(mask_value);
-                mask_3.push_back(0);
-                mask_4.push_back(0);
+    const NetworkSchedule& plan = network_plan(keys[0]->GetSlots());
+    int iterations = last_sorting_layer(plan);
+    int count = keys.size();
+
+    vector<Ctxt> sorted(keys);
+
+    for (int current_iteration = 1; current_iteration <= iterations; current_iteration++) {
+        const NetworkLayer& l = plan.layers[current_iteration - 1];
+
+        if (layer_skipped(l)) continue;
+
+        TracePhase layer("layer");
+
+        stage_rotations(plan, current_iteration - 1);
+        sorted = swap_lexicographic(sorted, l.arrowsdelta, l.round, l.stage);
+
+        if (current_iteration < iterations) {
+#pragma omp parallel for num_threads(min(task_threads(), count))
+            for (int k = 0; k < count; k++) {
+                ThreadingTask task(k);
+                sorted[k] = controller.bootstrap(sorted[k]);
             }
         }
 
-        if ((i + 1) * pow(2, stage + round + 1) >= num_slots) {
-            break;
+        if (verbose) cout << "Layer " << current_iteration << " / " << iterations << " done." << endl;
+    }
+
+    return sorted;
+}
+
+
+template <class Controller>
+auto NetworkSorting<Controller>::merge(const Ctxt& in, bool descending) -> Ctxt {
+    TracePhase phase("network.merge");
+
+    // The last round of the plan, whose blocks span the whole ciphertext
+    const NetworkSchedule& plan = network_plan(in->GetSlots());
+    int first_layer = plan.layer_count - plan_log2(plan.slots);
+
+    Ctxt result = in;
+
+    for (int i = first_layer; i < plan.layer_count; i++) {
+        TracePhase layer("layer");
+
+        stage_rotations(plan, i);
+        result = swap(result, plan.layers[i].arrowsdelta, plan.layers[i].round, plan.layers[i].stage, descending);
+        result = controller.bootstrap(result);
+    }
+
+    return result;
+}
+
+template <class Controller>
+auto NetworkSorting<Controller>::finalize(const Ctxt& sorted) -> Ctxt {
+    // The values already fill the slots of the ciphertext
+    return controller.compress(sorted, sorted->GetSlots(), output_precision_bits(delta));
+}
+
+template <class Controller>
+auto NetworkSorting<Controller>::swap(const Ctxt &in, int arrowsdelta, int round, int stage, bool descending) -> Ctxt {
+    TracePhase phase("swap");
+
+    Ctxt rot_pos, rot_neg;
+
+#pragma omp parallel sections num_threads(min(task_threads(), 2))
+    {
+#pragma omp section
+        {
+            ThreadingTask task(0);
+            rot_pos = controller.rot(in, arrowsdelta);
         }
 
-        for (int times = 0; times < pow(2, stage); times++) {
-            for (int j = 0; j < pow(2, round); j++) {
-                mask_1.push_back(0);
-                mask_2.push_back(0);
-                mask_3.push_back(mask_value);
-                mask_4.push_back(0);
-            }
+#pragma omp section
+        {
+            ThreadingTask task(1);
+            rot_neg = controller.rot(in, -arrowsdelta);
+        }
+    }
 
-            for (int j = 0; j < pow(2, round); j++) {
-                mask_1.push_back(0);
-                mask_2.push_back(0);
-                mask_3.push_back(0);
-                mask_4.push_back(mask_value);
-            }
+    Ctxt m1, m2, m3, m4;
+    double mask_value = 1.0;
+
+    if (comparator == RELU_COMPARATOR) {
+        // This performs the evaluation of the min function
+        int degree = layer_relu_degree(network_plan(in->GetSlots()).layer_index(round, stage));
+
+        m1 = controller.sub(in, controller.relu(controller.sub(in, rot_pos), degree, n));
+
+        // The other values are obtained in function of m1
+        m3 = controller.sub(controller.add(in, rot_pos), m1);
+        m4 = controller.rot(m1, -arrowsdelta);
+        m2 = controller.sub(controller.add(in, rot_neg), m4);
+    } else if (comparator == SWITCH_COMPARATOR) {
+        // min(a, b) = b + [a < b] (a - b), the comparison being exact
+        Ctxt difference = controller.sub(in, rot_pos);
+        m1 = controller.add(rot_pos, controller.mult(controller.compare_switch(in, rot_pos), difference));
+
+        m3 = controller.sub(controller.add(in, rot_pos), m1);
+        m4 = controller.rot(m1, -arrowsdelta);
+        m2 = controller.sub(controller.add(in, rot_neg), m4);
+    } else {
+        // Twice the min and the max, (a + b) ∓ |a - b|: the masks halve them, saving a level
+        Ctxt difference = controller.sub(in, rot_pos);
+        Ctxt distance = controller.mult(difference, controller.composite_sign(difference, sign));
+        Ctxt sum = controller.add(in, rot_pos);
+
+        m1 = controller.sub(sum, distance);
+        m3 = controller.add(sum, distance);
+        m4 = controller.rot(m1, -arrowsdelta);
+
+        Ctxt sum_neg = controller.add(in, rot_neg);
+        m2 = controller.sub(controller.add(sum_neg, sum_neg), m4);
+
+        mask_value = 0.5;
+    }
+
+    vector<Ptxt> masks = generate_layer_masks(m1->GetLevel(), m1->GetSlots(), round, stage, mask_value, descending);
+
+    vector<Ctxt> values = {m1, m2, m3, m4};
+    vector<Ctxt> masked(4);
+
+#pragma omp parallel for num_threads(min(task_threads(), 4))
+    for (int i = 0; i < 4; i++) {
+        ThreadingTask task(i);
+        masked[i] = controller.mult(values[i], masks[i]);
+    }
+
+    return controller.add_tree(masked);
+
+}
+
+template <class Controller>
+auto NetworkSorting<Controller>::swap_lexicographic(const vector<Ctxt> &keys, int arrowsdelta, int round, int stage) -> vector<Ctxt> {
+    TracePhase phase("swap");
+
+    int count = keys.size();
+    vector<Ctxt> difference(count), sum(count), sum_neg(count), signs(count);
+
+#pragma omp parallel for num_threads(min(task_threads(), count))
+    for (int k = 0; k < count; k++) {
+        ThreadingTask task(k);
+
+        Ctxt rot_pos = controller.rot(keys[k], arrowsdelta);
+        Ctxt rot_neg = controller.rot(keys[k], -arrowsdelta);
+
+        difference[k] = controller.sub(keys[k], rot_pos);
+        sum[k] = controller.add(keys[k], rot_pos);
+        sum_neg[k] = controller.add(keys[k], rot_neg);
+        signs[k] = controller.composite_sign(difference[k], sign);
+    }
+
+    // The sign of a key only counts where the previous ones tie, i.e. where their sign is zero. A tie
+    // is only zero up to the bootstrapping error, which the steep sign amplifies: its cube keeps the
+    // selector unchanged at ±1 while making that error vanish, at the level of the product by the tie
+    Ctxt selector = signs[count - 1];
+
+    for (int k = count - 2; k >= 0; k--) {
+        Ctxt square = controller.mult(signs[k], signs[k]);
+        Ctxt tie = controller.sub(1, square);
+        selector = controller.add(controller.mult(square, signs[k]), controller.mult(tie, selector));
+    }
+
+    vector<Ctxt> swapped(count);
+
+#pragma omp parallel for num_threads(min(task_threads(), count))
+    for (int k = 0; k < count; k++) {
+        ThreadingTask task(k);
+
+        // Twice the min and the max as in swap, the distance being signed by the selector
+        Ctxt distance = controller.mult(difference[k], selector);
+
+        Ctxt m1 = controller.sub(sum[k], distance);
+        Ctxt m3 = controller.add(sum[k], distance);
+        Ctxt m4 = controller.rot(m1, -arrowsdelta);
+        Ctxt m2 = controller.sub(controller.add(sum_neg[k], sum_neg[k]), m4);
+
+        vector<Ptxt> masks = generate_layer_masks(m1->GetLevel(), m1->GetSlots(), round, stage, 0.5);
+
+        vector<Ctxt> masked = {controller.mult(m1, masks[0]), controller.mult(m2, masks[1]),
+                               controller.mult(m3, masks[2]), controller.mult(m4, masks[3])};
+
+        swapped[k] = controller.add_tree(masked);
+    }
+
+    return swapped;
+}
+
+
+template <class Controller>
+vector<double> NetworkSorting<Controller>::pack_lanes(const vector<vector<double>>& lists) {
+    vector<double> slots;
+
+    for (const vector<double>& list : lists) {
+        slots.insert(slots.end(), list.begin(), list.end());
+    }
+
+    return slots;
+}
+
+template <class Controller>
+vector<vector<double>> NetworkSorting<Controller>::unpack_lanes(const vector<double>& slots, int n, int lanes) {
+    vector<vector<double>> lists;
+
+    for (int lane = 0; lane < lanes; lane++) {
+        vector<double> list(slots.begin() + lane * n, slots.begin() + (lane + 1) * n);
+
+        // Odd blocks come out of the network in descending order
+        if (lane % 2 == 1) reverse(list.begin(), list.end());
+
+        lists.push_back(list);
+    }
+
+    return lists;
+}
+
+template <class Controller>
+void NetworkSorting<Controller>::stage_rotations(const NetworkSchedule& plan, int layer) {
+    int arrowsdelta = plan.layers[layer].arrowsdelta;
+    controller.use_rotations({arrowsdelta, -arrowsdelta});
+
+    if (layer + 1 < plan.layer_count) {
+        int next = plan.layers[layer + 1].arrowsdelta;
+        controller.prefetch_rotations({next, -next});
+    }
+}
+
+template <class Controller>
+int NetworkSorting<Controller>::layer_relu_degree(int layer) const {
+    return layer < (int) relu_schedule.size() ? relu_schedule[layer] : relu_degree;
+}
+
+template <class Controller>
+auto NetworkSorting<Controller>::generate_layer_masks(int encoding_level, int num_slots, int round, int stage, double mask_value,
+                                                      bool descending) -> vector<Ptxt> {
+    const NetworkSchedule& plan = network_plan(num_slots);
+    const uint8_t* pattern = plan.layer_masks(plan.layer_index(round, stage));
+
+    // The second bit of a mask index tells the descending pairs from the ascending ones
+    int direction = descending ? 2 : 0;
+
+    vector<vector<double>> masks(4, vector<double>(num_slots, 0));
+    for (int slot = 0; slot < num_slots; slot++) masks[pattern[slot] ^ direction][slot] = mask_value;
+
+    return {controller.encode(masks[0], encoding_level, num_slots),
+            controller.encode(masks[1], encoding_level, num_slots),
+            controller.encode(masks[2], encoding_level, num_slots),
+            controller.encode(masks[3], encoding_level, num_slots)};
+}
+
+NetworkParameters search_relu_schedule(int n, double d, int trials, double noise_bits, int seed) {
+    NetworkConfig config = network_config(n, d);
+    NetworkParameters& parameters = config.parameters;
+
+    vector<vector<double>> inputs;
+    for (int t = 0; t < trials; t++) {
+        inputs.push_back(generate_close_randoms(n, d, seed + t));
+        for (double& v : inputs.back()) v *= parameters.input_scale;
+    }
+
+    // Lowering degrees never deepens a layer: the dry runs share the budget of the uniform degree
+    PlainController plain;
+    int levels = network_layer_levels(parameters);
+    int depth = plain.generate_context_network(n, levels, true, d);
+
+    auto sorts_input = [&](const vector<int>& schedule, int t) {
+        parameters.relu_schedule = schedule;
+
+        if (noise_bits > 0) plain.set_noise(noise_bits, seed + t);
+
+        NetworkSorting<PlainController> sorting(plain, config);
+        vector<double> result = plain.decode(plain.decrypt(sorting.sort(plain.encrypt(inputs[t], depth - levels - 3, n))));
+
+        vector<double> expected(inputs[t]);
+        std::sort(expected.begin(), expected.end());
+
+        // The accuracy required of the sorting, as Sort checks it (NaNs, of values that left [-1, 1], fail)
+        for (int i = 0; i < n; i++) {
+            if (!(abs(result[i] - expected[i]) < d)) return false;
         }
 
-        if ((i + 1) * pow(2, stage + round + 2) >= num_slots) {
-            break;
+        return !plain.statistics().depth_exceeded;
+    };
+
+    // The highest degree of each depth, below the uniform one
+    vector<int> candidates;
+    for (int degree : {27, 59, 119, 247, 495}) {
+        if (degree < parameters.relu_degree) candidates.push_back(degree);
+    }
+
+    vector<int> schedule(network_plan(n).sorting_layers(n), parameters.relu_degree);
+
+    // A schedule must sort every input the uniform degree sorts
+    vector<int> reference;
+    for (int t = 0; t < trials; t++) {
+        if (sorts_input(schedule, t)) reference.push_back(t);
+    }
+
+    if (reference.empty()) {
+        cerr << "The uniform ReLU degree " << parameters.relu_degree << " does not sort within δ, keeping it" << endl;
+        parameters.relu_schedule.clear();
+        return parameters;
+    }
+
+    auto sorts = [&](const vector<int>& candidate) {
+        for (int t : reference) {
+            if (!sorts_input(candidate, t)) return false;
         }
 
+        return true;
+    };
+
+    for (size_t layer = 0; layer < schedule.size(); layer++) {
+        // A lower degree only adds error: bisect the candidates that still sort
+        int low = 0, high = candidates.size();
+
+        while (low < high) {
+            int middle = (low + high) / 2;
+
+            vector<int> trial(schedule);
+            trial[layer] = candidates[middle];
+
+            if (sorts(trial)) high = middle;
+            else low = middle + 1;
+        }
+
+        if (low < (int) candidates.size()) schedule[layer] = candidates[low];
     }
 
-    return {controller.encode(mask_1, encoding_level, num_slots),
-            controller.encode(mask_2, encoding_level, num_slots),
-            controller.encode(mask_3, encoding_level, num_slots),
-            controller.encode(mask_4, encoding_level, num_slots)};
-}
\ No newline at end of file
+    parameters.relu_schedule = schedule;
+    parameters.relu_degree = *max_element(schedule.begin(), schedule.end());
+
+    return parameters;
+}
+
+template class NetworkSorting<FHEController>;
+template class NetworkSorting<PlainController>;
+template class NetworkSorting<CountingController>;
@@ -7,35 +7,127 @@
 
 #include "../src/FHEController.h"
 #include "Utils.h"
+#include "SortingParameters.h"
+#include "SortingPlan.h"
+
+#include <future>
 
 using namespace lbcrypto;
 using namespace std;
 using namespace std::chrono;
 
 
+template <class Controller>
 class NetworkSorting {
-    FHEController controller;
+    using Ctxt = typename Controller::Ctxt;
+    using Ptxt = typename Controller::Ptxt;
+
+    Controller controller;
     int n;
+    int lanes;
+    double delta;
     int relu_degree;
+    vector<int> relu_schedule;
+    NetworkComparator comparator;
+    CompositeSign sign;
     bool verbose;
 
+    int truncated_stages;
+
+    string checkpoint_directory;
+    int checkpoint_interval;
+
+    // The checkpoint being written, at most one at a time
+    shared_future<void> pending_checkpoint;
+
 public:
-    NetworkSorting(FHEController controller,
-                       int n,
-                       int relu_degree,
-                       bool verbose)
+    /**
+     * @param controller The controller, a handle that can be shared with other sorts
+     * @param config The input shape, the comparator and its approximation parameters
+     */
+    NetworkSorting(Controller controller, const NetworkConfig& config)
             : controller(controller),
-              n(n),
-              relu_degree(relu_degree),
-              verbose(verbose) {}
+              n(config.n),
+              lanes(config.lanes),
+              delta(config.delta),
+              relu_degree(config.parameters.relu_degree),
+              relu_schedule(config.parameters.relu_schedule),
+              comparator(config.parameters.comparator),
+              sign(config.parameters.sign),
+              verbose(config.verbose),
+              truncated_stages(config.truncated_stages),
+              checkpoint_directory(config.checkpoint_directory),
+              checkpoint_interval(max(1, config.checkpoint_interval)) {}
+
     /**
      *
-     * @param in The input ciphertext
+     * @param in The input ciphertext, with config.lanes lists of config.n values (see pack_lanes)
      * @return The sorted ciphertext, according to a bitonic sorting network
      */
     Ctxt sort(const Ctxt& in);
 
-private:
+    /**
+     * Continue a sort() interrupted after a checkpoint, from the layer that follows it. The
+     * controller must hold the keys of the interrupted process (see FHEController::load_keys).
+     * The checkpoint records the configuration of the sort that wrote it (n, lanes, δ, the
+     * comparator and its degrees, the truncation): a different one throws runtime_error
+     *
+     * @return The sorted ciphertext, as sort() would have returned it
+     */
+    Ctxt resume();
+
+    /**
+     * Whether config.checkpoint_directory holds a checkpoint that resume() can continue from
+     */
+    bool has_checkpoint() const;
+
+    /**
+     * Sort by several keys at once, in lexicographic order: every swap compares the keys, combines
+     * their signs into a single selector and moves all the keys by it. It requires SIGN_COMPARATOR,
+     * whose signs are selectors, and the parameters of network_parameters(..., keys)
+     *
+     * @param keys The keys, the primary one first, laid out as the input of sort()
+     * @return Every key, in the order of the records
+     */
+    vector<Ctxt> sort_lexicographic(const vector<Ctxt>& keys);
+
+    /**
+     * The last round of the bitonic network over all the slots of the ciphertext: it sorts a
+     * bitonic sequence (e.g. an ascending list followed by a descending one). Every layer is
+     * followed by a bootstrapping, so the result can be processed further
+     *
+     * @param in The input ciphertext, whose slots form a bitonic sequence
+     * @param descending Whether to sort in descending order, at the same cost
+     * @return The sorted ciphertext
+     */
+    Ctxt merge(const Ctxt& in, bool descending = false);
+
+    /**
+     * Drop the output of sort() to the lowest modulus that keeps it, the smallest ciphertext to send
+     * and decrypt. It consumes no level
+     */
+    Ctxt finalize(const Ctxt& sorted);
+
+    /**
+     * Lay out independent lists of n values side by side, so that a single ciphertext (and a single
+     * bootstrapping per layer) sorts all of them: the first log2(n) rounds of a bitonic network over
+     * lanes * n slots sort each block of n values on its own, the even blocks in ascending order and
+     * the odd ones in descending order
+     *
+     * @param lists The lists, all of the same power-of-two length
+     * @return The slots to be encrypted
+     */
+    static vector<double> pack_lanes(const vector<vector<double>>& lists);
+
+    /**
+     * Split the decrypted slots of a sorted ciphertext into its lists, all in ascending order
+     *
+     * @param slots The decrypted slots
+     * @param n The values of each list
+     * @param lanes The number of lists
+     */
+    static vector<vector<double>> unpack_lanes(const vector<double>& slots, int n, int lanes);
+
     /**
      * Evaluates a layer of a Sorting Network. In particular, it performs the swap
      * operation exploiting the SIMD parallelism in order to evaluate a whole layer.
@@ -45,10 +137,47 @@ private:
      * @param arrowsdelta The arrowsdelta value, i.e., the distance between compared elements
      * @param round The current round
      * @param stage The current stage
-     * @param poly_degree The degree of the ReLU Chebyshev polynomial
+     * @param descending Whether the blocks sorted ascending by the network are sorted descending instead
      * @return The vector obtained by applying the swapping opeartions
      */
-    Ctxt swap(const Ctxt &in, int arrowsdelta, int round, int stage);
+    Ctxt swap(const Ctxt &in, int arrowsdelta, int round, int stage, bool descending = false);
+
+    /**
+     * The swap of a layer over several keys: a pair is ordered by the first key where it differs,
+     * s_0^3 + (1 - s_0^2) (s_1^3 + (1 - s_1^2) (...)), s_k being sign(a_k - b_k), and a tie on every key
+     * leaves the pair unchanged
+     */
+    vector<Ctxt> swap_lexicographic(const vector<Ctxt> &keys, int arrowsdelta, int round, int stage);
+
+private:
+
+    // The ReLU degree of a layer, given its index in the plan
+    int layer_relu_degree(int layer) const;
+
+    // Makes the rotation keys of a layer resident and starts loading those of the next one (low-memory mode)
+    void stage_rotations(const NetworkSchedule& plan, int layer);
+
+    // The layers of sort() from first_layer (counted from 1) onwards
+    Ctxt sort_layers(const Ctxt& in, int first_layer);
+
+    // Whether an approximate sort drops the layer, one of the last stages of the last rounds
+    bool layer_skipped(const NetworkLayer& layer) const;
+
+    // The last layer (counted from 1) that sorts lists of n values, the one not followed by a bootstrapping
+    int last_sorting_layer(const NetworkSchedule& plan) const;
+
+    /*
+     * Writes the ciphertext after `layer` layers in the background: the ciphertext first, then the
+     * index that points to it, so an interruption at any time leaves the previous checkpoint valid
+     */
+    void checkpoint(const Ctxt& c, int layer);
+
+    // The layers done and the ciphertext of the last checkpoint, 0 and no file if none
+    int checkpoint_layer() const;
+    string checkpoint_path(int layer) const;
+
+    // What decides the circuit of sort(): a checkpoint can only be resumed by a sort that agrees on it
+    string circuit_description() const;
 
     /**
      * Generates a set of four masks to be applied to the four comparison vectors
@@ -57,11 +186,29 @@ private:
      * @param num_slots The number of values of the input vector
      * @param round The current round
      * @param stage The current stage
+     * @param descending Whether to swap the masks of the ascending and of the descending pairs
      * @return Four masks to be applied to the four comparison vectors for extracting the
      * required values
      */
-    vector<Ptxt> generate_layer_masks(int encoding_level, int length, int round, int stage, double mask_value = 1.0);
+    vector<Ptxt> generate_layer_masks(int encoding_level, int length, int round, int stage, double mask_value = 1.0,
+                                      bool descending = false);
 };
 
+/**
+ * Search the lowest ReLU degree of each layer that keeps the network-based sorting correct,
+ * by dry runs over inputs spaced by δ. The layers are lowered one at a time, in the order of the
+ * plan, each to the lowest degree (one per depth of the Paterson-Stockmeyer evaluation) for which
+ * every trial sorted by the uniform degree still sorts with an error below δ
+ *
+ * @param n The number of values to be sorted
+ * @param d The minimum distance δ between the values
+ * @param trials The random inputs every candidate schedule is checked on
+ * @param noise_bits If positive, the dry runs add a Gaussian error of 2^-noise_bits after every operation
+ * @param seed The seed of the first input and of its noise
+ * @return The parameters of network_parameters(n, d), with relu_schedule set and relu_degree set to
+ * its highest degree
+ */
+NetworkParameters search_relu_schedule(int n, double d, int trials = 8, double noise_bits = 0, int seed = 0);
+
 
 #endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_NETWORKSORTING_H
@@ -3,44 +3,405 @@
 //
 
 #include "PermutationSorting.h"
+#include "PlainController.h"
+#include "CostModel.h"
+#include "Threading.h"
 
-Ctxt PermutationSorting::sort(const Ctxt& in_exp, const Ctxt& in_rep) {
-    Ctxt indexing;
+template <class Controller>
+auto PermutationSorting<Controller>::sort(const Ctxt& in_exp, const Ctxt& in_rep) -> Ctxt {
+    TracePhase phase("permutation.sort");
 
-    Ctxt difference = controller.sub(in_exp, in_rep);
-    Ctxt cmp = controller.sigmoid(difference, 1, degree_sigmoid, -sigmoid_scaling);
+    Ctxt indexing = rank(in_exp, in_rep);
+
+    // Indexes are correct, simply scaled by 1/n for approximations to run over [-1, 1]
+
+    Ctxt ordered = compute_sorting(indexing, in_rep);
+
+    return ordered;
+
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::rank(const Ctxt& in_exp, const Ctxt& in_rep) -> Ctxt {
+    TracePhase phase("permutation.rank");
+
+    return rank_comparisons(compute_comparison(in_exp, in_rep));
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::rank_comparisons(const Ctxt& cmp) -> Ctxt {
+    if (!tieoffset) return compute_indexing(cmp);
+
+    return rank_with_counts(cmp).first;
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::sort_lexicographic(const vector<Ctxt>& keys_exp, const vector<Ctxt>& keys_rep) -> vector<Ctxt> {
+    TracePhase phase("permutation.lexicographic");
+
+    int keys = keys_exp.size();
+
+    if (keys < 2 || keys_rep.size() != keys_exp.size()) {
+        throw invalid_argument("A lexicographic sort takes two or more keys, each in both encodings");
+    }
+    if (scheme_switching) {
+        throw invalid_argument("A lexicographic sort requires the sigmoid comparison: the ties of a key come from its transition band");
+    }
+
+    Ctxt indexing = rank_comparisons(compute_lexicographic_comparison(keys_exp, keys_rep));
+
+    return permute_keys(compute_permutation_matrix(indexing), keys_rep);
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::sort_lexicographic_packed(const vector<Ctxt>& pairs_left, const vector<Ctxt>& pairs_right,
+                                                               const vector<Ctxt>& keys_rep) -> vector<Ctxt> {
+    TracePhase phase("permutation.lexicographic");
+
+    int keys = keys_rep.size();
+
+    if (keys < 2 || (int) pairs_left.size() != (keys + 1) / 2 || pairs_right.size() != pairs_left.size()) {
+        throw invalid_argument("A packed lexicographic sort takes two or more keys, two by two in half-diagonal packing");
+    }
+    if (scheme_switching || tieoffset) {
+        throw invalid_argument("The half-diagonal packing requires the sigmoid comparison without tie-offset: the equality counts span the whole matrix");
+    }
+
+    Ctxt indexing = compute_half_indexing(compute_packed_comparison(pairs_left, pairs_right, keys));
+
+    return permute_keys(compute_permutation_matrix(indexing), keys_rep);
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::sort_packed(const Ctxt& pair_left, const Ctxt& pair_right, const Ctxt& first_rep,
+                                                 const Ctxt& second_rep) -> pair<Ctxt, Ctxt> {
+    TracePhase phase("permutation.packed");
+
+    if (scheme_switching || tieoffset) {
+        throw invalid_argument("The half-diagonal packing requires the sigmoid comparison without tie-offset: the equality counts span the whole matrix");
+    }
+
+    Ctxt cmp = compute_comparison(pair_left, pair_right);
+
+    vector<Ctxt> ranks(2), lists_rep = {first_rep, second_rep}, sorted(2);
+
+    {
+        TracePhase indexing("indexing");
+        Ctxt cleaned = clean_comparisons(cmp);
+
+        // The second list is in the second half: a rotation brings its diagonals over the ones of the first
+        ranks = {half_ranks(cleaned), half_ranks(controller.rot(cleaned, n * n / 2))};
+    }
+
+#pragma omp parallel for num_threads(min(task_threads(), 2))
+    for (int l = 0; l < 2; l++) {
+        ThreadingTask task(l);
+        sorted[l] = compute_sorting(ranks[l], lists_rep[l]);
+    }
+
+    return {sorted[0], sorted[1]};
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::permute_keys(const Ctxt& permutation_matrix, const vector<Ctxt>& keys_rep) -> vector<Ctxt> {
+    int keys = keys_rep.size();
+
+    // The same permutation moves every key
+    vector<Ctxt> sorted(keys);
+
+#pragma omp parallel for num_threads(min(task_threads(), keys))
+    for (int k = 0; k < keys; k++) {
+        ThreadingTask task(k);
+        sorted[k] = apply_permutation(permutation_matrix, keys_rep[k]);
+    }
+
+    return sorted;
+}
+
+template <class Controller>
+pair<vector<double>, vector<double>> PermutationSorting<Controller>::half_diagonal_slots(const vector<double>& first,
+                                                                                         const vector<double>& second, int n) {
+    vector<double> left(n * n), right(n * n);
+
+    for (int half = 0; half < 2; half++) {
+        const vector<double>& key = half == 0 ? first : second;
+
+        for (int k = 0; k < n / 2; k++) {
+            for (int j = 0; j < n; j++) {
+                int slot = (half * n / 2 + k) * n + j;
+
+                left[slot] = key[(j - k - 1 + n) % n];
+                right[slot] = key[j];
+            }
+        }
+    }
+
+    return {left, right};
+}
+
+template <class Controller>
+vector<int> PermutationSorting<Controller>::half_packing_rotations() const {
+    vector<int> rotations = {-n};
+
+    for (int i = 0; i < log2(n / 2); i++) {
+        rotations.push_back(pow(2, i) * (n + 1));
+    }
+
+    return rotations;
+}
 
-    if (tieoffset) {
-        Ctxt offset;
+template <class Controller>
+auto PermutationSorting<Controller>::rank_with_counts(const Ctxt& cmp) -> pair<Ctxt, EqualityCounts> {
+    Ctxt indexing, offset;
+    EqualityCounts counts;
 
-#pragma omp parallel sections
+    // Task-level parallelism: each section gets its share of the limb-level threads
+#pragma omp parallel sections num_threads(task_threads())
+    {
+#pragma omp section
         {
+            ThreadingTask task(0);
+            indexing = compute_indexing(cmp);
+        }
+
 #pragma omp section
-            {
-                indexing = compute_indexing(cmp);
-            }
+        {
+            ThreadingTask task(1);
+            TracePhase phase("tieoffset");
+
+            counts = compute_equality_counts(cmp);
+            offset = compute_offset(counts);
+        }
+    }
+
+    return {controller.add(indexing, offset), counts};
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::sort_with_duplicates(const Ctxt& in_exp, const Ctxt& in_rep) -> pair<Ctxt, Duplicates> {
+    TracePhase phase("permutation.sort");
+
+    check_duplicates();
+
+    pair<Ctxt, EqualityCounts> ranked = rank_with_counts(compute_comparison(in_exp, in_rep));
 
+    Ctxt sorted;
+    Duplicates duplicates;
+
+#pragma omp parallel sections num_threads(task_threads())
+    {
 #pragma omp section
-            {
-                offset = compute_tieoffset(cmp);
-            }
+        {
+            ThreadingTask task(0);
+            sorted = compute_sorting(ranked.first, in_rep);
+        }
+
+#pragma omp section
+        {
+            ThreadingTask task(1);
+            duplicates = compute_duplicates(ranked.second);
         }
+    }
+
+    return {sorted, duplicates};
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::duplicates(const Ctxt& in_exp, const Ctxt& in_rep) -> Duplicates {
+    TracePhase phase("permutation.duplicates");
+
+    check_duplicates();
+
+    return compute_duplicates(compute_equality_counts(compute_comparison(in_exp, in_rep)));
+}
 
-        indexing = controller.add(indexing, offset);
-    } else {
-        indexing = compute_indexing(cmp);
+template <class Controller>
+void PermutationSorting<Controller>::check_duplicates() const {
+    if (!tieoffset || scheme_switching) {
+        throw invalid_argument("Duplicate statistics require the tie-offset: its equality matrix and its depth");
     }
+}
 
+template <class Controller>
+auto PermutationSorting<Controller>::select(const Ctxt& in_exp, const Ctxt& in_rep, const vector<int>& ranks) -> Ctxt {
+    TracePhase phase("permutation.select");
 
-    // Indexes are correct, simply scaled by 1/n for approximations to run over [-1, 1]
+    if (ranks.empty() || (int) ranks.size() >= n) {
+        throw invalid_argument("Select between 1 and n - 1 ranks, or sort the whole input");
+    }
 
-    Ctxt ordered = compute_sorting(indexing, in_rep);
+    for (int k : ranks) {
+        if (k < 0 || k >= n) throw invalid_argument("Rank " + to_string(k) + " out of [0, n)");
+    }
 
-    return ordered;
+    return compute_selection(rank(in_exp, in_rep), in_rep, ranks);
+}
 
+template <class Controller>
+vector<int> PermutationSorting<Controller>::selection_rotations() const {
+    vector<int> rotations;
+
+    for (int i = 0; i < log2(n); i++) {
+        rotations.push_back(pow(2, i) * (n - 1));
+    }
+
+    return rotations;
 }
 
-Ctxt PermutationSorting::compute_indexing(const Ctxt &c){
+template <class Controller>
+auto PermutationSorting<Controller>::finalize(const Ctxt& sorted) -> Ctxt {
+    TracePhase phase("permutation.finalize");
+
+    vector<double> firsts(n * n, 0), block(n * n, 0);
+    for (int i = 0; i < n; i++) {
+        firsts[i * n] = 1;
+        block[i] = 1;
+    }
+
+    // The value i moves from slot i n to slot i: every slot in [0, n) only receives its own value
+    Ctxt values = controller.mult(sorted, controller.encode(firsts, sorted->GetLevel(), n*n));
+
+    for (int i = 0; i < log2(n); i++) {
+        int rotindex = pow(2, i) * (n - 1);
+        values = controller.add(values, controller.rot(values, rotindex));
+    }
+
+    // Repeated with period n, the slots are decoded as a ciphertext of n slots
+    values = controller.mult(values, controller.encode(block, values->GetLevel(), n*n));
+    values = controller.rotsum(values, n);
+
+    return controller.compress(values, n, output_precision_bits(delta));
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_comparison(const Ctxt &in_exp, const Ctxt &in_rep) -> Ctxt {
+    TracePhase phase("comparison");
+
+    // Exact 0/1 comparisons out of FHEW, where the sigmoid gives 1/2 on ties
+    if (scheme_switching) return controller.compare_switch(in_exp, in_rep);
+
+    Ctxt difference = controller.sub(in_exp, in_rep);
+
+    return controller.sigmoid(difference, 1, degree_sigmoid, -sigmoid_scaling);
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_lexicographic_comparison(const vector<Ctxt> &keys_exp, const vector<Ctxt> &keys_rep) -> Ctxt {
+    TracePhase phase("lexicographic.comparison");
+
+    int keys = keys_exp.size();
+    vector<Ctxt> cmp(keys), eq(keys);
+
+#pragma omp parallel for num_threads(min(task_threads(), keys))
+    for (int k = 0; k < keys; k++) {
+        ThreadingTask task(k);
+
+        cmp[k] = compute_comparison(keys_exp[k], keys_rep[k]);
+        if (k < keys - 1) eq[k] = compute_equality(cmp[k]);
+    }
+
+    // cmp_k + eq_k (cmp_k+1 - 1/2): the ties of a key are decided by the next one, and a tie on
+    // every key (the diagonal included) stays 1/2, as the indexing and the tie-offset expect
+    Ctxt combined = cmp[keys - 1];
+
+    for (int k = keys - 2; k >= 0; k--) {
+        combined = controller.add(cmp[k], controller.mult(eq[k], controller.add(combined, -0.5)));
+    }
+
+    return combined;
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_packed_comparison(const vector<Ctxt> &pairs_left, const vector<Ctxt> &pairs_right,
+                                                               int keys) -> Ctxt {
+    TracePhase phase("lexicographic.comparison");
+
+    int pairs = pairs_left.size();
+    vector<Ctxt> cmp(pairs), eq(pairs);
+
+#pragma omp parallel for num_threads(min(task_threads(), pairs))
+    for (int p = 0; p < pairs; p++) {
+        ThreadingTask task(p);
+
+        cmp[p] = compute_comparison(pairs_left[p], pairs_right[p]);
+        if (2 * p < keys - 1) eq[p] = compute_equality(cmp[p]);
+    }
+
+    // The odd keys are in the second half of their pair: a rotation brings them over the even ones
+    auto key = [&](const vector<Ctxt>& packed, int k) {
+        return k % 2 == 0 ? packed[k / 2] : controller.rot(packed[k / 2], n * n / 2);
+    };
+
+    // The same combination as compute_lexicographic_comparison, diagonal by diagonal
+    Ctxt combined = key(cmp, keys - 1);
+
+    for (int k = keys - 2; k >= 0; k--) {
+        combined = controller.add(key(cmp, k), controller.mult(key(eq, k), controller.add(combined, -0.5)));
+    }
+
+    return combined;
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_indexing(const Ctxt &c) -> Ctxt {
+    TracePhase phase("indexing");
+
+    // Nothing to clean, and no 1/2 of the comparison of each value with itself to remove
+    if (scheme_switching) return controller.rotsum(controller.mult(c, 1.0 / n), n);
+
+    Ctxt indexes = controller.rotsum(clean_comparisons(c), n);
+
+    return controller.sub(indexes, controller.encode(0.5 / n, 0, n*n));
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_half_indexing(const Ctxt &c) -> Ctxt {
+    TracePhase phase("indexing");
+
+    return half_ranks(clean_comparisons(c));
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::half_ranks(const Ctxt &cmp) -> Ctxt {
+    /*
+     * Slot (k - 1) n + m of the first half holds [x_{m-k} < x_m]. The rank of x_j sums the
+     * diagonals k = 1, ..., n/2 of column j, and the complements of the diagonals k < n/2 at
+     * column j + k: the latter are read along stride n + 1, once the ones wrapping around their
+     * row (m < k) are moved one row down
+     */
+    int rows = n / 2;
+    vector<double> inner(n * n, 0), wrapping(n * n, 0), first_row(n * n, 0);
+
+    for (int k = 0; k < rows - 1; k++) {
+        for (int m = 0; m < n; m++) {
+            if (m > k) inner[k * n + m] = 1;
+            else wrapping[k * n + m] = 1;
+        }
+    }
+    for (int j = 0; j < n; j++) first_row[j] = 1;
+
+    int level = cmp->GetLevel();
+
+    Ctxt below = cmp;
+    Ctxt above = controller.add(controller.mult(cmp, controller.encode(inner, level, n*n)),
+                                controller.rot(controller.mult(cmp, controller.encode(wrapping, level, n*n)), -n));
+
+    for (int i = 0; i < log2(rows); i++) {
+        int rotindex = pow(2, i);
+        below = controller.add(below, controller.rot(below, n * rotindex));
+        above = controller.add(above, controller.rot(above, (n + 1) * rotindex));
+    }
+
+    // Only the first row holds ranks: it is repeated over the n rows, as compute_indexing returns them
+    Ctxt indexes = controller.sub(below, controller.rot(above, 1));
+    indexes = controller.mult(indexes, controller.encode(first_row, indexes->GetLevel(), n*n));
+    indexes = controller.rotsum(indexes, n);
+
+    return controller.add(indexes, (rows - 1) / (double) n);
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::clean_comparisons(const Ctxt &c) -> Ctxt {
     //Devo dividere per n
     Ctxt cmp = c->Clone();
 
@@ -49,25 +410,24 @@ Ctxt PermutationSorting::compute_indexing(const Ctxt &c){
         cmp = controller.clean_sigmoid(cmp, n);
     } else if (delta == 0.001) {
         cmp = controller.clean_sigmoid_and_scale(cmp, 1.0 / n);
-        cmp = controller.clean_sigmoid(cmp, n);
-        cmp = controller.clean_sigmoid(cmp, n);
+        cmp = controller.clean_sigmoid(cmp, n, 2);
     } else if (delta == 0.0001) {
         cmp = controller.clean_sigmoid_and_scale(cmp, 1.0 / n);
-        cmp = controller.clean_sigmoid(cmp, n);
-        cmp = controller.clean_sigmoid(cmp, n);
-        cmp = controller.clean_sigmoid(cmp, n);
-        cmp = controller.clean_sigmoid(cmp, n);
-        cmp = controller.clean_sigmoid(cmp, n);
-        cmp = controller.clean_sigmoid(cmp, n);
-        //cmp = controller.clean_sigmoid(cmp, n);
+        cmp = controller.clean_sigmoid(cmp, n, 6);
     }
 
-    Ctxt indexes = controller.rotsum(cmp, n);
+    return cmp;
+}
 
-    return controller.sub(indexes, controller.encode(0.5 / n, 0, n*n));
+template <class Controller>
+auto PermutationSorting<Controller>::compute_tieoffset(const Ctxt &c) -> Ctxt {
+    TracePhase phase("tieoffset");
+
+    return compute_offset(compute_equality_counts(c));
 }
 
-Ctxt PermutationSorting::compute_tieoffset(const Ctxt &c){
+template <class Controller>
+auto PermutationSorting<Controller>::compute_equality(const Ctxt &c) -> Ctxt {
     Ctxt eq = c->Clone();
 
     if (delta == 0.01) {
@@ -75,23 +435,21 @@ Ctxt PermutationSorting::compute_tieoffset(const Ctxt &c){
         //eq = controller.clean_sigmoid(eq, 1);
     }
     if (delta == 0.001) {
-        eq = controller.clean_sigmoid(eq, 1);
-        eq = controller.clean_sigmoid(eq, 1);
-        //eq = controller.clean_sigmoid(eq, 1);
+        eq = controller.clean_sigmoid(eq, 1, 2);
     } else if (delta == 0.0001) {
-        eq = controller.clean_sigmoid(eq, 1);
-        eq = controller.clean_sigmoid(eq, 1);
-        eq = controller.clean_sigmoid(eq, 1);
-        eq = controller.clean_sigmoid(eq, 1);
-        eq = controller.clean_sigmoid(eq, 1);
-        eq = controller.clean_sigmoid(eq, 1);
-        eq = controller.clean_sigmoid(eq, 1);
-        //eq = controller.clean_sigmoid(eq, 1);
+        eq = controller.clean_sigmoid(eq, 1, 7);
     }
 
     eq = controller.mult(eq, controller.sub(1, eq));
     eq = controller.clean_sigmoid_and_scale(eq, 6.4);
 
+    return eq;
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_equality_counts(const Ctxt &c) -> EqualityCounts {
+    Ctxt eq = compute_equality(c);
+
     Ctxt eqclone = controller.add(eq, controller.encode(0, eq->GetLevel(), n*n));
 
     for (int i = 0; i < log2(n); i++) {
@@ -99,8 +457,6 @@ Ctxt PermutationSorting::compute_tieoffset(const Ctxt &c){
         eqclone = controller.add(eqclone, controller.rot(eqclone, n * rotindex));
     }
 
-    Ctxt sx = controller.mult(eqclone, 0.5 / n);
-
     vector<double> triangular_matrix;
 
     for (int rows = 0; rows < n; rows++) {
@@ -121,13 +477,50 @@ Ctxt PermutationSorting::compute_tieoffset(const Ctxt &c){
         dx = controller.add(dx, controller.rot(dx, n * rotindex));
     }
 
-    Ctxt offset = controller.sub(sx, dx);
+    return {eqclone, dx};
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_offset(const EqualityCounts &counts) -> Ctxt {
+    Ctxt sx = controller.mult(counts.multiplicity, 0.5 / n);
+
+    Ctxt offset = controller.sub(sx, counts.preceding);
     offset = controller.add(offset, 0.5 / n);
 
     return offset;
 }
 
-Ctxt PermutationSorting::compute_sorting(const Ctxt &indexes, const Ctxt &in_rep) {
+template <class Controller>
+auto PermutationSorting<Controller>::compute_duplicates(const EqualityCounts &counts) -> Duplicates {
+    TracePhase phase("duplicates");
+
+    // x_j is a first occurrence when the only value equal to it up to slot j is itself
+    Ctxt first = controller.sinc(controller.add(counts.preceding, -1.0 / n), degree_sinc, n);
+
+    if (n >= 32) {
+        first = controller.clean_sigmoid(first, 1, n >= 128 ? 2 : 1);
+    }
+
+    // Every block of n slots holds the same values: the rotations by 1, ..., n/2 sum a block
+    Ctxt distinct = first;
+
+    for (int i = 0; i < log2(n); i++) {
+        int rotindex = pow(2, i);
+        distinct = controller.add(distinct, controller.rot(distinct, rotindex));
+    }
+
+    return {counts.multiplicity, first, distinct};
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_sorting(const Ctxt &indexes, const Ctxt &in_rep) -> Ctxt {
+    TracePhase phase("sorting");
+
+    return apply_permutation(compute_permutation_matrix(indexes), in_rep);
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::compute_permutation_matrix(const Ctxt &indexes) -> Ctxt {
     vector<double> zeros;
     for (int i = 0; i < n; i++) {
         for (int j = 0; j < n; j++) {
@@ -143,12 +536,14 @@ Ctxt PermutationSorting::compute_sorting(const Ctxt &indexes, const Ctxt &in_rep
 
 
     if (n >= 32) {
-        permutation_matrix = controller.clean_sigmoid(permutation_matrix, 1);
-    }
-    if (n >= 128) {
-        permutation_matrix = controller.clean_sigmoid(permutation_matrix, 1);
+        permutation_matrix = controller.clean_sigmoid(permutation_matrix, 1, n >= 128 ? 2 : 1);
     }
 
+    return permutation_matrix;
+}
+
+template <class Controller>
+auto PermutationSorting<Controller>::apply_permutation(const Ctxt &permutation_matrix, const Ctxt &in_rep) -> Ctxt {
     Ctxt sorted = controller.mult(in_rep, permutation_matrix);
 
     for (int i = 0; i < log2(n); i++) {
@@ -159,4 +554,43 @@ Ctxt PermutationSorting::compute_sorting(const Ctxt &indexes, const Ctxt &in_rep
     return sorted;
 }
 
+template <class Controller>
+auto PermutationSorting<Controller>::compute_selection(const Ctxt &indexes, const Ctxt &in_rep, const vector<int> &ranks) -> Ctxt {
+    TracePhase phase("selection");
+
+    /*
+     * The output r gathers the slots r + j (n - 1), j < n: one per column, so one per input
+     * value, and disjoint from the ones of the other outputs as long as there are fewer than n.
+     * Only those slots are compared with a target rank, the others are masked out of in_rep
+     */
+    vector<double> targets(n * n, 0), selected(n * n, 0);
+
+    for (int r = 0; r < (int) ranks.size(); r++) {
+        for (int j = 0; j < n; j++) {
+            int slot = (r + j * (n - 1)) % (n * n);
+
+            targets[slot] = ranks[r] / (double) n;
+            selected[slot] = 1;
+        }
+    }
+
+    Ctxt indicator = controller.sinc(controller.sub(indexes, controller.encode(targets, 0, n*n)), degree_sinc, n);
+
+    if (n >= 32) {
+        indicator = controller.clean_sigmoid(indicator, 1, n >= 128 ? 2 : 1);
+    }
+
+    // in_rep is far fresher than the indicator: masking it costs no level of the circuit
+    Ctxt values = controller.mult(controller.mult(in_rep, controller.encode(selected, in_rep->GetLevel(), n*n)), indicator);
+
+    for (int i = 0; i < log2(n); i++) {
+        int rotindex = pow(2, i) * (n - 1);
+        values = controller.add(values, controller.rot(values, rotindex));
+    }
+
+    return values;
+}
 
+template class PermutationSorting<FHEController>;
+template class PermutationSorting<PlainController>;
+template class PermutationSorting<CountingController>;
@@ -7,6 +7,7 @@
 #define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_PERMUTATIONSORTING_H
 
 #include "../src/FHEController.h"
+#include "SortingParameters.h"
 // For multithreading
 #include <cmath>
 #include <omp.h>
@@ -17,8 +18,12 @@ using namespace std;
 using namespace std::chrono;
 
 
+template <class Controller>
 class PermutationSorting {
-    FHEController controller;
+    using Ctxt = typename Controller::Ctxt;
+    using Ptxt = typename Controller::Ptxt;
+
+    Controller controller;
     int sigmoid_scaling;
     int degree_sigmoid;
     int degree_sinc;
@@ -28,36 +33,195 @@ class PermutationSorting {
     bool toy;
     bool verbose;
     bool clean_permutation_matrix;
+    bool scheme_switching;
 
     public:
-    PermutationSorting(FHEController controller,
-                       int sigmoid_scaling,
-                       int degree_sigmoid,
-                       int degree_sinc,
-                       bool tieoffset,
-                       int n,
-                       double delta,
-                       bool toy,
-                       bool verbose,
-                       bool clean_permutation_matrix)
+    /**
+     * @param controller The controller, a handle that can be shared with other sorts
+     * @param config The input shape and the approximation parameters
+     */
+    PermutationSorting(Controller controller, const PermutationConfig& config)
             : controller(controller),
-              sigmoid_scaling(sigmoid_scaling),
-              degree_sigmoid(degree_sigmoid),
-              degree_sinc(degree_sinc),
-              tieoffset(tieoffset),
-              n(n),
-              delta(delta),
-              toy(toy),
-              verbose(verbose),
-              clean_permutation_matrix(clean_permutation_matrix) {}
+              sigmoid_scaling(config.parameters.sigmoid_scaling),
+              degree_sigmoid(config.parameters.degree_sigmoid),
+              degree_sinc(config.parameters.degree_sinc),
+              tieoffset(config.tieoffset),
+              n(config.n),
+              delta(config.delta),
+              toy(config.toy),
+              verbose(config.verbose),
+              clean_permutation_matrix(config.clean_permutation_matrix),
+              scheme_switching(config.scheme_switching) {}
 
         Ctxt sort(const Ctxt& in_exp, const Ctxt& in_rep);
 
-    private:
+        /**
+         * Statistics of the repeated values, read off the equality matrix of the tie-offset. Every
+         * block of n slots holds the same values
+         */
+        struct Duplicates {
+            Ctxt multiplicity;      // Slot j: how many values equal x_j, x_j included
+            Ctxt first;             // Slot j: 1 if no x_i with i < j equals x_j, 0 otherwise
+            Ctxt distinct;          // Every slot: the number of distinct values
+        };
+
+        /**
+         * Sort the input and compute its duplicate statistics in the same pass: the comparisons and
+         * the equality matrix are computed once. Requires the tie-offset (and its depth)
+         *
+         * @return The output of sort() and the statistics
+         */
+        pair<Ctxt, Duplicates> sort_with_duplicates(const Ctxt& in_exp, const Ctxt& in_rep);
+
+        /**
+         * Only the duplicate statistics, within the depth of a sort with the tie-offset
+         */
+        Duplicates duplicates(const Ctxt& in_exp, const Ctxt& in_rep);
+
+        /**
+         * Sort by several keys at once, in lexicographic order: the comparison matrices of the keys
+         * are combined before the indexing, so a single permutation matrix is computed and applied
+         * to every key. It requires the depth of permutation_parameters(..., keys)
+         *
+         * @param keys_exp The keys in expanded encoding, the primary one first
+         * @param keys_rep The same keys in repeated encoding
+         * @return Every key, in the order of the records, as sort() returns a single one
+         */
+        vector<Ctxt> sort_lexicographic(const vector<Ctxt>& keys_exp, const vector<Ctxt>& keys_rep);
+
+        /**
+         * The slots of two keys in half-diagonal packing. The comparison of x_i with x_j is the
+         * complement of the one of x_j with x_i, so a key only needs the n/2 diagonals
+         * (x_{j-k}, x_j), k = 1, ..., n/2, of its matrix: n^2 / 2 slots, and two keys fill a ciphertext.
+         * Row k - 1 of the first half holds the diagonal k of the first key, the second half the
+         * ones of the second key
+         *
+         * @param first, second The two keys, of n values each (the same key twice for an odd one out),
+         * or the two lists of sort_packed()
+         * @return The slots of the two operands of the comparison, to be encrypted over n^2 slots
+         */
+        static pair<vector<double>, vector<double>> half_diagonal_slots(const vector<double>& first,
+                                                                       const vector<double>& second, int n);
+
+        /**
+         * sort_lexicographic() over keys in half-diagonal packing: each sigmoid (and each equality
+         * matrix) serves two keys, and the ranks are derived from the diagonals by strided sums.
+         * Requires the sigmoid comparison without tie-offset, the depth of
+         * permutation_parameters(..., keys, true) and the half_packing_rotations()
+         *
+         * @param pairs_left, pairs_right The encrypted half_diagonal_slots() of the keys 2p and 2p + 1
+         * @param keys_rep Every key in repeated encoding, the primary one first
+         * @return Every key, in the order of the records
+         */
+        vector<Ctxt> sort_lexicographic_packed(const vector<Ctxt>& pairs_left, const vector<Ctxt>& pairs_right,
+                                               const vector<Ctxt>& keys_rep);
+
+        /**
+         * Sort two independent lists of n values in half-diagonal packing: a single sigmoid compares
+         * both, and each gets its own ranks and permutation matrix. Requires the sigmoid comparison
+         * without tie-offset, the depth of permutation_parameters(..., 1, true) and the
+         * half_packing_rotations()
+         *
+         * @param pair_left, pair_right The encrypted half_diagonal_slots() of the two lists
+         * @param first_rep, second_rep The two lists in repeated encoding
+         * @return The two lists, each sorted as sort() returns it
+         */
+        pair<Ctxt, Ctxt> sort_packed(const Ctxt& pair_left, const Ctxt& pair_right, const Ctxt& first_rep,
+                                     const Ctxt& second_rep);
+
+        /**
+         * Rotation indexes used by sort_lexicographic_packed() and sort_packed(), on top of the ones
+         * of generate_rotation_keys_permutation
+         */
+        vector<int> half_packing_rotations() const;
+
+        /**
+         * Encrypted ranks of the input, without sorting it (argsort-style clients)
+         *
+         * @return A ciphertext whose slot j (in every block of n slots) holds rank(x_j) / n, the
+         * rank counting the smaller values (and, with the tie-offset, the equal ones before x_j)
+         */
+        Ctxt rank(const Ctxt& in_exp, const Ctxt& in_rep);
+
+        /**
+         * The values of the given ranks, e.g. the median or other quantiles, packed at the start of
+         * the ciphertext: each requested rank gets a row of indicators in place of the permutation
+         * matrix. The rows are still evaluated over the n^2 slots, and a polynomial costs the same
+         * whatever slots it fills, so this stage costs as much as the one of sort(). What it saves
+         * is the repacking of finalize(): the selected values already sit in the first slots
+         *
+         * @param ranks The requested ranks, in [0, n), fewer than n of them
+         * @return A ciphertext whose slot r holds the value of rank ranks[r]; the slots from
+         * ranks.size() on are not meaningful
+         */
+        Ctxt select(const Ctxt& in_exp, const Ctxt& in_rep, const vector<int>& ranks);
+
+        /**
+         * Rotation indexes used by select() and finalize(), on top of the ones of
+         * generate_rotation_keys_permutation
+         */
+        vector<int> selection_rotations() const;
+
+        /**
+         * Repack the output of sort(), whose values sit every n slots of n^2, as a ciphertext of n
+         * slots at the lowest modulus that keeps it, much smaller to send and faster to decrypt.
+         * It consumes FINALIZATION_LEVELS levels, to be added to the circuit depth
+         *
+         * @param sorted The output of sort()
+         * @return The sorted values, in the n slots of the ciphertext
+         */
+        Ctxt finalize(const Ctxt& sorted);
+
+        // The two masks of finalize()
+        static const int FINALIZATION_LEVELS = 2;
+
+        /*
+         * The stages of sort(), exposed so that they can be measured in isolation
+         */
+        Ctxt compute_comparison(const Ctxt &in_exp, const Ctxt &in_rep);
+        Ctxt compute_lexicographic_comparison(const vector<Ctxt> &keys_exp, const vector<Ctxt> &keys_rep);
+        Ctxt compute_packed_comparison(const vector<Ctxt> &pairs_left, const vector<Ctxt> &pairs_right, int keys);
         Ctxt compute_indexing(const Ctxt &c);
+        Ctxt compute_half_indexing(const Ctxt &c);
         Ctxt compute_tieoffset(const Ctxt &c);
+
+        // Column sums of the equality matrix: the multiplicity of x_j, and the values equal to x_j
+        // up to slot j (itself included) over n
+        struct EqualityCounts {
+            Ctxt multiplicity;
+            Ctxt preceding;
+        };
+
+        // The 0/1 matrix of the pairs in the transition band of the comparison, the diagonal included
+        Ctxt compute_equality(const Ctxt &c);
+
+        EqualityCounts compute_equality_counts(const Ctxt &c);
+        Ctxt compute_offset(const EqualityCounts &counts);
+        Duplicates compute_duplicates(const EqualityCounts &counts);
         Ctxt compute_sorting(const Ctxt &indexes, const Ctxt &in_rep);
+        Ctxt compute_permutation_matrix(const Ctxt &indexes);
+        Ctxt apply_permutation(const Ctxt &permutation_matrix, const Ctxt &in_rep);
+        Ctxt compute_selection(const Ctxt &indexes, const Ctxt &in_rep, const vector<int> &ranks);
+
+    private:
         void set_degrees(double d);
+
+        // The ranks out of a comparison matrix, with the tie-offset if configured
+        Ctxt rank_comparisons(const Ctxt& cmp);
+
+        // The comparisons brought to 0/1 and scaled by 1/n, before they are summed into ranks
+        Ctxt clean_comparisons(const Ctxt& c);
+
+        // The ranks out of cleaned comparisons in half-diagonal packing, read from the first half
+        Ctxt half_ranks(const Ctxt& cmp);
+
+        // Applies the permutation matrix to every key, in parallel
+        vector<Ctxt> permute_keys(const Ctxt& permutation_matrix, const vector<Ctxt>& keys_rep);
+
+        // The tie-offset ranks, together with the equality counts they come from
+        pair<Ctxt, EqualityCounts> rank_with_counts(const Ctxt& cmp);
+
+        void check_duplicates() const;
 };
 
 
@@ -0,0 +1,410 @@
+#include "PlainController.h"
+
+#include <fstream>
+
+PlainController::PlainController() : state(make_shared<State>()) {}
+
+int PlainController::generate_context_network(int num_slots, int levels_required, bool toy_parameters, double delta) {
+    // Same level budgets of FHEController, bootstrapping with sparse ternary secrets costs 9 levels plus the budget
+    vector<uint32_t> level_budget = {3, 3};
+    if (delta == 0.001) level_budget = {2, 3};
+
+    int bootstrap_depth = 9 + level_budget[0] + level_budget[1];
+
+    state->num_slots = num_slots;
+    state->depth = levels_required + 1 + bootstrap_depth;
+    state->bootstrap_level = bootstrap_depth;
+
+    cout << "Levels required: " << levels_required << endl;
+    cout << "Dry run: cleartext slots, circuit depth " << state->depth << endl << endl;
+
+    return state->depth;
+}
+
+void PlainController::generate_context_permutation(int num_slots, int levels_required, bool toy, int n, double delta) {
+    state->num_slots = num_slots;
+    state->depth = levels_required;
+    state->bootstrap_level = 0;
+
+    cout << "Dry run: cleartext slots, circuit depth " << state->depth << endl;
+}
+
+void PlainController::set_noise(double bits, unsigned int seed) {
+    state->noise = bits > 0 ? pow(2, -bits) : 0;
+    state->bootstrap_noise = bits > 0 ? pow(2, -min(bits, 20.0)) : 0;
+    state->generator.seed(seed);
+}
+
+DryRunStatistics PlainController::statistics() const {
+    lock_guard<mutex> lock(state->lock);
+
+    DryRunStatistics s;
+    s.depth = state->depth;
+    s.max_level = state->max_level;
+    s.depth_exceeded = state->depth_exceeded;
+    s.out_of_range = state->out_of_range;
+
+    return s;
+}
+
+PlainController::Ctxt PlainController::make(vector<double> values, int level, bool bootstrapped) {
+    lock_guard<mutex> lock(state->lock);
+
+    double sigma = bootstrapped ? state->bootstrap_noise : state->noise;
+    if (sigma > 0) {
+        normal_distribution<double> error(0, sigma);
+        for (double& v : values) v += error(state->generator);
+    }
+
+    state->max_level = max(state->max_level, level);
+    if (level > state->depth) state->depth_exceeded = true;
+
+    Ctxt c = make_shared<PlainCiphertext>();
+    c->values = std::move(values);
+    c->level = level;
+
+    return c;
+}
+
+void PlainController::count_out_of_range(const vector<double>& values) {
+    long count = 0;
+    for (double v : values) if (abs(v) > 1) count++;
+
+    if (count > 0) {
+        lock_guard<mutex> lock(state->lock);
+        state->out_of_range += count;
+    }
+}
+
+PlainController::Ptxt PlainController::encode(const vector<double> &vec, int level, int num_slots) {
+    Ptxt p = make_shared<PlainPlaintext>();
+    p->values = vec;
+    p->values.resize(num_slots > 0 ? num_slots : state->num_slots, 0);
+    p->level = level;
+
+    return p;
+}
+
+PlainController::Ptxt PlainController::encode(double value, int level, int num_slots) {
+    return encode(vector<double>(num_slots, value), level, num_slots);
+}
+
+PlainController::Ctxt PlainController::encrypt(const vector<double> &vec, int level, int num_slots) {
+    return make(encode(vec, level, num_slots)->values, level);
+}
+
+PlainController::Ctxt PlainController::encrypt_expanded(const vector<double> &vec, int level, int num_slots, int repetitions) {
+    vector<double> repeated;
+
+    for (double v : vec) {
+        for (int j = 0; j < repetitions; j++) {
+            repeated.push_back(v);
+        }
+    }
+
+    return encrypt(repeated, level, num_slots);
+}
+
+PlainController::Ctxt PlainController::encrypt_repeated(const vector<double> &vec, int level, int num_slots, int repetitions) {
+    vector<double> repeated;
+
+    for (int i = 0; i < repetitions; i++) {
+        repeated.insert(repeated.end(), vec.begin(), vec.end());
+    }
+
+    return encrypt(repeated, level, num_slots);
+}
+
+vector<double> PlainController::decode(const Ptxt &p) {
+    return p->values;
+}
+
+PlainController::Ptxt PlainController::decrypt(const Ctxt &c) {
+    Ptxt p = make_shared<PlainPlaintext>();
+    p->values = c->values;
+    p->level = c->level;
+
+    return p;
+}
+
+// Elementwise combination of two slot vectors, the shorter one is zero-padded
+static vector<double> combine(const vector<double>& a, const vector<double>& b, const function<double(double, double)>& f) {
+    vector<double> result(max(a.size(), b.size()));
+
+    for (size_t i = 0; i < result.size(); i++) {
+        result[i] = f(i < a.size() ? a[i] : 0, i < b.size() ? b[i] : 0);
+    }
+
+    return result;
+}
+
+PlainController::Ctxt PlainController::add(const Ctxt &a, const Ctxt &b) {
+    return make(combine(a->values, b->values, plus<double>()), max(a->level, b->level));
+}
+
+PlainController::Ctxt PlainController::add(const Ctxt &a, const Ptxt &b) {
+    return make(combine(a->values, b->values, plus<double>()), max(a->level, b->level));
+}
+
+PlainController::Ctxt PlainController::add(const Ctxt &a, double d) {
+    vector<double> values = a->values;
+    for (double& v : values) v += d;
+
+    return make(values, a->level);
+}
+
+PlainController::Ctxt PlainController::add_tree(vector<Ctxt> v) {
+    vector<double> values = v[0]->values;
+    int level = v[0]->level;
+
+    for (size_t i = 1; i < v.size(); i++) {
+        values = combine(values, v[i]->values, plus<double>());
+        level = max(level, v[i]->level);
+    }
+
+    return make(values, level);
+}
+
+PlainController::Ctxt PlainController::sub(double a, const Ctxt &b) {
+    vector<double> values = b->values;
+    for (double& v : values) v = a - v;
+
+    return make(values, b->level);
+}
+
+PlainController::Ctxt PlainController::sub(const Ctxt &a, const Ctxt &b) {
+    return make(combine(a->values, b->values, minus<double>()), max(a->level, b->level));
+}
+
+PlainController::Ctxt PlainController::sub(const Ctxt &c, const Ptxt &p) {
+    return make(combine(c->values, p->values, minus<double>()), max(c->level, p->level));
+}
+
+PlainController::Ctxt PlainController::mult(const Ctxt &c, const Ptxt &p) {
+    return make(combine(c->values, p->values, multiplies<double>()), max(c->level, p->level) + 1);
+}
+
+PlainController::Ctxt PlainController::mult(const Ctxt &c1, const Ctxt &c2) {
+    return make(combine(c1->values, c2->values, multiplies<double>()), max(c1->level, c2->level) + 1);
+}
+
+PlainController::Ctxt PlainController::mult(const Ctxt &c, double d) {
+    vector<double> values = c->values;
+    for (double& v : values) v *= d;
+
+    return make(values, c->level + 1);
+}
+
+PlainController::Ctxt PlainController::rot(const Ctxt &c, int index) {
+    // Positive indexes rotate to the left, as EvalRotate
+    int slots = c->values.size();
+    vector<double> values(slots);
+
+    for (int i = 0; i < slots; i++) {
+        values[i] = c->values[((i + index) % slots + slots) % slots];
+    }
+
+    return make(values, c->level);
+}
+
+PlainController::Ctxt PlainController::bootstrap(const Ctxt &c) {
+    count_out_of_range(c->values);
+
+    return make(c->values, state->bootstrap_level, true);
+}
+
+PlainController::Ctxt PlainController::compress(const Ctxt &c, int slots, int precision_bits) {
+    return make(vector<double>(c->values.begin(), c->values.begin() + slots), state->depth);
+}
+
+PlainController::Ctxt PlainController::rotsum(const Ctxt &in, int n) {
+    Ctxt result = add(in, rot(in, n));
+
+    for (int i = 1; i < log2(n); i++) {
+        result = add(result, rot(result, n * pow(2, i)));
+    }
+
+    return result;
+}
+
+PlainController::Ctxt PlainController::chebyshev(const Ctxt &in, const string &key, const function<double(double)> &func, int degree,
+                                                 double a, double b) {
+    const vector<double>* coefficients;
+
+    {
+        lock_guard<mutex> lock(state->lock);
+
+        string cache_key = key + "/" + to_string(degree);
+        auto it = state->coefficients.find(cache_key);
+        if (it == state->coefficients.end()) {
+            it = state->coefficients.emplace(cache_key, chebyshev_coefficients(func, a, b, degree)).first;
+        }
+
+        // std::map never invalidates references to its elements
+        coefficients = &it->second;
+    }
+
+    count_out_of_range(in->values);
+
+    vector<double> values(in->values.size());
+
+#pragma omp parallel for if (values.size() >= 4096)
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = evaluate_chebyshev_series(*coefficients, a, b, in->values[i]);
+    }
+
+    return make(values, in->level + poly_evaluation_cost(degree));
+}
+
+PlainController::Ctxt PlainController::even_chebyshev(const Ctxt &in, const string &key, const function<double(double)> &f, int degree) {
+    return chebyshev(mult(in, in), key + "/even", [f](double y) { return f(sqrt(y)); }, degree / 2, 0, 1);
+}
+
+PlainController::Ctxt PlainController::polynomial(const Ctxt &in, const vector<double> &power_coefficients, int levels) {
+    vector<double> values(in->values.size());
+
+    for (size_t i = 0; i < values.size(); i++) {
+        double x = in->values[i], result = 0;
+        for (size_t k = power_coefficients.size(); k-- > 0;) result = result * x + power_coefficients[k];
+        values[i] = result;
+    }
+
+    return make(values, in->level + levels);
+}
+
+PlainController::Ctxt PlainController::sigmoid(const Ctxt &in, int n, int degree, int scaling) {
+    return chebyshev(in, "sigmoid/" + to_string(n) + "/" + to_string(scaling), sigmoid_function(n, scaling), degree);
+}
+
+PlainController::Ctxt PlainController::sinc(const Ctxt &in, int poly_degree, double n) {
+    if (even_evaluation_fits(poly_degree)) return even_chebyshev(in, "sinc/" + to_string(n), sinc_function(n), poly_degree);
+
+    return chebyshev(in, "sinc/" + to_string(n), sinc_function(n), poly_degree);
+}
+
+PlainController::Ctxt PlainController::double_sinc(const Ctxt &in, int poly_degree, double n) {
+    if (even_evaluation_fits(poly_degree)) return even_chebyshev(in, "double_sinc/" + to_string(n), double_sinc_function(n), poly_degree);
+
+    return chebyshev(in, "double_sinc/" + to_string(n), double_sinc_function(n), poly_degree);
+}
+
+PlainController::Ctxt PlainController::relu(const Ctxt &in, int poly_degree, int n) {
+    if (even_evaluation_fits(poly_degree)) return add(even_chebyshev(in, "relu", relu_even_function(), poly_degree), mult(in, 0.5));
+
+    return chebyshev(in, "relu", relu_function(), poly_degree);
+}
+
+PlainController::Ctxt PlainController::composite_sign(const Ctxt &in, const CompositeSign &sign) {
+    Ctxt result = in;
+
+    for (int i = 0; i < sign.g_iterations; i++) result = polynomial(result, sign_g_polynomial(sign.g_degree), poly_evaluation_cost(sign.g_degree));
+    for (int i = 0; i < sign.f_iterations; i++) result = polynomial(result, sign_f_polynomial(sign.f_degree), poly_evaluation_cost(sign.f_degree));
+
+    return result;
+}
+
+PlainController::Ctxt PlainController::compare_switch(const Ctxt &c1, const Ctxt &c2) {
+    vector<double> result(c1->values.size());
+
+    for (size_t i = 0; i < result.size(); i++) {
+        // The FHEW message, d 2^bits mod 2^(bits + 1), is negative when its top bit is set
+        long message = lround((c1->values[i] - c2->values[i]) * pow(2, SCHEME_SWITCH_PRECISION_BITS));
+        long modulus = 1L << (SCHEME_SWITCH_PRECISION_BITS + 1);
+
+        message = ((message % modulus) + modulus) % modulus;
+        result[i] = message >= modulus / 2 ? 1 : 0;
+    }
+
+    return make(result, SCHEME_SWITCH_LEVELS);
+}
+
+// The cleaning polynomials consume the same levels of their FHEController counterparts:
+// two for the cubic ones (x^2 times a + bx), three for the degree 5 one
+
+PlainController::Ctxt PlainController::clean_sigmoid(const Ctxt &in, double n, int iterations) {
+    Ctxt result = in;
+    for (int i = 0; i < iterations; i++) result = polynomial(result, {0, 0, n * 3, -n * n * 2}, 2);
+
+    return result;
+}
+
+PlainController::Ctxt PlainController::clean_sigmoid_and_scale(const Ctxt &in, double n) {
+    return polynomial(in, {0, 0, n * 3, -n * 2}, 2);
+}
+
+PlainController::Ctxt PlainController::clean_binary(const Ctxt &in, double scale) {
+    return polynomial(in, {0, 0, 3.0 / scale, -2.0 / scale}, 2);
+}
+
+PlainController::Ctxt PlainController::clean_sign(const Ctxt &in) {
+    return polynomial(in, {0, 0, 15, -50, 60, -24}, poly_evaluation_cost(5));
+}
+
+void PlainController::save(const Ctxt &c, const string &filename) {
+    ofstream out(filename, ios::binary);
+
+    uint64_t size = c->values.size();
+    out.write(reinterpret_cast<const char*>(&c->level), sizeof(c->level));
+    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out.write(reinterpret_cast<const char*>(c->values.data()), size * sizeof(double));
+
+    if (!out) throw runtime_error("Could not write the ciphertext to " + filename);
+}
+
+PlainController::Ctxt PlainController::load(const string &filename) {
+    ifstream in(filename, ios::binary);
+
+    Ctxt c = make_shared<PlainCiphertext>();
+    uint64_t size = 0;
+    in.read(reinterpret_cast<char*>(&c->level), sizeof(c->level));
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    c->values.resize(size);
+    in.read(reinterpret_cast<char*>(c->values.data()), size * sizeof(double));
+
+    if (!in) throw runtime_error("Could not read a ciphertext from " + filename);
+
+    return c;
+}
+
+void PlainController::save_keys(const string &directory) {
+    ofstream description(directory + "/keys.txt");
+
+    description << "depth " << state->depth << endl;
+    description << "slots " << state->num_slots << endl;
+    description << "bootstrap_level " << state->bootstrap_level << endl;
+
+    if (!description) throw runtime_error("Could not write the keys to " + directory);
+}
+
+int PlainController::load_keys(const string &directory) {
+    ifstream description(directory + "/keys.txt");
+    string field;
+
+    description >> field >> state->depth >> field >> state->num_slots >> field >> state->bootstrap_level;
+
+    if (!description) throw runtime_error("Could not read the key description in " + directory);
+
+    return state->depth;
+}
+
+void PlainController::print(const Ctxt &c, int slots, string prefix) {
+    if (slots == 0) {
+        slots = c->GetSlots();
+    }
+
+    cout << prefix << "[ ";
+
+    for (int i = 0; i < slots; i++) {
+        double v = c->values[i];
+
+        if (i == slots - 1) {
+            cout << v << " ]";
+        } else if (abs(v) <= 0.00001) {
+            cout << "0.0000" << " ";
+        } else {
+            cout << v << " ";
+        }
+    }
+
+    cout << endl;
+}
@@ -0,0 +1,192 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_PLAINCONTROLLER_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_PLAINCONTROLLER_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Utils.h"
+#include "Approximations.h"
+
+using namespace std;
+
+/*
+ * Cleartext stand-in for a CKKS ciphertext: the slots and the number of consumed levels
+ */
+struct PlainCiphertext {
+    vector<double> values;
+    int level = 0;
+
+    size_t GetLevel() const { return level; }
+    uint32_t GetSlots() const { return values.size(); }
+    shared_ptr<PlainCiphertext> Clone() const { return make_shared<PlainCiphertext>(*this); }
+};
+
+struct PlainPlaintext {
+    vector<double> values;
+    int level = 0;
+
+    size_t GetLevel() const { return level; }
+    uint32_t GetSlots() const { return values.size(); }
+};
+
+/*
+ * What a dry run observed besides the output values
+ */
+struct DryRunStatistics {
+    int depth = 0;                  // Levels available in the equivalent FHE context
+    int max_level = 0;              // Highest level reached by a ciphertext
+    bool depth_exceeded = false;    // Whether some ciphertext went beyond the available levels
+    long out_of_range = 0;          // Slots outside [-1, 1] given to a Chebyshev approximation or to bootstrapping
+};
+
+/*
+ * Dry-run backend with the same interface of FHEController. The sorting classes are templated on
+ * the controller, so the same circuit runs encrypted (FHEController), in cleartext (PlainController)
+ * or only counted (CountingController). Ciphertexts are plain vectors of doubles, so a sort runs
+ * in milliseconds: the Chebyshev approximations use the same target functions and
+ * the same coefficients computed by OpenFHE, rotations and cleaning polynomials are
+ * evaluated exactly, and levels are consumed as in the FHE circuit (one per
+ * multiplication, poly_evaluation_cost(d) per polynomial, eagerly counted).
+ * Optionally, Gaussian noise is added after each operation to mimic CKKS errors.
+ *
+ * Copies share the same state, as copies of FHEController share the same context.
+ */
+class PlainController {
+public:
+    using Ctxt = shared_ptr<PlainCiphertext>;
+    using Ptxt = shared_ptr<PlainPlaintext>;
+
+    PlainController();
+
+    /**
+     * Configure the level budget as FHEController::generate_context_network would
+     *
+     * @return the total depth of the circuit, including the bootstrapping operation
+     */
+    int generate_context_network(int num_slots, int levels_required, bool toy_parameters, double delta);
+    void generate_rotation_keys_network(int num_slots) {}
+
+    /**
+     * Configure the level budget as FHEController::generate_context_permutation would
+     */
+    void generate_context_permutation(int num_slots, int levels_required, bool toy, int n, double delta);
+    void generate_rotation_keys_permutation(int n) {}
+    void generate_rotation_key(int index) {}
+    void generate_scheme_switching_keys(int num_slots, bool toy_parameters) {}
+    void use_rotations(const vector<int>& indexes) {}
+    void prefetch_rotations(const vector<int>& indexes) {}
+
+    /**
+     * Inject CKKS-like noise: every operation adds a Gaussian error of standard deviation 2^-bits
+     * to each slot, bootstrapping adds one of 2^-min(bits, 20)
+     *
+     * @param bits The precision bits of a single operation (0 disables the noise)
+     * @param seed The seed of the noise generator
+     */
+    void set_noise(double bits, unsigned int seed = 0);
+
+    DryRunStatistics statistics() const;
+
+    /**
+      * Basic operations
+      */
+    Ptxt encode(const vector<double>& vec, int level, int num_slots);
+    Ptxt encode(double value, int level, int num_slots);
+    Ctxt encrypt(const vector<double>& vec, int level = 0, int plaintext_num_slots = 0);
+    Ctxt encrypt_expanded(const vector<double>& vec, int level = 0, int plaintext_num_slots = 0, int repetitions = 1);
+    Ctxt encrypt_repeated(const vector<double>& vec, int level = 0, int plaintext_num_slots = 0, int repetitions = 1);
+    vector<double> decode(const Ptxt& p);
+    Ptxt decrypt(const Ctxt& c);
+
+    Ctxt add(const Ctxt& c1, const Ctxt& c2);
+    Ctxt add(const Ctxt& c, const Ptxt& p);
+    Ctxt add(const Ctxt& c, double d);
+    Ctxt add_tree(vector<Ctxt> v);
+
+    Ctxt sub(const Ctxt& c1, const Ctxt& c2);
+    Ctxt sub(const Ctxt& c, const Ptxt& p);
+    Ctxt sub(double a, const Ctxt& c2);
+
+    Ctxt mult(const Ctxt& c, const Ptxt& p);
+    Ctxt mult(const Ctxt& c, double d);
+    Ctxt mult(const Ctxt& c1, const Ctxt& c2);
+
+    Ctxt rot(const Ctxt& c, int index);
+    Ctxt bootstrap(const Ctxt& c);
+
+    // Moves the ciphertext to the last level, keeping its first `slots` slots
+    Ctxt compress(const Ctxt& c, int slots, int precision_bits);
+
+    /**
+      * Permutation-based operations
+      */
+    Ctxt sigmoid(const Ctxt& in, int n, int degree, int scaling);
+    Ctxt rotsum(const Ctxt& in, int n);
+    Ctxt sinc(const Ctxt& in, int degree, double n);
+    Ctxt double_sinc(const Ctxt& in, int degree, double n);
+    Ctxt clean_binary(const Ctxt& in, double scale);
+    Ctxt clean_sign(const Ctxt& in);
+    Ctxt clean_sigmoid(const Ctxt& in, double n, int iterations = 1);
+    Ctxt clean_sigmoid_and_scale(const Ctxt& in, double n);
+
+    /**
+      * Network-based operations
+      */
+    Ctxt relu(const Ctxt& in, int degree, int n);
+    Ctxt composite_sign(const Ctxt& in, const CompositeSign& sign);
+
+    // Exact comparison, with differences scaled and reduced as FHEW reads them, the result at level SCHEME_SWITCH_LEVELS
+    Ctxt compare_switch(const Ctxt& c1, const Ctxt& c2);
+
+    /**
+      * Utilities
+      */
+    void print(const Ctxt& c, int slots = 0, string prefix = "");
+
+    // Binary dump of the slots and the level, the counterpart of FHEController::save/load
+    void save(const Ctxt& c, const string& filename);
+    Ctxt load(const string& filename);
+
+    // The level budget, the counterpart of FHEController::save_keys/load_keys
+    void save_keys(const string& directory);
+    int load_keys(const string& directory);
+
+private:
+    struct State {
+        int num_slots = 0;
+        int depth = 0;
+        int bootstrap_level = 0;
+
+        double noise = 0;
+        double bootstrap_noise = 0;
+        mt19937 generator;
+
+        int max_level = 0;
+        bool depth_exceeded = false;
+        long out_of_range = 0;
+
+        // Chebyshev coefficients, indexed by function and degree
+        map<string, vector<double>> coefficients;
+
+        mutex lock;
+    };
+
+    shared_ptr<State> state;
+
+    // Wraps the result of an operation: adds the noise and checks the level budget
+    Ctxt make(vector<double> values, int level, bool bootstrapped = false);
+
+    Ctxt chebyshev(const Ctxt& in, const string& key, const function<double(double)>& func, int degree,
+                   double a = -1, double b = 1);
+
+    // As FHEController::even_chebyshev: g(x^2) with g(y) = f(sqrt(y)) over [0, 1] and half the degree
+    Ctxt even_chebyshev(const Ctxt& in, const string& key, const function<double(double)>& f, int degree);
+    Ctxt polynomial(const Ctxt& in, const vector<double>& power_coefficients, int levels);
+    void count_out_of_range(const vector<double>& values);
+};
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_PLAINCONTROLLER_H
@@ -0,0 +1,323 @@
+#include "SortingParameters.h"
+
+// Levels of the combination of the comparison matrices of a lexicographic sort
+static int lexicographic_levels(double d, int keys) {
+    if (keys < 2) return 0;
+
+    // The equality matrix of a key: its cleanings, eq (1 - eq) and the final clean
+    int cleanings = d == 0.01 ? 1 : d == 0.001 ? 2 : d == 0.0001 ? 7 : 0;
+    int equality = 2 * cleanings + 3;
+
+    // Then one product for every key past the first
+    return equality + keys - 1;
+}
+
+PermutationParameters permutation_parameters(int n, double d, bool tieoffset, bool scheme_switching, int keys,
+                                             bool half_packing) {
+    PermutationParameters p;
+    int partial_depth = 0;
+
+    if (scheme_switching) {
+        // The comparisons come back from FHEW exact, whatever δ: no sigmoid and no cleaning, only the 1/n scaling
+        p.precision_digits = max(1, (int) ceil(-log10(d)));
+        partial_depth = SCHEME_SWITCH_LEVELS + 1;
+
+    } else if (d == 0.1) {
+        p.precision_digits = 1;
+        p.sigmoid_scaling = 650;
+        p.degree_sigmoid = 1006;
+        partial_depth = 10;
+
+    } else if (d == 0.01) {
+        p.precision_digits = 2;
+        p.sigmoid_scaling = 360;
+        p.degree_sigmoid = 495;
+        partial_depth = 9;
+        partial_depth += 4; // Metto due clean
+
+    } else if (d == 0.001) {
+        p.precision_digits = 3;
+        p.sigmoid_scaling = 2400;
+        p.degree_sigmoid = 2031;
+        partial_depth = 11;
+        partial_depth += 6; // Metto tre clean
+
+    } else if (d == 0.0001) {
+        p.precision_digits = 4;
+        p.sigmoid_scaling = 3500;
+        p.degree_sigmoid = 4030;
+        partial_depth = 12;
+        partial_depth += 14; // Metto sette clean
+
+
+    } else {
+        cerr << "The required min distance '" << d << "' is too small!" << endl;
+    }
+
+    if (tieoffset) partial_depth += 2; //Tieoffset derivative
+
+    partial_depth += lexicographic_levels(d, keys);
+
+    // The masks that gather the complements of the diagonals, then the one of the first row of ranks
+    if (half_packing) partial_depth += 2;
+
+    if (n <= 8) {
+        p.degree_sinc = 59;
+        partial_depth += 6;
+
+
+        if (d == 0.0001) {
+            p.degree_sinc = 247;
+            partial_depth += 2;
+        }
+    } else if (n == 16) {
+        p.degree_sinc = 119;
+        partial_depth += 7;
+
+        if (d == 0.0001) {
+            p.degree_sinc = 495;
+            partial_depth += 3;
+        }
+    } else if (n == 32) {
+        p.degree_sinc = 247;
+        partial_depth += 8;
+
+        partial_depth += 2; //One clean
+
+        if (d == 0.0001) {
+            p.degree_sinc = 495;
+            partial_depth += 2;
+        }
+    } else if (n == 64) {
+        p.degree_sinc = 495;
+        partial_depth += 9;
+
+        partial_depth += 2; //One clean
+
+    } else if (n == 128) {
+        p.degree_sinc = 495;
+        partial_depth += 9;
+
+        partial_depth += 4; //Two clean
+
+        if (d == 0.0001) {
+            partial_depth += 2; //One clean
+        }
+    }
+
+    p.circuit_depth = partial_depth + 1; //For the last matrix mult
+
+    return p;
+}
+
+CountingParameters counting_parameters(int n, double d) {
+    CountingParameters p;
+    p.precision_digits = max(1, (int) ceil(-log10(d)));
+    p.buckets = grid_points(d);
+
+    if (p.buckets > MAX_COUNTING_BUCKETS) {
+        cerr << "The grid of step '" << d << "' has too many buckets for the counting-based sorting!" << endl;
+    }
+
+    // The indicators of the buckets of every value, then an empty half for the prefix sums to wrap into
+    int padded = 1 << (int) ceil(log2(p.buckets));
+    p.slots = 2 * n * padded;
+
+    // The sinc tells the points of the grid apart as the one of the permutation-based sorting tells the ranks
+    if (padded <= 8) {
+        p.degree_sinc = 59;
+    } else if (padded == 16) {
+        p.degree_sinc = 119;
+    } else if (padded == 32) {
+        p.degree_sinc = 247;
+        p.cleanings = 1;
+    } else {
+        p.degree_sinc = 495;
+        p.cleanings = padded >= 128 ? 2 : 1;
+    }
+
+    // The offsets between the start of a bucket and a position are (k + 1/2) / n: a quarter of 1/n
+    // of margin for the errors of the counts, and the signs within δ / 4 of ±1
+    p.sign = composite_sign_parameters(1.0 / (4 * n), ceil(log2(4 * n)) + ceil(-log2(d)) + 3);
+
+    // The sinc and its cleanings, the mask of the bucket starts, the sign and the weights of the buckets
+    p.circuit_depth = poly_evaluation_cost(p.degree_sinc) + 2 * p.cleanings + 1 + p.sign.levels() + 1;
+
+    return p;
+}
+
+NetworkParameters network_parameters(int n, double d, NetworkComparator comparator, int keys) {
+    NetworkParameters p;
+
+    if (d >= 0.1) {
+        p.precision_digits = 1;
+        p.relu_degree = 119;
+    } else if (d >= 0.01) {
+        p.precision_digits = 2;
+        p.relu_degree = 351;
+
+        if (n > 1024) {
+            p.relu_degree = 495;
+        }
+
+    } else if (d >= 0.001) {
+        p.precision_digits = 3;
+        p.relu_degree = 495;
+    } else if (comparator == SWITCH_COMPARATOR) {
+        // No approximation to tune, the FHEW comparison resolves much smaller differences
+        p.precision_digits = max(1, (int) ceil(-log10(d)));
+    } else {
+        cerr << "The required min distance '" << d << "' is too small!" << endl;
+    }
+
+    p.input_scale = 0.95;
+
+    p.comparator = comparator;
+    p.keys = keys;
+    if (comparator == SIGN_COMPARATOR) {
+        // Four bits of margin below δ, the differences being scaled as the inputs. With several keys
+        // the signs select between the keys, so they must be close to ±1 rather than only scaled by the difference
+        int precision = keys > 1 ? 2 * ceil(-log2(d)) + 4 : ceil(-log2(d)) + 4;
+        p.sign = composite_sign_parameters(d * p.input_scale, precision);
+    }
+
+    return p;
+}
+
+CompositeSign composite_sign_parameters(double min_difference, int precision_bits) {
+    const int max_iterations = 12;
+    const int samples = 256;
+
+    // Log-spaced points of [min_difference, 1], both ends included
+    vector<double> points(samples + 1);
+    for (int i = 0; i <= samples; i++) points[i] = min_difference * pow(1 / min_difference, (double) i / samples);
+
+    CompositeSign best;
+    bool found = false;
+
+    for (int g_degree : {3, 5, 7}) {
+        for (int f_degree : {3, 5, 7}) {
+            vector<double> after_g(points);
+
+            for (int g_iterations = 0; g_iterations <= max_iterations; g_iterations++) {
+                if (g_iterations > 0) {
+                    for (double& y : after_g) y = evaluate_power_series(sign_g_polynomial(g_degree), y);
+                }
+
+                vector<double> y(after_g);
+
+                for (int f_iterations = 0; f_iterations <= max_iterations; f_iterations++) {
+                    if (f_iterations > 0) {
+                        for (double& v : y) v = evaluate_power_series(sign_f_polynomial(f_degree), v);
+                    }
+
+                    double error = 0, magnitude = 0;
+                    for (int i = 0; i <= samples; i++) {
+                        error = max(error, points[i] * abs(1 - y[i]) / 2);
+                        magnitude = max(magnitude, abs(y[i]));
+                    }
+
+                    if (error > pow(2, -precision_bits) || magnitude > 1.1) continue;
+
+                    CompositeSign candidate{g_degree, g_iterations, f_degree, f_iterations};
+
+                    if (!found || candidate.levels() < best.levels() ||
+                        (candidate.levels() == best.levels() && candidate.products() < best.products())) {
+                        best = candidate;
+                        found = true;
+                    }
+
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!found) cerr << "No composite sign reaches " << precision_bits << " bits for differences of " << min_difference << endl;
+
+    return best;
+}
+
+int network_layer_levels(int relu_degree) {
+    // Levels required by max(0, x) approximation
+    int levels_consumption = poly_evaluation_cost(relu_degree);
+
+    // One more level for the masking operation
+    levels_consumption += 1;
+
+    return levels_consumption;
+}
+
+int network_layer_levels(const NetworkParameters& parameters) {
+    if (parameters.comparator == RELU_COMPARATOR) {
+        int degree = parameters.relu_degree;
+        for (int layer_degree : parameters.relu_schedule) degree = max(degree, layer_degree);
+
+        return network_layer_levels(degree);
+    }
+
+    // The product by the comparison, which comes back from FHEW with its own levels, and the masking operation
+    if (parameters.comparator == SWITCH_COMPARATOR) return 2;
+
+    // The composite sign, its product by a - b and the masking operation. A lexicographic sort
+    // squares the signs and chains one product for every further key to build the selector
+    int selector_levels = parameters.keys > 1 ? parameters.keys : 0;
+
+    return parameters.sign.levels() + selector_levels + 2;
+}
+
+PermutationConfig permutation_config(int n, double d, bool tieoffset, bool toy, bool verbose, bool scheme_switching,
+                                     int keys, bool half_packing) {
+    PermutationConfig config;
+    config.n = n;
+    config.delta = d;
+    config.tieoffset = tieoffset;
+    config.toy = toy;
+    config.verbose = verbose;
+    config.scheme_switching = scheme_switching;
+    config.parameters = permutation_parameters(n, d, tieoffset, scheme_switching, keys, half_packing);
+
+    return config;
+}
+
+CountingConfig counting_config(int n, double d, bool toy, bool verbose) {
+    CountingConfig config;
+    config.n = n;
+    config.delta = d;
+    config.toy = toy;
+    config.verbose = verbose;
+    config.parameters = counting_parameters(n, d);
+
+    return config;
+}
+
+NetworkConfig network_config(int n, double d, bool toy, bool verbose, NetworkComparator comparator, int keys) {
+    NetworkConfig config;
+    config.n = n;
+    config.delta = d;
+    config.toy = toy;
+    config.verbose = verbose;
+    config.parameters = network_parameters(n, d, comparator, keys);
+
+    return config;
+}
+
+int network_truncation(int n, int max_displacement) {
+    int stages = 0;
+
+    // The last round keeps at least its first stage, the one that splits the halves
+    while (stages + 1 < log2(n) && (1 << (stages + 1)) - 1 <= max_displacement) stages++;
+
+    return stages;
+}
+
+ExternalConfig external_config(const string& directory, int run_size, double d, bool toy, bool verbose,
+                               NetworkComparator comparator) {
+    ExternalConfig config;
+    config.directory = directory;
+    config.run_size = run_size;
+    config.verbose = verbose;
+    config.network = network_config(run_size, d, toy, verbose, comparator);
+
+    return config;
+}
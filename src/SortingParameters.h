@@ -0,0 +1,204 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_SORTINGPARAMETERS_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_SORTINGPARAMETERS_H
+
+#include "Utils.h"
+#include "Approximations.h"
+
+/*
+ * Parameters of the permutation-based approach for a given (n, δ)
+ */
+struct PermutationParameters {
+    int precision_digits = 0;
+    int sigmoid_scaling = 0;
+    int degree_sigmoid = 0;
+    int degree_sinc = 0;
+    int circuit_depth = 0;
+};
+
+/*
+ * Parameters of the network-based approach for a given (n, δ)
+ */
+struct NetworkParameters {
+    int precision_digits = 0;
+    int relu_degree = 0;
+    vector<int> relu_schedule;      // Degree of each layer of the plan, if not empty; the layers past its end use relu_degree
+    double input_scale = 1.0;
+
+    NetworkComparator comparator = RELU_COMPARATOR;
+    CompositeSign sign;             // Only used by SIGN_COMPARATOR
+    int keys = 1;                   // Keys of a lexicographic sort, whose selectors are combined in each swap
+};
+
+/*
+ * Parameters of the counting-based approach for a given (n, δ)
+ */
+struct CountingParameters {
+    int precision_digits = 0;
+    int buckets = 0;                // Points of the grid of step δ in [0, 1)
+    int slots = 0;                  // n slots per bucket, the buckets rounded up to a power of two, twice
+    int degree_sinc = 0;
+    int cleanings = 0;              // Of the bucket indicators
+    CompositeSign sign;             // Whether the values of a bucket start before a position
+    int circuit_depth = 0;
+};
+
+// The largest grid of the counting-based sorting, the one of δ = 0.01 rounded up
+static const int MAX_COUNTING_BUCKETS = 128;
+
+// The slots of a ring of dimension 2^16, the largest one of the contexts
+static const int MAX_COUNTING_SLOTS = 1 << 15;
+
+/**
+ * Choose the parameters of the counting-based sorting. Its cost depends on the buckets, not on
+ * the distance between the values: it needs no bootstrapping and n 1/δ slots instead of n^2, but
+ * the values must lie on the grid of step δ
+ *
+ * @param n The number of values to be sorted
+ * @param d The step of the grid, whose grid_points() are the buckets, at most MAX_COUNTING_BUCKETS
+ * @return The parameters of the counting-based sorting
+ */
+CountingParameters counting_parameters(int n, double d);
+
+/**
+ * Choose the sigmoid/sinc degrees, the sigmoid scaling and the circuit depth
+ * required by the permutation-based sorting
+ *
+ * @param n The number of values to be sorted
+ * @param d The minimum distance δ between the values
+ * @param tieoffset Whether the tie-offset correction will be evaluated
+ * @param scheme_switching Whether the comparisons are evaluated in FHEW instead of by the sigmoid
+ * @param keys The keys of a lexicographic sort, whose comparison matrices are combined before the indexing
+ * @param half_packing Whether the keys come in half-diagonal packing, whose indexing takes two more levels
+ * @return The parameters of the permutation-based sorting
+ */
+PermutationParameters permutation_parameters(int n, double d, bool tieoffset, bool scheme_switching = false,
+                                             int keys = 1, bool half_packing = false);
+
+/**
+ * Choose the ReLU degree (or the composite sign) and the input scaling required by the
+ * network-based sorting
+ *
+ * @param n The number of values to be sorted
+ * @param d The minimum distance δ between the values
+ * @param comparator How min(a, b) is computed in a swap
+ * @param keys The keys of a lexicographic sort (SIGN_COMPARATOR only)
+ * @return The parameters of the network-based sorting
+ */
+NetworkParameters network_parameters(int n, double d, NetworkComparator comparator = RELU_COMPARATOR, int keys = 1);
+
+/**
+ * Choose the composite sign approximation with the fewest levels (then the fewest products
+ * between ciphertexts) such that x (1 - sign(x)) / 2, the error it induces on min(a, b), stays
+ * below 2^-precision_bits for every min_difference <= x <= 1
+ *
+ * @param min_difference The smallest |a - b| to be compared
+ * @param precision_bits The required precision
+ */
+CompositeSign composite_sign_parameters(double min_difference, int precision_bits);
+
+/**
+ * Number of levels consumed by a single layer of the network-based sorting
+ *
+ * @param relu_degree The degree of the ReLU Chebyshev polynomial
+ * @return The levels required by the max(0, x) approximation plus the masking
+ */
+int network_layer_levels(int relu_degree);
+
+/**
+ * Number of levels consumed by a single layer of the network-based sorting with the given comparator
+ * (the deepest layer, with a ReLU degree schedule)
+ */
+int network_layer_levels(const NetworkParameters& parameters);
+
+/*
+ * Configuration of a PermutationSorting: the input shape and the approximation parameters
+ */
+struct PermutationConfig {
+    int n = 0;
+    double delta = 0;
+    bool tieoffset = false;
+    bool toy = false;
+    bool verbose = false;
+    bool clean_permutation_matrix = false;
+    bool scheme_switching = false;  // Exact comparisons in FHEW (no tie-offset: ties have no transition band)
+    PermutationParameters parameters;
+};
+
+/*
+ * Configuration of a NetworkSorting
+ */
+struct NetworkConfig {
+    int n = 0;                      // Values of each list
+    int lanes = 1;                  // Independent lists packed side by side in one ciphertext
+    double delta = 0;
+    bool toy = false;
+    bool verbose = false;
+    NetworkParameters parameters;
+
+    int truncated_stages = 0;       // Approximate sort: the last stages dropped from the last round, see network_truncation()
+
+    string checkpoint_directory;    // Where sort() writes a checkpoint after the bootstrappings, if not empty
+    int checkpoint_interval = 1;    // Layers between two checkpoints
+};
+
+/*
+ * Configuration of a CountingSorting
+ */
+struct CountingConfig {
+    int n = 0;
+    double delta = 0;               // The step of the grid of the values
+    bool toy = false;
+    bool verbose = false;
+    CountingParameters parameters;
+};
+
+/*
+ * Configuration of an ExternalSorting: runs of run_size values are sorted by the network-based
+ * sorting, kept on disk and merged pairwise
+ */
+struct ExternalConfig {
+    string directory;               // Where the runs are written
+    int run_size = 0;               // Values of each run, a power of two
+    int max_resident = 6;           // Run ciphertexts held in memory at once, including prefetched and pending writes
+    bool verbose = false;
+    NetworkConfig network;          // The sorter of a single run (network.n = run_size)
+};
+
+/**
+ * The configuration of a permutation-based sort, with the parameters chosen by permutation_parameters()
+ */
+PermutationConfig permutation_config(int n, double d, bool tieoffset, bool toy = false, bool verbose = false,
+                                     bool scheme_switching = false, int keys = 1, bool half_packing = false);
+
+/**
+ * The configuration of a counting-based sort, with the parameters chosen by counting_parameters()
+ */
+CountingConfig counting_config(int n, double d, bool toy = false, bool verbose = false);
+
+/**
+ * The configuration of a network-based sort, with the parameters chosen by network_parameters()
+ */
+NetworkConfig network_config(int n, double d, bool toy = false, bool verbose = false,
+                             NetworkComparator comparator = RELU_COMPARATOR, int keys = 1);
+
+/**
+ * The approximate network-based sort that skips the most layers while leaving every value within
+ * max_displacement positions of its rank. Only the last round is truncated: it merges a bitonic
+ * sequence, and after its first log2(n) - s stages every block of 2^s slots holds the values whose
+ * ranks fall in it. Dropping its last s stages (the comparisons closer than 2^s slots) leaves each
+ * value within 2^s - 1 positions of its rank. The earlier rounds are not truncated, as an unsorted
+ * block would break the bitonic input of the rounds that follow
+ *
+ * @param n The number of values of each list
+ * @param max_displacement The displacement budget, 0 for the exact sort
+ * @return The stages s, in NetworkConfig::truncated_stages
+ */
+int network_truncation(int n, int max_displacement);
+
+/**
+ * The configuration of an external sort, whose runs are sorted by network_config(run_size, d, toy, verbose, comparator)
+ */
+ExternalConfig external_config(const string& directory, int run_size, double d, bool toy = false, bool verbose = false,
+                               NetworkComparator comparator = RELU_COMPARATOR);
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_SORTINGPARAMETERS_H
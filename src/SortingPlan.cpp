@@ -0,0 +1,79 @@
+#include "SortingPlan.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+template <int N>
+static const NetworkSchedule& compiled_plan() {
+    using Plan = NetworkPlan<N>;
+
+    static const NetworkSchedule schedule{N, Plan::layer_count, Plan::rotation_count,
+                                          Plan::layers.data(), Plan::rotations.data(), Plan::masks.data()};
+
+    return schedule;
+}
+
+// The tables of a plan too large to be compiled in
+struct BuiltPlan {
+    vector<NetworkLayer> layers;
+    vector<int> rotations;
+    vector<uint8_t> masks;
+    NetworkSchedule schedule;
+};
+
+static const NetworkSchedule& built_plan(int slots) {
+    static mutex lock;
+    static map<int, unique_ptr<BuiltPlan>> plans;
+
+    lock_guard<mutex> guard(lock);
+
+    unique_ptr<BuiltPlan>& plan = plans[slots];
+    if (plan) return plan->schedule;
+
+    plan = make_unique<BuiltPlan>();
+    int log_slots = plan_log2(slots);
+
+    for (int i = 0; i < log_slots; i++) {
+        plan->rotations.push_back(1 << i);
+        plan->rotations.push_back(-(1 << i));
+
+        for (int j = 0; j < i + 1; j++) plan->layers.push_back({1 << (i - j), i - j, j});
+    }
+
+    plan->masks.resize(plan->layers.size() * slots);
+    for (size_t l = 0; l < plan->layers.size(); l++) {
+        for (int slot = 0; slot < slots; slot++) {
+            plan->masks[l * slots + slot] = layer_mask_index(slot, plan->layers[l].round, plan->layers[l].stage);
+        }
+    }
+
+    plan->schedule = {slots, (int) plan->layers.size(), (int) plan->rotations.size(),
+                      plan->layers.data(), plan->rotations.data(), plan->masks.data()};
+
+    return plan->schedule;
+}
+
+const NetworkSchedule& network_plan(int slots) {
+    switch (slots) {
+        case 2: return compiled_plan<2>();
+        case 4: return compiled_plan<4>();
+        case 8: return compiled_plan<8>();
+        case 16: return compiled_plan<16>();
+        case 32: return compiled_plan<32>();
+        case 64: return compiled_plan<64>();
+        case 128: return compiled_plan<128>();
+        case 256: return compiled_plan<256>();
+        case 512: return compiled_plan<512>();
+        case 1024: return compiled_plan<1024>();
+        default: break;
+    }
+
+    if (slots < 2 || (slots & (slots - 1)) != 0) {
+        throw invalid_argument("The slots of a sorting network must be a power of two, not " + to_string(slots));
+    }
+
+    return built_plan(slots);
+}
@@ -0,0 +1,124 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_SORTINGPLAN_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_SORTINGPLAN_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+/*
+ * A layer of the bitonic network, in the terms of NetworkSorting::swap
+ */
+struct NetworkLayer {
+    int arrowsdelta;        // Distance between the compared slots
+    int round;              // log2(arrowsdelta)
+    int stage;              // Position of the layer in its round of the network
+};
+
+constexpr int plan_log2(int n) {
+    return n <= 1 ? 0 : 1 + plan_log2(n / 2);
+}
+
+/**
+ * Which of the four masks of a swap selects a slot: 0 and 1 for the blocks keeping the min and
+ * the max of ascending pairs, 2 and 3 for the descending ones
+ */
+constexpr uint8_t layer_mask_index(int slot, int round, int stage) {
+    return 2 * ((slot >> (stage + round + 1)) & 1) + ((slot >> round) & 1);
+}
+
+/*
+ * Everything the bitonic network over N slots needs that only depends on N, computed at compile
+ * time: the layer schedule, the rotation indexes and the mask pattern of every layer. The rounds
+ * come in order, so the first k (k + 1) / 2 layers are the network that sorts blocks of 2^k slots
+ */
+template <int N>
+struct NetworkPlan {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "The slots of a sorting network must be a power of two");
+
+    static constexpr int log_slots = plan_log2(N);
+    static constexpr int layer_count = log_slots * (log_slots + 1) / 2;
+    static constexpr int rotation_count = 2 * log_slots;
+
+    static constexpr array<NetworkLayer, layer_count> make_layers() {
+        array<NetworkLayer, layer_count> layers{};
+        int l = 0;
+
+        for (int i = 0; i < log_slots; i++) {
+            for (int j = 0; j < i + 1; j++) {
+                layers[l++] = {1 << (i - j), i - j, j};
+            }
+        }
+
+        return layers;
+    }
+
+    static constexpr array<int, rotation_count> make_rotations() {
+        array<int, rotation_count> rotations{};
+
+        for (int i = 0; i < log_slots; i++) {
+            rotations[2 * i] = 1 << i;
+            rotations[2 * i + 1] = -(1 << i);
+        }
+
+        return rotations;
+    }
+
+    static constexpr array<uint8_t, layer_count * N> make_masks() {
+        array<uint8_t, layer_count * N> masks{};
+        array<NetworkLayer, layer_count> layers = make_layers();
+
+        for (int l = 0; l < layer_count; l++) {
+            for (int slot = 0; slot < N; slot++) {
+                masks[l * N + slot] = layer_mask_index(slot, layers[l].round, layers[l].stage);
+            }
+        }
+
+        return masks;
+    }
+
+    static constexpr array<NetworkLayer, layer_count> layers = make_layers();
+    static constexpr array<int, rotation_count> rotations = make_rotations();
+    static constexpr array<uint8_t, layer_count * N> masks = make_masks();
+};
+
+/*
+ * A plan as seen at run time, pointing to the compile-time tables of a NetworkPlan (or to tables
+ * built once for the sizes without one)
+ */
+struct NetworkSchedule {
+    int slots = 0;
+    int layer_count = 0;
+    int rotation_count = 0;
+
+    const NetworkLayer* layers = nullptr;
+    const int* rotations = nullptr;
+    const uint8_t* masks = nullptr;         // layer_count rows of `slots` mask indexes
+
+    // Layers of the network that sorts blocks of `n` slots, the first ones of the schedule
+    int sorting_layers(int n) const { return plan_log2(n) * (plan_log2(n) + 1) / 2; }
+
+    // Mask pattern of the layer at `index`
+    const uint8_t* layer_masks(int index) const { return masks + (size_t) index * slots; }
+
+    // Index of the layer with the given round and stage
+    int layer_index(int round, int stage) const {
+        int i = round + stage;
+        return i * (i + 1) / 2 + stage;
+    }
+
+    vector<int> rotation_indexes() const { return vector<int>(rotations, rotations + rotation_count); }
+};
+
+static const int MAX_COMPILED_PLAN_SLOTS = 1024;
+
+/**
+ * The plan of the bitonic network over a power-of-two number of slots. The sizes up to
+ * MAX_COMPILED_PLAN_SLOTS are tables compiled in the binary, the larger ones are built on first use
+ *
+ * @param slots The slots of the ciphertext, a power of two
+ */
+const NetworkSchedule& network_plan(int slots);
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_SORTINGPLAN_H
@@ -0,0 +1,121 @@
+#include "Threading.h"
+
+#include <algorithm>
+
+static ThreadingStrategy current_strategy;
+
+// How many ThreadingTask objects are alive on the calling thread
+static thread_local int task_depth = 0;
+
+// Cores this process may run on, in the order they are assigned to threads
+static vector<int> allowed_cpus() {
+    vector<int> cpus;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+#endif
+
+    if (cpus.empty()) {
+        for (int cpu = 0; cpu < omp_get_num_procs(); cpu++) cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+// Affinity masks are inherited, so the cores allowed at startup are remembered before any pinning
+static const vector<int>& process_cpus() {
+    static const vector<int> cpus = allowed_cpus();
+    return cpus;
+}
+
+#ifdef __linux__
+static void pin_current_thread(int first, int count) {
+    const vector<int>& cpus = process_cpus();
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = first; i < first + count; i++) CPU_SET(cpus[i % cpus.size()], &set);
+
+    sched_setaffinity(0, sizeof(set), &set);
+}
+#endif
+
+int available_cores() {
+    return process_cpus().size();
+}
+
+void configure_threading(ThreadingStrategy strategy) {
+    if (strategy.total_threads <= 0) strategy.total_threads = available_cores();
+    strategy.task_threads = clamp(strategy.task_threads, 1, strategy.total_threads);
+
+    current_strategy = strategy;
+
+    // Nested regions must not be serialized, otherwise every task would run OpenFHE single-threaded
+    omp_set_dynamic(0);
+    omp_set_max_active_levels(strategy.task_threads > 1 ? 2 : 1);
+
+    // Operations issued outside of task-level regions use the whole budget
+    omp_set_num_threads(strategy.total_threads);
+
+#ifdef __linux__
+    // One core per thread of the top-level team (the pool is reused by the following regions)
+#pragma omp parallel num_threads(strategy.total_threads)
+    {
+        if (strategy.pin) pin_current_thread(omp_get_thread_num(), 1);
+        else pin_current_thread(0, available_cores());
+    }
+
+    if (strategy.pin) pin_current_thread(0, 1);
+    else pin_current_thread(0, available_cores());
+#endif
+}
+
+const ThreadingStrategy& threading() {
+    if (current_strategy.total_threads == 0) current_strategy.total_threads = omp_get_max_threads();
+
+    return current_strategy;
+}
+
+int task_threads() {
+    return task_depth > 0 ? 1 : threading().task_threads;
+}
+
+void print_threading(ostream& out) {
+    const ThreadingStrategy& s = threading();
+
+    out << "Threads: " << s.total_threads << " (" << s.task_threads << " task × " << s.limb_threads() << " limb)"
+        << (s.pin ? ", pinned" : "") << ", cores available: " << available_cores() << endl;
+}
+
+ThreadingTask::ThreadingTask(int index) : nested(task_depth > 0), previous_threads(omp_get_max_threads()) {
+    task_depth++;
+    if (nested) return;
+
+    const ThreadingStrategy& s = threading();
+    omp_set_num_threads(s.limb_threads());
+
+#ifdef __linux__
+    if (s.pin && sched_getaffinity(0, sizeof(previous_mask), &previous_mask) == 0) {
+        restore_mask = true;
+        pin_current_thread(index * s.limb_threads(), s.limb_threads());
+    }
+#endif
+}
+
+ThreadingTask::~ThreadingTask() {
+    task_depth--;
+    if (nested) return;
+
+    omp_set_num_threads(previous_threads);
+
+#ifdef __linux__
+    if (restore_mask) sched_setaffinity(0, sizeof(previous_mask), &previous_mask);
+#endif
+}
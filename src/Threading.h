@@ -0,0 +1,81 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_THREADING_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_THREADING_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using namespace std;
+
+/*
+ * How the thread budget is split between the two levels of parallelism of a sort:
+ * task-level threads run independent ciphertext operations (the sections of the
+ * permutation-based sorting, the rotations and mask products of a swap), limb-level
+ * threads are the ones OpenFHE uses inside every operation to process the RNS limbs.
+ *
+ * With task_threads = 1 every operation gets the whole budget; with task_threads = k
+ * each of the k concurrent operations gets total_threads / k limb threads, instead of
+ * the single thread OpenMP would give to a nested region by default.
+ */
+struct ThreadingStrategy {
+    int total_threads = 0;      // 0 for every available core
+    int task_threads = 1;
+    bool pin = false;           // Pin every thread to its own core (Linux only)
+
+    int limb_threads() const { return max(1, total_threads / max(task_threads, 1)); }
+};
+
+/**
+ * Apply a threading strategy to the whole process, it must be called outside of parallel regions
+ *
+ * @param strategy The strategy, whose total_threads = 0 is resolved to the available cores
+ */
+void configure_threading(ThreadingStrategy strategy);
+
+/**
+ * The strategy currently in use
+ */
+const ThreadingStrategy& threading();
+
+/**
+ * Task-level threads the calling thread may use: the strategy's task_threads, or 1 inside a
+ * ThreadingTask, whose share of the cores is already fixed
+ */
+int task_threads();
+
+/**
+ * Number of cores this process may run on
+ */
+int available_cores();
+
+void print_threading(ostream& out = cout);
+
+/*
+ * Marks the calling thread as the `index`-th task of a task-level parallel region for the
+ * lifetime of the object: OpenFHE calls issued by the thread use limb_threads() threads,
+ * pinned to the block of cores of the task when pinning is enabled. Tasks nested in a task
+ * (e.g. a sort running as one of many concurrent jobs) keep the outer assignment
+ */
+class ThreadingTask {
+public:
+    explicit ThreadingTask(int index);
+    ~ThreadingTask();
+
+    ThreadingTask(const ThreadingTask&) = delete;
+    ThreadingTask& operator=(const ThreadingTask&) = delete;
+
+private:
+    bool nested;
+    int previous_threads;
+#ifdef __linux__
+    cpu_set_t previous_mask;
+    bool restore_mask = false;
+#endif
+};
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_THREADING_H
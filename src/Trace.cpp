@@ -0,0 +1,231 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <unistd.h>
+
+// Upper bound on the spans kept by each thread, so that long runs cannot exhaust memory
+static const size_t MAX_SPANS_PER_THREAD = 1 << 22;
+
+struct Tracer::ThreadBuffer {
+    int tid = 0;
+
+    OperationStats kinds[OP_KINDS];
+
+    // Phases seen by this thread: name, inclusive stats (count, total_ns) and self time of its operations
+    vector<pair<const char*, OperationStats>> phases;
+
+    vector<TraceSpan> spans;
+
+    // Time spent in nested operations, one entry per active operation
+    vector<int64_t> nested_ns;
+    vector<const char*> active_phases;
+
+    OperationStats& phase(const char* name) {
+        for (auto& entry : phases) {
+            if (entry.first == name || strcmp(entry.first, name) == 0) return entry.second;
+        }
+        phases.emplace_back(name, OperationStats());
+        return phases.back().second;
+    }
+
+    // Resident set sampled when each active phase began
+    vector<uint64_t> phase_rss;
+};
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() : epoch(chrono::steady_clock::now()) {}
+
+int64_t Tracer::now() const {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+}
+
+Tracer::ThreadBuffer& Tracer::buffer() {
+    thread_local ThreadBuffer* local = nullptr;
+
+    if (local == nullptr) {
+        lock_guard<mutex> lock(buffers_mutex);
+        buffers.push_back(make_unique<ThreadBuffer>());
+        local = buffers.back().get();
+        local->tid = buffers.size();
+    }
+
+    return *local;
+}
+
+uint64_t Tracer::resident_bytes() {
+    // The second field of statm is the resident set, in pages
+    ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+
+    if (!(statm >> size >> resident)) return 0;
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void Tracer::begin_operation() {
+    buffer().nested_ns.push_back(0);
+}
+
+void Tracer::end_operation(OperationKind kind, int64_t start_ns, int level_in, int level_out, uint64_t bytes) {
+    ThreadBuffer& b = buffer();
+    int64_t duration = now() - start_ns;
+
+    int64_t nested = 0;
+    if (!b.nested_ns.empty()) {
+        nested = b.nested_ns.back();
+        b.nested_ns.pop_back();
+    }
+    if (!b.nested_ns.empty()) b.nested_ns.back() += duration;
+
+    OperationStats& s = b.kinds[kind];
+    s.count++;
+    s.total_ns += duration;
+    s.self_ns += duration - nested;
+    s.level_in_sum += level_in;
+    s.level_out_sum += level_out;
+    s.bytes_sum += bytes;
+
+    if (!b.active_phases.empty()) b.phase(b.active_phases.back()).self_ns += duration - nested;
+
+    if (spans() && b.spans.size() < MAX_SPANS_PER_THREAD) {
+        b.spans.push_back({to_string(kind), false, start_ns, duration, level_in, level_out, bytes});
+    }
+}
+
+void Tracer::begin_phase(const char* name) {
+    ThreadBuffer& b = buffer();
+
+    b.active_phases.push_back(name);
+    if (memory()) b.phase_rss.push_back(resident_bytes());
+}
+
+void Tracer::end_phase(const char* name, int64_t start_ns) {
+    ThreadBuffer& b = buffer();
+    int64_t duration = now() - start_ns;
+
+    if (!b.active_phases.empty()) b.active_phases.pop_back();
+
+    OperationStats& s = b.phase(name);
+    s.count++;
+    s.total_ns += duration;
+
+    if (memory() && !b.phase_rss.empty()) {
+        s.peak_rss = max({s.peak_rss, b.phase_rss.back(), resident_bytes()});
+        b.phase_rss.pop_back();
+    }
+
+    if (spans() && b.spans.size() < MAX_SPANS_PER_THREAD) {
+        b.spans.push_back({name, true, start_ns, duration, -1, -1, 0});
+    }
+}
+
+void Tracer::write_chrome_trace(const string& filename) const {
+    lock_guard<mutex> lock(buffers_mutex);
+
+    ofstream out(filename);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    bool first = true;
+
+    for (const auto& b : buffers) {
+        out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+            << ", \"args\": {\"name\": \"thread " << b->tid << "\"}}";
+        first = false;
+
+        for (const TraceSpan& s : b->spans) {
+            out << ",\n{\"name\": \"" << s.name << "\", \"cat\": \"" << (s.phase ? "phase" : "op")
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->tid
+                << ", \"ts\": " << s.start_ns / 1000.0 << ", \"dur\": " << s.duration_ns / 1000.0;
+
+            if (!s.phase) {
+                out << ", \"args\": {\"level_in\": " << s.level_in << ", \"level_out\": " << s.level_out
+                    << ", \"bytes\": " << s.bytes << "}";
+            }
+
+            out << "}";
+        }
+    }
+
+    out << "\n]}\n";
+
+    cout << "Trace written to " << filename << endl;
+}
+
+void Tracer::print_summary(ostream& out) const {
+    lock_guard<mutex> lock(buffers_mutex);
+
+    OperationStats kinds[OP_KINDS];
+    map<string, OperationStats> phases;
+    int64_t self_total = 0;
+
+    for (const auto& b : buffers) {
+        for (int k = 0; k < OP_KINDS; k++) {
+            kinds[k].count += b->kinds[k].count;
+            kinds[k].total_ns += b->kinds[k].total_ns;
+            kinds[k].self_ns += b->kinds[k].self_ns;
+            kinds[k].level_in_sum += b->kinds[k].level_in_sum;
+            kinds[k].level_out_sum += b->kinds[k].level_out_sum;
+            kinds[k].bytes_sum += b->kinds[k].bytes_sum;
+            self_total += b->kinds[k].self_ns;
+        }
+        for (const auto& [name, s] : b->phases) {
+            phases[name].count += s.count;
+            phases[name].total_ns += s.total_ns;
+            phases[name].self_ns += s.self_ns;
+            phases[name].peak_rss = max(phases[name].peak_rss, s.peak_rss);
+        }
+    }
+
+    vector<int> order;
+    for (int k = 0; k < OP_KINDS; k++) if (kinds[k].count > 0) order.push_back(k);
+    sort(order.begin(), order.end(), [&](int a, int b) { return kinds[a].self_ns > kinds[b].self_ns; });
+
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << fixed << setprecision(2);
+
+    out << endl << left << setw(12) << "Operation" << right << setw(10) << "count" << setw(14) << "self (ms)"
+        << setw(9) << "share" << setw(12) << "avg (ms)" << setw(10) << "lvl in" << setw(10) << "lvl out"
+        << setw(11) << "avg MB" << endl;
+
+    for (int k : order) {
+        const OperationStats& s = kinds[k];
+        out << left << setw(12) << to_string(static_cast<OperationKind>(k)) << right
+            << setw(10) << s.count
+            << setw(14) << s.self_ns / 1e6
+            << setw(8) << (self_total > 0 ? 100.0 * s.self_ns / self_total : 0) << "%"
+            << setw(12) << s.total_ns / 1e6 / s.count
+            << setw(10) << (double) s.level_in_sum / s.count
+            << setw(10) << (double) s.level_out_sum / s.count
+            << setw(11) << s.bytes_sum / 1048576.0 / s.count << endl;
+    }
+
+    if (!phases.empty()) {
+        vector<pair<string, OperationStats>> sorted_phases(phases.begin(), phases.end());
+        sort(sorted_phases.begin(), sorted_phases.end(),
+             [](const auto& a, const auto& b) { return a.second.total_ns > b.second.total_ns; });
+
+        out << endl << left << setw(26) << "Phase" << right << setw(10) << "count" << setw(14) << "total (ms)"
+            << setw(16) << "own ops (ms)";
+        if (memory()) out << setw(16) << "peak RSS (MB)";
+        out << endl;
+
+        for (const auto& [name, s] : sorted_phases) {
+            out << left << setw(26) << name << right << setw(10) << s.count << setw(14) << s.total_ns / 1e6
+                << setw(16) << s.self_ns / 1e6;
+            if (memory()) out << setw(16) << s.peak_rss / 1048576.0;
+            out << endl;
+        }
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
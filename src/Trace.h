@@ -0,0 +1,154 @@
+#ifndef PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_TRACE_H
+#define PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * The kinds of operation recorded by the FHEController entry points
+ */
+enum OperationKind {
+    OP_ENCODE, OP_ENCRYPT, OP_DECRYPT, OP_ADD, OP_SUB, OP_MULT, OP_ROT,
+    OP_CHEBYSHEV, OP_POLY, OP_BOOTSTRAP, OP_SWITCH, OP_RESCALE, OP_KINDS
+};
+
+static inline const char* to_string(OperationKind kind) {
+    switch (kind) {
+        case OP_ENCODE: return "encode";
+        case OP_ENCRYPT: return "encrypt";
+        case OP_DECRYPT: return "decrypt";
+        case OP_ADD: return "add";
+        case OP_SUB: return "sub";
+        case OP_MULT: return "mult";
+        case OP_ROT: return "rot";
+        case OP_CHEBYSHEV: return "chebyshev";
+        case OP_POLY: return "poly";
+        case OP_BOOTSTRAP: return "bootstrap";
+        case OP_SWITCH: return "scheme switch";
+        case OP_RESCALE: return "rescale";
+        default: return "unknown";
+    }
+}
+
+/*
+ * Aggregated statistics of an operation kind (or of a phase)
+ */
+struct OperationStats {
+    uint64_t count = 0;
+    int64_t total_ns = 0;       // Inclusive time
+    int64_t self_ns = 0;        // Time not spent in nested operations
+    int64_t level_in_sum = 0;
+    int64_t level_out_sum = 0;
+    uint64_t bytes_sum = 0;
+    uint64_t peak_rss = 0;      // Largest resident set seen at the bounds of a phase, with memory sampling
+};
+
+/*
+ * A timed interval, exported as a Chrome/Perfetto "complete" event
+ */
+struct TraceSpan {
+    const char* name;
+    bool phase;
+    int64_t start_ns;
+    int64_t duration_ns;
+    int level_in;
+    int level_out;
+    uint64_t bytes;
+};
+
+/*
+ * Process-wide recorder of FHE operations and algorithm phases.
+ *
+ * Every thread writes to its own buffer, so recording never takes a lock: the
+ * cost of an operation record is two clock reads and a few additions. Statistics
+ * are always collected while the tracer is enabled, spans only when requested
+ * (they are needed for the trace export and grow with the number of operations).
+ */
+class Tracer {
+public:
+    static Tracer& instance();
+
+    void set_enabled(bool enabled) { stats_enabled = enabled; }
+    void set_spans(bool enabled) { spans_enabled = enabled; }
+    bool enabled() const { return stats_enabled.load(memory_order_relaxed); }
+    bool spans() const { return spans_enabled.load(memory_order_relaxed); }
+
+    // Sample the resident set size when every phase begins and ends, for the memory column of the summary
+    void set_memory(bool enabled) { memory_enabled = enabled; }
+    bool memory() const { return memory_enabled.load(memory_order_relaxed); }
+
+    // Current resident set size of the process, in bytes (0 where it cannot be read)
+    static uint64_t resident_bytes();
+
+    // Nanoseconds since the tracer was created
+    int64_t now() const;
+
+    void begin_operation();
+    void end_operation(OperationKind kind, int64_t start_ns, int level_in, int level_out, uint64_t bytes);
+
+    void begin_phase(const char* name);
+    void end_phase(const char* name, int64_t start_ns);
+
+    /**
+     * Write the recorded spans in the Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+     *
+     * @param filename The output JSON file
+     */
+    void write_chrome_trace(const string& filename) const;
+
+    /**
+     * Print which operation kinds and which phases dominate the recorded run
+     *
+     * @param out The output stream
+     */
+    void print_summary(ostream& out = cout) const;
+
+private:
+    struct ThreadBuffer;
+
+    Tracer();
+    ThreadBuffer& buffer();
+
+    chrono::steady_clock::time_point epoch;
+    atomic<bool> stats_enabled{true};
+    atomic<bool> spans_enabled{false};
+    atomic<bool> memory_enabled{false};
+
+    mutable mutex buffers_mutex;
+    vector<unique_ptr<ThreadBuffer>> buffers;
+};
+
+/*
+ * Marks an algorithm phase (e.g., "comparison", "swap") for the lifetime of the object
+ */
+class TracePhase {
+public:
+    explicit TracePhase(const char* name) : name(name) {
+        Tracer& tracer = Tracer::instance();
+        if (tracer.enabled()) {
+            start_ns = tracer.now();
+            tracer.begin_phase(name);
+        }
+    }
+
+    ~TracePhase() {
+        if (start_ns >= 0) Tracer::instance().end_phase(name, start_ns);
+    }
+
+    TracePhase(const TracePhase&) = delete;
+    TracePhase& operator=(const TracePhase&) = delete;
+
+private:
+    const char* name;
+    int64_t start_ns = -1;
+};
+
+#endif //PRACTICAL_SORTING_OF_ENCRYPTED_NUMBERS_TRACE_H
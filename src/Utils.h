@@ -8,10 +8,14 @@
 #include <iostream>
 #include <algorithm> // for shuffle
 #include <numeric>   // for iota
+#include <iterator>
 
 #include <vector>
 #include <random>
 #include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <chrono>
 
 //#define GREEN_TEXT "\033[1;32m"
 //#define RED_TEXT "\033[1;31m"
@@ -24,9 +28,10 @@
 #define RESET_COLOR ""
 
 using namespace std;
+using namespace std::chrono;
 
 enum SortingType {
-    NONE, PERMUTATION, NETWORK
+    NONE, PERMUTATION, NETWORK, COUNTING
 };
 
 static inline  string to_string(SortingType type) {
@@ -34,10 +39,61 @@ static inline  string to_string(SortingType type) {
         case NONE: return "NONE";
         case PERMUTATION: return "Permutation-based";
         case NETWORK: return "Network-based";
+        case COUNTING: return "Counting-based";
         default: return "UNKNOWN";
     }
 }
 
+/*
+ * How the network-based sorting computes min(a, b) in a swap
+ */
+enum NetworkComparator {
+    RELU_COMPARATOR,    // a - max(0, a - b), with a single high-degree Chebyshev approximation of max(0, x)
+    SIGN_COMPARATOR,    // ((a + b) - (a - b) sign(a - b)) / 2, with a composition of low-degree sign polynomials
+    SWITCH_COMPARATOR   // b + [a < b] (a - b), the comparison being evaluated exactly in FHEW by scheme switching
+};
+
+static inline string to_string(NetworkComparator comparator) {
+    switch (comparator) {
+        case SIGN_COMPARATOR: return "composite sign";
+        case SWITCH_COMPARATOR: return "scheme switching";
+        default: return "ReLU";
+    }
+}
+
+// The comparator named on the command line: relu, sign or switch
+static inline NetworkComparator parse_comparator(const string& name) {
+    if (name == "sign") return SIGN_COMPARATOR;
+    if (name == "switch") return SWITCH_COMPARATOR;
+
+    return RELU_COMPARATOR;
+}
+
+/*
+ * How the scaling factor of the CKKS ciphertexts is managed
+ */
+enum RescalingMode {
+    AUTO_RESCALING,         // FLEXIBLEAUTO: OpenFHE rescales before every product
+    AUTO_EXT_RESCALING,     // FLEXIBLEAUTOEXT: as FLEXIBLEAUTO, with an extra modulus for the fresh ciphertexts
+    MANUAL_RESCALING        // FIXEDMANUAL: the FHEController rescales where the next operation requires it
+};
+
+static inline string to_string(RescalingMode mode) {
+    switch (mode) {
+        case AUTO_EXT_RESCALING: return "FLEXIBLEAUTOEXT";
+        case MANUAL_RESCALING: return "FIXEDMANUAL";
+        default: return "FLEXIBLEAUTO";
+    }
+}
+
+// The rescaling mode named on the command line: auto, autoext or manual
+static inline RescalingMode parse_rescaling(const string& name) {
+    if (name == "autoext") return AUTO_EXT_RESCALING;
+    if (name == "manual") return MANUAL_RESCALING;
+
+    return AUTO_RESCALING;
+}
+
 static inline  vector<double> generate_random_vector(int num_values) {
     //Generates a vector of num_values elements uniformely sampled from (0, 1)
 
@@ -59,6 +115,18 @@ static inline  vector<double> generate_random_vector(int num_values) {
     return vec;
 }
 
+/*
+ * Levels a comparison by scheme switching leaves consumed: its result is a fresh CKKS ciphertext
+ * out of the FHEW-to-CKKS switch, whose modular reduction (a Chebyshev cosine and the double-angle
+ * iterations) takes these levels
+ */
+static const int SCHEME_SWITCH_LEVELS = 13;
+
+/*
+ * Differences in (-1, 1) are scaled by 2^bits and switched to FHEW plaintexts modulo 2^(bits + 1), whose
+ * top bit is the sign: differences under 2^-bits read as ties
+ */
+static const int SCHEME_SWITCH_PRECISION_BITS = 15;
 
 static inline int poly_evaluation_cost(int degree) {
     //Cost for running the Paterson-Stockmeyer algorithm
@@ -82,6 +150,8 @@ static inline int poly_evaluation_cost(int degree) {
         return 10;
     } else if (degree <= 2031+1) {
         return 11;
+    } else if (degree <= 4031+1) {
+        return 12;
     } else {
         cerr << "Use a valid degree!" << endl;
         return 0;
@@ -89,6 +159,17 @@ static inline int poly_evaluation_cost(int degree) {
 
 }
 
+// The bits of a result that tell apart two values δ apart, with one to spare
+static inline int output_precision_bits(double delta) {
+    return (int) ceil(-log2(delta)) + 1;
+}
+
+static inline bool even_evaluation_fits(int degree) {
+    // An even function of degree d is a polynomial of degree d/2 in x^2: worth it when squaring x
+    // costs no more level than the full series (e.g. 119, 351, 495, not 59 or 247)
+    return 1 + poly_evaluation_cost(degree / 2) <= poly_evaluation_cost(degree);
+}
+
 static inline vector<double> parse_input_vector(const std::string& input) {
     std::vector<double> result;
     std::istringstream iss(input);
@@ -130,6 +211,57 @@ static inline double precision_bits(const std::vector<double>& vec1, const std::
     return -log2(infinity_norm(vec1, vec2));
 }
 
+/*
+ * How far a list is from being sorted, up to a tolerance: a value may take any position of the
+ * sorted list holding a value within the tolerance of it, and two values are out of order when the
+ * first exceeds the second by the tolerance or more
+ */
+struct Sortedness {
+    int max_displacement = 0;       // The largest distance of a value from its positions
+    long inversions = 0;            // The pairs of values out of order
+};
+
+static inline Sortedness sortedness(const std::vector<double>& sorted, const std::vector<double>& obtained, double tolerance) {
+    Sortedness result;
+    std::size_t n = obtained.size();
+
+    for (std::size_t i = 0; i < n; i++) {
+        long first = lower_bound(sorted.begin(), sorted.end(), obtained[i] - tolerance) - sorted.begin();
+        long last = upper_bound(sorted.begin(), sorted.end(), obtained[i] + tolerance) - sorted.begin();
+        long position = (long) i;
+
+        // No value within the tolerance: the positions around the one the value would take
+        if (first == last) first = max(0L, first - 1), last = min((long) n, last + 1);
+
+        long displacement = position < first ? first - position : position >= last ? position - last + 1 : 0;
+        result.max_displacement = max(result.max_displacement, (int) displacement);
+    }
+
+    // Bottom-up merge sort, counting for each value of a right run the larger ones of the left run
+    vector<double> values(obtained);
+
+    for (std::size_t width = 1; width < n; width *= 2) {
+        vector<double> merged;
+        merged.reserve(n);
+
+        for (std::size_t start = 0; start < n; start += 2 * width) {
+            std::size_t middle = min(start + width, n), end = min(start + 2 * width, n);
+
+            for (std::size_t a = start, b = middle; b < end; b++) {
+                while (a < middle && values[a] < values[b] + tolerance) a++;
+                result.inversions += middle - a;
+            }
+
+            merge(values.begin() + start, values.begin() + middle, values.begin() + middle, values.begin() + end,
+                  back_inserter(merged));
+        }
+
+        values.swap(merged);
+    }
+
+    return result;
+}
+
 static inline void print_duration(chrono::time_point<steady_clock, nanoseconds> start, const string &title) {
     auto ms = duration_cast<milliseconds>(steady_clock::now() - start);
 
@@ -168,7 +300,31 @@ static inline bool isSameUpToNDecimals(double a, double b, int n) {
     return std::round(a * n) == std::round(b * n);
 }
 
-static inline std::vector<double> generate_close_randoms(int n, double max_distance = 0.01) {
+// The points of the grid of the given step in [0, 1), accumulated as generate_close_randoms does
+static inline int grid_points(double step) {
+    int points = 0;
+
+    for (double x = 0.0; x < 1; x += step) points++;
+
+    return points;
+}
+
+// Whether every value lies in [0, 1) on the grid of the given step, as generate_close_randoms draws them
+static inline bool on_grid(const std::vector<double>& values, double step) {
+    int points = grid_points(step);
+
+    for (double v : values) {
+        double point = round(v / step);
+
+        if (v < 0 || v >= 1 || point >= points || abs(v - point * step) > 1e-9) return false;
+    }
+
+    return true;
+}
+
+static inline std::vector<double> generate_close_randoms(int n, double max_distance = 0.01, int seed = -1) {
+    //A negative seed draws the values from a random device, otherwise the sequence is reproducible
+
     if (n * max_distance > 1) {
         cout << "INFO: the random input vector will contain duplicates." << endl;
     }
@@ -181,11 +337,11 @@ static inline std::vector<double> generate_close_randoms(int n, double max_dista
     }
 
     std::random_device rd; // obtain a random number from hardware
-    std::mt19937 gen(rd()); // seed the generator
+    std::mt19937 gen(seed < 0 ? rd() : static_cast<unsigned int>(seed)); // seed the generator
 
 
     while (values.size() < static_cast<std::size_t>(n)) {
-        std::uniform_int_distribution<> distr(0, values.size()); // define the range
+        std::uniform_int_distribution<> distr(0, values.size() - 1); // define the range
         int random = distr(gen);
         values.push_back(values[random]);
     }
@@ -198,31 +354,4 @@ static inline std::vector<double> generate_close_randoms(int n, double max_dista
 }
 
 
-//Copy pasted from https://github.com/openfheorg/openfhe-development/blob/main/src/core/lib/math/chebyshev.cpp
-/*
-static inline std::vector<double> EvalChebyshevCoefficients(std::function<double(double)> func, double a, double b, uint32_t degree) {
-    if (!degree) {
-        OPENFHE_THROW("The degree of approximation can not be zero");
-    }
-    // the number of coefficients to be generated should be degree+1 as zero is also included
-    size_t coeffTotal{degree + 1};
-    double bMinusA = 0.5 * (b - a);
-    double bPlusA  = 0.5 * (b + a);
-    double PiByDeg = M_PI / static_cast<double>(coeffTotal);
-    std::vector<double> functionPoints(coeffTotal);
-    for (size_t i = 0; i < coeffTotal; ++i)
-        functionPoints[i] = func(std::cos(PiByDeg * (i + 0.5)) * bMinusA + bPlusA);
-
-    double multFactor = 2.0 / static_cast<double>(coeffTotal);
-    std::vector<double> coefficients(coeffTotal);
-    for (size_t i = 0; i < coeffTotal; ++i) {
-        for (size_t j = 0; j < coeffTotal; ++j)
-            coefficients[i] += functionPoints[j] * std::cos(PiByDeg * i * (j + 0.5));
-        coefficients[i] *= multFactor;
-    }
-    return coefficients;
-}
-*/
-
-
 #endif //SORTING_UTILS_H
@@ -0,0 +1,811 @@
+#include <iostream>
+#include <functional>
+#include <thread>
+#include "openfhe.h"
+#include "FHEController.h"
+#include "Utils.h"
+#include "Metrics.h"
+#include "PermutationSorting.h"
+#include "NetworkSorting.h"
+#include "SortingParameters.h"
+#include "CostModel.h"
+#include "Threading.h"
+
+using namespace lbcrypto;
+using namespace std;
+using namespace std::chrono;
+
+// Set by CMake: "hexl" for the build linked to the OpenFHE with Intel HEXL, "native" otherwise
+#ifndef SORTING_BACKEND
+#define SORTING_BACKEND "native"
+#endif
+
+/*
+ * A single measurement, either of a primitive or of a whole sort
+ */
+struct BenchmarkRecord {
+    string suite;
+    string name;
+    string method;
+    int n = 0;
+    double delta = 0;
+    int repetition = 0;
+    Measurement measurement;
+
+    // Only meaningful for end-to-end runs
+    int corrects = -1;
+    double precision_bits = 0;
+    int final_level = -1;
+
+    // Thread budget of the measurement
+    int threads = 0;
+    int task_threads = 1;
+
+    // Sorts running at once on the same context (concurrency suite)
+    int jobs = 1;
+};
+
+void read_arguments(int argc, char *argv[]);
+void benchmark_permutation_primitives(int n, double delta);
+void benchmark_network_primitives(int n, double delta);
+void benchmark_end_to_end(SortingType method, int n, double delta);
+void benchmark_scaling(SortingType method, int n, double delta);
+void benchmark_concurrency(SortingType method, int n, double delta);
+void benchmark_comparison(SortingType method, int n, double delta);
+void calibrate(const string& filename);
+void compare_results(const string& baseline_file, const string& candidate_file);
+void write_json(const string& filename);
+void write_csv(const string& filename);
+
+vector<BenchmarkRecord> records;
+
+vector<int> sizes = {8, 16};
+vector<double> deltas = {0.01};
+vector<SortingType> methods = {PERMUTATION, NETWORK};
+int repetitions = 3;
+int seed = 42;
+bool toy;
+bool run_primitives;
+bool run_end_to_end;
+bool run_scaling;
+bool run_comparison;
+vector<int> job_counts;
+vector<int> thread_counts;
+vector<int> task_thread_counts = {1, 2};
+bool pin_threads;
+NetworkComparator comparator = RELU_COMPARATOR;
+RescalingMode rescaling = AUTO_RESCALING;
+string json_file;
+string csv_file;
+string calibration_file;
+string baseline_file;
+string candidate_file;
+
+int main(int argc, char *argv[]) {
+    read_arguments(argc, argv);
+
+    if (!baseline_file.empty()) {
+        compare_results(baseline_file, candidate_file);
+        return 0;
+    }
+
+    if (!calibration_file.empty()) {
+        calibrate(calibration_file);
+        return 0;
+    }
+
+    if (!run_primitives && !run_end_to_end && !run_scaling && !run_comparison && job_counts.empty()) {
+        run_primitives = true;
+        run_end_to_end = true;
+    }
+
+    // Scaling curves over powers of two, up to 64 threads or the available cores
+    if (thread_counts.empty()) {
+        for (int t = 1; t <= min(64, available_cores()); t *= 2) thread_counts.push_back(t);
+    }
+
+    configure_threading({0, 1, pin_threads});
+    print_threading();
+
+    cout << setprecision(3) << fixed;
+
+    for (int n : sizes) {
+        for (double delta : deltas) {
+            for (SortingType method : methods) {
+                if (run_primitives && method == PERMUTATION) benchmark_permutation_primitives(n, delta);
+                if (run_primitives && method == NETWORK) benchmark_network_primitives(n, delta);
+                if (run_end_to_end) benchmark_end_to_end(method, n, delta);
+                if (run_scaling) benchmark_scaling(method, n, delta);
+                if (!job_counts.empty()) benchmark_concurrency(method, n, delta);
+                if (run_comparison) benchmark_comparison(method, n, delta);
+            }
+        }
+    }
+
+    if (!json_file.empty()) write_json(json_file);
+    if (!csv_file.empty()) write_csv(csv_file);
+
+    return 0;
+}
+
+static void report(const BenchmarkRecord& r) {
+    cout << left << setw(11) << r.suite << setw(26) << r.name << right
+         << " n: " << setw(5) << r.n << ", δ: " << r.delta << ", rep: " << r.repetition
+         << " | wall: " << r.measurement.wall_ms << "ms"
+         << ", cpu: " << r.measurement.cpu_ms << "ms"
+         << ", threads: " << r.measurement.active_threads << "/" << r.threads
+         << ", peak RSS: " << r.measurement.peak_rss_kb / 1024 << "MB";
+
+    if (r.jobs > 1) {
+        cout << ", jobs: " << r.jobs << ", throughput: " << r.jobs * 1000.0 / r.measurement.wall_ms << " sorts/s";
+    }
+
+    if (r.corrects >= 0) {
+        cout << ", corrects: " << r.corrects << "/" << r.n << ", precision bits: " << r.precision_bits;
+    }
+
+    cout << endl;
+}
+
+/*
+ * Runs `block` the requested number of times, recording one entry per repetition
+ */
+static void measure(const string& suite, const string& name, SortingType method, int n, double delta,
+                    const function<void()>& block) {
+    for (int rep = 0; rep < repetitions; rep++) {
+        ResourceProbe probe;
+        probe.start();
+        block();
+
+        BenchmarkRecord r;
+        r.suite = suite;
+        r.name = name;
+        r.method = to_string(method);
+        r.n = n;
+        r.delta = delta;
+        r.repetition = rep;
+        r.measurement = probe.stop();
+        r.threads = threading().total_threads;
+        r.task_threads = threading().task_threads;
+
+        report(r);
+        records.push_back(r);
+    }
+}
+
+/*
+ * The permutation-based sorting as benchmarked: with the tie-offset correction, unless the
+ * comparisons are switched to FHEW (exact comparisons leave no tie band to correct)
+ */
+static PermutationConfig benchmark_permutation_config(int n, double delta, NetworkComparator comparison) {
+    bool scheme_switching = comparison == SWITCH_COMPARATOR;
+
+    return permutation_config(n, delta, !scheme_switching, toy, false, scheme_switching);
+}
+
+void benchmark_permutation_primitives(int n, double delta) {
+    PermutationConfig config = benchmark_permutation_config(n, delta, comparator);
+    const PermutationParameters& parameters = config.parameters;
+
+    FHEController controller(rescaling);
+    controller.generate_context_permutation(n * n, parameters.circuit_depth, toy, n, delta);
+    controller.generate_rotation_keys_permutation(n);
+    if (config.scheme_switching) controller.generate_scheme_switching_keys(n * n, toy);
+
+    vector<double> input_values = generate_close_randoms(n, delta, seed);
+
+    Ctxt in_exp = controller.encrypt_expanded(input_values, 0, n*n, n);
+    Ctxt in_rep = controller.encrypt_repeated(input_values, 0, n*n, n);
+
+    PermutationSorting sorting(controller, config);
+
+    // Inputs of each stage are computed once, outside of the measured blocks
+    Ctxt difference = controller.sub(in_exp, in_rep);
+    Ctxt cmp = sorting.compute_comparison(in_exp, in_rep);
+    Ctxt indexing = sorting.compute_indexing(cmp);
+    Ctxt sinc_input = controller.mult(difference, 0.5);
+
+    measure("primitive", "rot", PERMUTATION, n, delta, [&] { controller.rot(in_exp, n); });
+    measure("primitive", "rotsum", PERMUTATION, n, delta, [&] { controller.rotsum(in_exp, n); });
+    if (config.scheme_switching) {
+        measure("primitive", "compare_switch", PERMUTATION, n, delta, [&] { controller.compare_switch(in_exp, in_rep); });
+    } else {
+        measure("primitive", "sigmoid", PERMUTATION, n, delta, [&] {
+            controller.sigmoid(difference, 1, parameters.degree_sigmoid, -parameters.sigmoid_scaling);
+        });
+    }
+    measure("primitive", "clean_sigmoid", PERMUTATION, n, delta, [&] { controller.clean_sigmoid(cmp, n); });
+    measure("primitive", "sinc", PERMUTATION, n, delta, [&] { controller.sinc(sinc_input, parameters.degree_sinc, n); });
+
+    measure("stage", "permutation.comparison", PERMUTATION, n, delta, [&] { sorting.compute_comparison(in_exp, in_rep); });
+    measure("stage", "permutation.indexing", PERMUTATION, n, delta, [&] { sorting.compute_indexing(cmp); });
+    if (config.tieoffset) {
+        measure("stage", "permutation.tieoffset", PERMUTATION, n, delta, [&] { sorting.compute_tieoffset(cmp); });
+
+        auto counts = sorting.compute_equality_counts(cmp);
+        measure("stage", "permutation.duplicates", PERMUTATION, n, delta, [&] { sorting.compute_duplicates(counts); });
+    }
+    measure("stage", "permutation.sorting", PERMUTATION, n, delta, [&] { sorting.compute_sorting(indexing, in_rep); });
+}
+
+void benchmark_network_primitives(int n, double delta) {
+    NetworkConfig config = network_config(n, delta, toy, false, comparator);
+    const NetworkParameters& parameters = config.parameters;
+    int levels_consumption = network_layer_levels(parameters);
+
+    FHEController controller(rescaling);
+    int circuit_depth = controller.generate_context_network(n, levels_consumption, toy, delta);
+    controller.generate_rotation_keys_network(n);
+    if (parameters.comparator == SWITCH_COMPARATOR) controller.generate_scheme_switching_keys(n, toy);
+
+    vector<double> input_values = generate_close_randoms(n, delta, seed);
+    for (double& v : input_values) v *= parameters.input_scale;
+
+    Ctxt in = controller.encrypt(input_values, circuit_depth - levels_consumption - 3, n);
+    Ctxt difference = controller.sub(in, controller.rot(in, 1));
+
+    NetworkSorting sorting(controller, config);
+
+    measure("primitive", "rot", NETWORK, n, delta, [&] { controller.rot(in, 1); });
+    if (parameters.relu_degree > 0) {
+        measure("primitive", "relu", NETWORK, n, delta, [&] { controller.relu(difference, parameters.relu_degree, n); });
+    }
+    if (parameters.comparator == SIGN_COMPARATOR) {
+        measure("primitive", "composite_sign", NETWORK, n, delta, [&] { controller.composite_sign(difference, parameters.sign); });
+    }
+    if (parameters.comparator == SWITCH_COMPARATOR) {
+        measure("primitive", "compare_switch", NETWORK, n, delta, [&] { controller.compare_switch(in, controller.rot(in, 1)); });
+    }
+    measure("primitive", "bootstrap", NETWORK, n, delta, [&] { controller.bootstrap(in); });
+
+    measure("stage", "network.swap", NETWORK, n, delta, [&] { sorting.swap(in, 1, 0, 0); });
+}
+
+/*
+ * Generates the context and the keys required to sort n values with the given method
+ *
+ * @return The circuit depth
+ */
+static int setup_context(FHEController& controller, SortingType method, int n, double delta,
+                         NetworkComparator comparison) {
+    if (method == PERMUTATION) {
+        PermutationConfig config = benchmark_permutation_config(n, delta, comparison);
+        const PermutationParameters& parameters = config.parameters;
+
+        controller.generate_context_permutation(n * n, parameters.circuit_depth, toy, n, delta);
+        controller.generate_rotation_keys_permutation(n);
+        if (config.scheme_switching) controller.generate_scheme_switching_keys(n * n, toy);
+
+        return parameters.circuit_depth;
+    }
+
+    NetworkConfig config = network_config(n, delta, toy, false, comparison);
+    const NetworkParameters& parameters = config.parameters;
+    int levels_consumption = network_layer_levels(parameters);
+
+    int circuit_depth = controller.generate_context_network(n, levels_consumption, toy, delta);
+    controller.generate_rotation_keys_network(n);
+    if (comparison == SWITCH_COMPARATOR) controller.generate_scheme_switching_keys(n, toy);
+
+    return circuit_depth;
+}
+
+/*
+ * Encrypts fresh random values, sorts them measuring only the sort itself, and checks the result.
+ * Concurrent sorts are measured as a whole by the caller, so they pass probe_resources = false
+ */
+static BenchmarkRecord sort_once(FHEController& controller, int circuit_depth, const string& suite,
+                                 SortingType method, int n, double delta, int rep, NetworkComparator comparison,
+                                 bool probe_resources = true) {
+    vector<double> input_values = generate_close_randoms(n, delta, seed + rep);
+    vector<double> results;
+    Ctxt result;
+
+    ResourceProbe probe;
+
+    if (method == PERMUTATION) {
+        PermutationConfig config = benchmark_permutation_config(n, delta, comparison);
+
+        Ctxt in_exp = controller.encrypt_expanded(input_values, 0, n*n, n);
+        Ctxt in_rep = controller.encrypt_repeated(input_values, 0, n*n, n);
+
+        PermutationSorting sorting(controller, config);
+
+        if (probe_resources) probe.start();
+        result = sorting.sort(in_exp, in_rep);
+    } else {
+        NetworkConfig config = network_config(n, delta, toy, false, comparison);
+        const NetworkParameters& parameters = config.parameters;
+        int levels_consumption = network_layer_levels(parameters);
+
+        vector<double> scaled(input_values);
+        for (double& v : scaled) v *= parameters.input_scale;
+
+        Ctxt in = controller.encrypt(scaled, circuit_depth - levels_consumption - 3, n);
+
+        NetworkSorting sorting(controller, config);
+
+        if (probe_resources) probe.start();
+        result = sorting.sort(in);
+    }
+
+    BenchmarkRecord r;
+    r.suite = suite;
+    r.name = comparison == comparator ? "sort" : "sort (" + to_string(comparison) + ")";
+    r.method = to_string(method);
+    r.n = n;
+    r.delta = delta;
+    r.repetition = rep;
+    if (probe_resources) r.measurement = probe.stop();
+    r.final_level = result->GetLevel();
+    r.threads = threading().total_threads;
+    r.task_threads = threading().task_threads;
+
+    vector<double> decrypted = controller.decode(controller.decrypt(result));
+    double scale = method == NETWORK ? network_parameters(n, delta).input_scale : 1.0;
+    int stride = method == PERMUTATION ? n : 1;
+
+    for (int i = 0; i < n; i++) {
+        results.push_back(decrypted[i * stride] / scale);
+    }
+
+    sort(input_values.begin(), input_values.end());
+
+    r.corrects = 0;
+    for (int i = 0; i < n; i++) {
+        if (abs(input_values[i] - results[i]) < delta) r.corrects++;
+    }
+    r.precision_bits = precision_bits(input_values, results);
+
+    return r;
+}
+
+void benchmark_end_to_end(SortingType method, int n, double delta) {
+    FHEController controller(rescaling);
+    int circuit_depth = setup_context(controller, method, n, delta, comparator);
+
+    for (int rep = 0; rep < repetitions; rep++) {
+        BenchmarkRecord r = sort_once(controller, circuit_depth, "end-to-end", method, n, delta, rep, comparator);
+
+        report(r);
+        records.push_back(r);
+    }
+}
+
+/*
+ * Whole sorts on the same context under every thread budget and task/limb split
+ */
+void benchmark_scaling(SortingType method, int n, double delta) {
+    FHEController controller(rescaling);
+    int circuit_depth = setup_context(controller, method, n, delta, comparator);
+
+    for (int threads : thread_counts) {
+        for (int task_threads : task_thread_counts) {
+            if (task_threads > threads) continue;
+
+            configure_threading({threads, task_threads, pin_threads});
+
+            for (int rep = 0; rep < repetitions; rep++) {
+                BenchmarkRecord r = sort_once(controller, circuit_depth, "scaling", method, n, delta, rep, comparator);
+
+                report(r);
+                records.push_back(r);
+            }
+        }
+    }
+
+    configure_threading({0, 1, pin_threads});
+}
+
+/*
+ * Many sorts at once, each on its own thread, sharing a single context and key set. Each job
+ * gets its share of the cores as limb-level threads; the record reports the whole batch
+ */
+void benchmark_concurrency(SortingType method, int n, double delta) {
+    FHEController controller(rescaling);
+    int circuit_depth = setup_context(controller, method, n, delta, comparator);
+
+    for (int jobs : job_counts) {
+        configure_threading({0, jobs, pin_threads});
+
+        for (int rep = 0; rep < repetitions; rep++) {
+            vector<BenchmarkRecord> results(jobs);
+            vector<thread> workers;
+
+            ResourceProbe probe;
+            probe.start();
+
+            for (int j = 0; j < jobs; j++) {
+                workers.emplace_back([&, j] {
+                    ThreadingTask task(j);
+                    // Every job sorts different values
+                    results[j] = sort_once(controller, circuit_depth, "concurrency", method, n, delta,
+                                           rep * jobs + j, comparator, false);
+                });
+            }
+
+            for (thread& worker : workers) worker.join();
+
+            BenchmarkRecord r = results[0];
+            r.repetition = rep;
+            r.measurement = probe.stop();
+            r.jobs = jobs;
+
+            // A batch is correct only as far as its worst job
+            for (const BenchmarkRecord& job : results) {
+                r.corrects = min(r.corrects, job.corrects);
+                r.precision_bits = min(r.precision_bits, job.precision_bits);
+                r.final_level = max(r.final_level, job.final_level);
+            }
+
+            report(r);
+            records.push_back(r);
+        }
+    }
+
+    configure_threading({0, 1, pin_threads});
+}
+
+/*
+ * Whole sorts with the polynomial comparison (the sigmoid, or the --comparator of the network) and
+ * with scheme switching, on the same inputs: the polynomial degrees grow as δ shrinks, while the
+ * FHEW comparison costs the same for every δ, so the summary tells which engine is faster where
+ */
+void benchmark_comparison(SortingType method, int n, double delta) {
+    NetworkComparator polynomial = comparator == SWITCH_COMPARATOR ? RELU_COMPARATOR : comparator;
+    map<NetworkComparator, double> median_wall_ms;
+
+    for (NetworkComparator comparison : {polynomial, SWITCH_COMPARATOR}) {
+        CostEstimate estimate = estimate_sort(method, n, delta, method == PERMUTATION && comparison != SWITCH_COMPARATOR,
+                                              toy, CostCalibration(), comparison, rescaling);
+
+        if (!estimate.feasible) {
+            cout << "comparison " << to_string(method) << " with " << to_string(comparison) << " n: " << n
+                 << ", δ: " << delta << " | not feasible: " << estimate.reason << endl;
+            continue;
+        }
+
+        FHEController controller(rescaling);
+        int circuit_depth = setup_context(controller, method, n, delta, comparison);
+
+        vector<double> wall_ms;
+
+        for (int rep = 0; rep < repetitions; rep++) {
+            BenchmarkRecord r = sort_once(controller, circuit_depth, "comparison", method, n, delta, rep, comparison);
+            r.name = "sort (" + to_string(comparison) + ")";
+
+            report(r);
+            records.push_back(r);
+            wall_ms.push_back(r.measurement.wall_ms);
+        }
+
+        sort(wall_ms.begin(), wall_ms.end());
+        if (!wall_ms.empty()) median_wall_ms[comparison] = wall_ms[wall_ms.size() / 2];
+    }
+
+    cout << "comparison " << to_string(method) << " n: " << n << ", δ: " << delta << " | ";
+
+    if (median_wall_ms.size() == 2) {
+        double ratio = median_wall_ms[polynomial] / median_wall_ms[SWITCH_COMPARATOR];
+        cout << "scheme switching is " << (ratio >= 1 ? ratio : 1 / ratio) << "x " << (ratio >= 1 ? "faster" : "slower")
+             << " than " << to_string(polynomial) << endl;
+    } else if (median_wall_ms.count(SWITCH_COMPARATOR)) {
+        cout << "only scheme switching reaches this δ" << endl;
+    } else {
+        cout << "scheme switching not measured" << endl;
+    }
+}
+
+// Median wall time of `block` over the requested repetitions
+static double median_ms(const function<void()>& block) {
+    vector<double> times;
+
+    for (int rep = 0; rep < max(repetitions, 1); rep++) {
+        auto start = steady_clock::now();
+        block();
+        times.push_back(duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0);
+    }
+
+    sort(times.begin(), times.end());
+
+    return times[times.size() / 2];
+}
+
+/*
+ * Measures the per-operation latencies used by the cost model, on the context of a
+ * network-based sort of the first size and delta, at the level of its input
+ */
+void calibrate(const string& filename) {
+    int n = sizes[0];
+    double delta = deltas[0];
+
+    NetworkConfig config = network_config(n, delta, toy);
+    const NetworkParameters& parameters = config.parameters;
+    int levels_consumption = network_layer_levels(parameters);
+
+    reset_peak_rss();
+    long rss_before = peak_rss_kb();
+
+    FHEController controller(rescaling);
+    int circuit_depth = controller.generate_context_network(n, levels_consumption, toy, delta);
+    controller.generate_rotation_keys_network(n);
+
+    long rss_context = peak_rss_kb() - rss_before;
+
+    int level = circuit_depth - levels_consumption - 3;
+    vector<double> input_values = generate_close_randoms(n, delta, seed);
+    for (double& v : input_values) v *= parameters.input_scale;
+
+    Ctxt in = controller.encrypt(input_values, level, n);
+
+    CostCalibration calibration;
+    calibration.ring_dim = in->GetElements()[0].GetRingDimension();
+    calibration.limbs = circuit_depth + 1 - level;
+    calibration.calibrated = true;
+
+    calibration.add_ms = median_ms([&] { controller.add(in, in); });
+    calibration.plaintext_mult_ms = median_ms([&] { controller.mult(in, 0.5); });
+    calibration.ciphertext_mult_ms = median_ms([&] { controller.mult(in, in); });
+    calibration.rotation_ms = median_ms([&] { controller.rot(in, 1); });
+    calibration.bootstrap_ms = median_ms([&] { controller.bootstrap(in); });
+
+    // A product by a constant rescales its operand first, in every mode
+    Ctxt product = controller.mult(in, 0.5);
+    calibration.rescale_ms = max(median_ms([&] { controller.mult(product, 0.5); }) - calibration.plaintext_mult_ms, 0.0);
+
+    // Every Chebyshev degree used by the sorting parameters that fits the remaining levels
+    for (int degree : {59, 119, 247, 351, 495, 1006, 2031}) {
+        if (level + poly_evaluation_cost(degree) > circuit_depth) continue;
+
+        calibration.chebyshev_ms[degree] = median_ms([&] { controller.relu(in, degree, n); });
+    }
+
+    // Ratio between the measured memory of the context and what the model predicts for it
+    CostEstimate estimate = estimate_sort(NETWORK, n, delta, false, toy, calibration, RELU_COMPARATOR, rescaling);
+    if (estimate.feasible && estimate.key_bytes > 0 && rss_context > 0) {
+        calibration.memory_scale = rss_context * 1024.0 / (estimate.key_bytes + estimate.peak_data_bytes);
+    }
+
+    cout << "ring dimension: " << calibration.ring_dim << ", limbs: " << calibration.limbs
+         << ", add: " << calibration.add_ms << "ms, plaintext mult: " << calibration.plaintext_mult_ms
+         << "ms, ciphertext mult: " << calibration.ciphertext_mult_ms << "ms, rotation: " << calibration.rotation_ms
+         << "ms, bootstrap: " << calibration.bootstrap_ms << "ms, rescale: " << calibration.rescale_ms
+         << "ms, memory scale: " << calibration.memory_scale << endl;
+
+    calibration.save(filename);
+}
+
+/*
+ * Median wall time of every measurement of a CSV written by --csv, keyed by what was measured
+ */
+static map<string, double> read_wall_times(const string& filename, string& backend) {
+    ifstream in(filename);
+    if (!in) throw runtime_error("Could not read " + filename);
+
+    string line;
+    getline(in, line);
+    vector<string> header = tokenizer(line, ',');
+
+    auto column = [&](const string& name) {
+        auto it = find(header.begin(), header.end(), name);
+        return it == header.end() ? -1 : (int) (it - header.begin());
+    };
+
+    vector<int> key_columns;
+    for (const char* name : {"suite", "name", "method", "n", "delta", "threads", "task_threads", "jobs"}) {
+        if (column(name) >= 0) key_columns.push_back(column(name));
+    }
+
+    int wall_column = column("wall_ms");
+    int backend_column = column("backend");
+    if (wall_column < 0) throw runtime_error(filename + " has no wall_ms column");
+
+    backend = "unknown";
+    map<string, vector<double>> times;
+
+    while (getline(in, line)) {
+        if (line.empty()) continue;
+
+        vector<string> fields = tokenizer(line, ',');
+        if ((int) fields.size() != (int) header.size()) continue;
+
+        string key;
+        for (int c : key_columns) key += (key.empty() ? "" : " ") + header[c] + "=" + fields[c];
+
+        times[key].push_back(stod(fields[wall_column]));
+        if (backend_column >= 0) backend = fields[backend_column];
+    }
+
+    map<string, double> medians;
+    for (auto& [key, values] : times) {
+        sort(values.begin(), values.end());
+        medians[key] = values[values.size() / 2];
+    }
+
+    return medians;
+}
+
+/*
+ * Compares two CSVs of the same suites, e.g. the same run of the native and of the HEXL build, by
+ * the median wall time of every measurement both contain
+ */
+void compare_results(const string& baseline_file, const string& candidate_file) {
+    string baseline_backend, candidate_backend;
+    map<string, double> baseline = read_wall_times(baseline_file, baseline_backend);
+    map<string, double> candidate = read_wall_times(candidate_file, candidate_backend);
+
+    cout << setprecision(3) << fixed;
+    cout << "Baseline: " << baseline_file << " (" << baseline_backend << "), candidate: " << candidate_file
+         << " (" << candidate_backend << ")" << endl;
+
+    double log_speedups = 0;
+    int compared = 0;
+
+    for (const auto& [key, baseline_ms] : baseline) {
+        auto it = candidate.find(key);
+        if (it == candidate.end() || it->second <= 0) continue;
+
+        double speedup = baseline_ms / it->second;
+        log_speedups += log(speedup);
+        compared++;
+
+        cout << left << setw(90) << key << right << " | " << setw(10) << baseline_ms << "ms -> "
+             << setw(10) << it->second << "ms, speedup: " << speedup << "x" << endl;
+    }
+
+    if (compared == 0) {
+        cout << "The two files have no measurement in common" << endl;
+        return;
+    }
+
+    cout << "Geometric mean speedup over " << compared << " measurements: " << exp(log_speedups / compared) << "x" << endl;
+}
+
+static string build_variant() {
+#ifdef NDEBUG
+    return "release";
+#else
+    return "debug";
+#endif
+}
+
+void write_json(const string& filename) {
+    ofstream out(filename);
+    out << setprecision(6) << fixed;
+
+    out << "{\n  \"build\": {\"compiler\": \"" << __VERSION__ << "\", \"variant\": \"" << build_variant()
+        << "\", \"backend\": \"" << SORTING_BACKEND << "\", \"rescaling\": \"" << to_string(rescaling)
+        << "\", \"toy\": " << (toy ? "true" : "false") << ", \"seed\": " << seed << "},\n";
+    out << "  \"records\": [\n";
+
+    for (size_t i = 0; i < records.size(); i++) {
+        const BenchmarkRecord& r = records[i];
+        out << "    {\"suite\": \"" << r.suite << "\", \"name\": \"" << r.name << "\", \"method\": \"" << r.method
+            << "\", \"n\": " << r.n << ", \"delta\": " << r.delta << ", \"repetition\": " << r.repetition
+            << ", \"wall_ms\": " << r.measurement.wall_ms << ", \"cpu_ms\": " << r.measurement.cpu_ms
+            << ", \"thread_cpu_ms\": " << r.measurement.thread_cpu_ms
+            << ", \"max_thread_cpu_ms\": " << r.measurement.max_thread_cpu_ms
+            << ", \"active_threads\": " << r.measurement.active_threads
+            << ", \"threads\": " << r.threads << ", \"task_threads\": " << r.task_threads
+            << ", \"jobs\": " << r.jobs
+            << ", \"peak_rss_kb\": " << r.measurement.peak_rss_kb
+            << ", \"corrects\": " << r.corrects << ", \"precision_bits\": " << r.precision_bits
+            << ", \"final_level\": " << r.final_level << "}" << (i + 1 < records.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+
+    cout << "Results written to " << filename << endl;
+}
+
+void write_csv(const string& filename) {
+    ofstream out(filename);
+    out << setprecision(6) << fixed;
+
+    out << "suite,name,method,n,delta,repetition,wall_ms,cpu_ms,thread_cpu_ms,max_thread_cpu_ms,"
+           "active_threads,threads,task_threads,jobs,peak_rss_kb,corrects,precision_bits,final_level,backend,rescaling" << endl;
+
+    for (const BenchmarkRecord& r : records) {
+        out << r.suite << "," << r.name << "," << r.method << "," << r.n << "," << r.delta << "," << r.repetition << ","
+            << r.measurement.wall_ms << "," << r.measurement.cpu_ms << "," << r.measurement.thread_cpu_ms << ","
+            << r.measurement.max_thread_cpu_ms << "," << r.measurement.active_threads << ","
+            << r.threads << "," << r.task_threads << "," << r.jobs << ","
+            << r.measurement.peak_rss_kb << "," << r.corrects << "," << r.precision_bits << "," << r.final_level << ","
+            << SORTING_BACKEND << "," << to_string(rescaling) << endl;
+    }
+
+    cout << "Results written to " << filename << endl;
+}
+
+void read_arguments(int argc, char *argv[]) {
+    if (argc == 2 && string(argv[1]) == "--help") {
+        cerr << "Usage: ./Benchmark [options]\n"
+                "\n"
+                "Suites (both are executed when none is given):\n"
+                "  --primitives              Benchmark sigmoid, sinc, relu, clean_sigmoid, rotsum, rot, bootstrap,\n"
+                "                            a single swap layer and the permutation stages in isolation\n"
+                "  --end-to-end              Benchmark whole sorts over the given sizes and deltas\n"
+                "  --scaling                 Benchmark whole sorts under every thread budget (1, 2, 4, ... up to 64\n"
+                "                            or the available cores) with 1 and 2 task-level threads\n"
+                "  --concurrency <a,b,...>   Run a, b, ... whole sorts at once on one shared context and report\n"
+                "                            the aggregate throughput\n"
+                "  --comparison              Run whole sorts with the polynomial comparison and with scheme switching\n"
+                "                            and report which one is faster for every size and δ\n"
+                "  --calibrate <file>        Measure the per-operation latencies used by the cost model\n"
+                "                            (Sort --estimate --calibration <file>) and write them to <file>\n"
+                "  --compare <base> <cand>   Compare two CSVs written by --csv, e.g. by the native and the HEXL\n"
+                "                            build, by the median wall time of every measurement\n"
+                "\n"
+                "Options:\n"
+                "  --n <a,b,...>             Number of values (default: 8,16)\n"
+                "  --delta <a,b,...>         Min distances δ (default: 0.01)\n"
+                "  --permutation             Only benchmark the permutation-based sorting\n"
+                "  --network                 Only benchmark the network-based sorting\n"
+                "  --repetitions <r>         Repetitions of each measurement (default: 3)\n"
+                "  --seed <s>                Seed of the random inputs (default: 42)\n"
+                "  --toy                     Use toy parameters\n"
+                "  --comparator <relu|sign|switch>\n"
+                "                            Comparator of the network-based sorting (default: relu); switch also\n"
+                "                            switches the comparisons of the permutation-based sorting\n"
+                "  --rescaling <auto|autoext|manual>\n"
+                "                            Scaling technique: FLEXIBLEAUTO (default), FLEXIBLEAUTOEXT or FIXEDMANUAL\n"
+                "  --threads <a,b,...>       Thread budgets of --scaling\n"
+                "  --task-threads <a,b,...>  Task-level threads of --scaling (default: 1,2)\n"
+                "  --pin                     Pin every thread to its own core\n"
+                "  --json <file>             Write the results as JSON\n"
+                "  --csv <file>              Write the results as CSV\n" << endl;
+        exit(0);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        string arg = string(argv[i]);
+
+        if (arg == "--primitives") run_primitives = true;
+        if (arg == "--end-to-end") run_end_to_end = true;
+        if (arg == "--permutation") methods = {PERMUTATION};
+        if (arg == "--network") methods = {NETWORK};
+        if (arg == "--toy") toy = true;
+        if (arg == "--scaling") run_scaling = true;
+        if (arg == "--comparison") run_comparison = true;
+        if (arg == "--pin") pin_threads = true;
+
+        if (i + 1 < argc) {
+            if (arg == "--n") {
+                sizes.clear();
+                for (const string& t : tokenizer(argv[i + 1], ',')) sizes.push_back(stoi(t));
+            }
+            if (arg == "--delta") {
+                deltas.clear();
+                for (const string& t : tokenizer(argv[i + 1], ',')) deltas.push_back(stod(t));
+            }
+            if (arg == "--threads") {
+                thread_counts.clear();
+                for (const string& t : tokenizer(argv[i + 1], ',')) thread_counts.push_back(stoi(t));
+            }
+            if (arg == "--concurrency") {
+                job_counts.clear();
+                for (const string& t : tokenizer(argv[i + 1], ',')) job_counts.push_back(stoi(t));
+            }
+            if (arg == "--task-threads") {
+                task_thread_counts.clear();
+                for (const string& t : tokenizer(argv[i + 1], ',')) task_thread_counts.push_back(stoi(t));
+            }
+            if (arg == "--comparator") comparator = parse_comparator(argv[i + 1]);
+            if (arg == "--rescaling") rescaling = parse_rescaling(argv[i + 1]);
+            if (arg == "--repetitions") repetitions = stoi(argv[i + 1]);
+            if (arg == "--seed") seed = stoi(argv[i + 1]);
+            if (arg == "--json") json_file = argv[i + 1];
+            if (arg == "--csv") csv_file = argv[i + 1];
+            if (arg == "--calibrate") calibration_file = argv[i + 1];
+        }
+
+        if (arg == "--compare") {
+            if (i + 2 >= argc) {
+                cerr << "--compare requires the baseline and the candidate CSV" << endl;
+                exit(1);
+            }
+            baseline_file = argv[i + 1];
+            candidate_file = argv[i + 2];
+        }
+    }
+}
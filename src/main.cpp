@@ -5,279 +5,910 @@
 #include "Utils.h"
 #include "PermutationSorting.h"
 #include "NetworkSorting.h"
+#include "SortingParameters.h"
+#include "PlainController.h"
+#include "CostModel.h"
+#include "Threading.h"
+#include "ExternalSorting.h"
+#include "CountingSorting.h"
 
 #include "schemelet/rlwe-mp.h"
 #include "math/hermite.h"
+#include <filesystem>
 #include <functional>
+#include <numeric>
+#include <optional>
 
 
 using namespace lbcrypto;
 using namespace std;
 using namespace std::chrono;
 
-void read_arguments(int argc, char *argv[]);
-void set_permutation_parameters(int n, double d);
-void set_network_parameters(int n, double d);
-void evaluate_sorting_accuracy(const Ctxt& result);
-
-
-FHEController controller;
-vector<double> input_values;
-
-int n;
-double delta;
-int precision_digits;
-bool toy;
-bool verbose;
-
 /*
- * Permutation-based parameters
+ * What Sort has been asked to do, as read from the command line
  */
-int sigmoid_scaling;
-int degree_sigmoid;
-int degree_sinc;
-int circuit_depth;
-bool tieoffset;
+struct SortOptions {
+    vector<double> input_values;
+    int n = 0;
+    double delta = 0;
+    SortingType method = NONE;
+
+    bool toy = false;
+    bool verbose = false;
+    bool tieoffset = false;
+    int relu_degree = 0;                // 0 for the degree chosen by network_parameters()
+    vector<int> relu_schedule;          // ReLU degree of each layer, overriding relu_degree
+    bool tune_relu = false;             // Search the lowest ReLU degree of each layer by dry runs
+    NetworkComparator comparator = RELU_COMPARATOR;
+    RescalingMode rescaling = AUTO_RESCALING;
+    int lanes = 1;                      // Independent lists of n / lanes values (two with --permutation --half-packing)
+    int seed = -1;
+
+    /*
+     * Permutation-based sorting only: outputs other than the sorted list
+     */
+    bool ranks_only = false;            // The encrypted rank of each value
+    vector<double> quantiles;           // The values at these quantiles, in [0, 1]
+    bool duplicates = false;            // Also the multiplicities, first occurrences and distinct count
+
+    bool finalize = false;              // Repack the sorted values densely at the last modulus
+
+    vector<string> then_by;             // Further keys of a lexicographic sort, as given to --then-by
+    vector<vector<double>> secondary_keys;  // The same keys, parsed or drawn once the input is known
+    bool half_packing = false;          // Permutation-based: the comparisons of two keys per sigmoid
+
+    /*
+     * Network-based sorting: checkpoints of the layers, and the keys they are encrypted under
+     */
+    string checkpoint_directory;
+    int checkpoint_interval = 1;
+    bool resume = false;                // Continue from the last checkpoint instead of encrypting the input
+    string offload_directory;           // Low-memory mode: where the rotation keys are kept between layers
+
+    int max_displacement = 0;           // Approximate network-based sorting: the positions a value may be off by
+
+    string trace_file;
+    bool trace_summary = false;
+    bool memory_report = false;         // The peak resident set of every phase, in the summary
+
+    bool dry_run = false;
+    double dry_run_noise = 0;
+
+    ThreadingStrategy threading;
+
+    /*
+     * External-memory sorting: the input is streamed in runs kept on disk
+     */
+    string input_file;                  // Read while sorting, instead of being loaded, with --external
+    string external_directory;
+    int run_size = 0;                   // 0 for min(n, 64) with --random, 64 otherwise
+    double memory_limit_mb = 0;         // Bounds the run ciphertexts held in memory (0 for the default of 6)
+    string output_file;
+
+    /*
+     * Cost model and admission control
+     */
+    bool estimate_only = false;
+    bool automatic_method = false;
+    string calibration_file;
+    double max_seconds = 0;
+    double max_memory_mb = 0;
+
+    /*
+     * Experimental
+     */
+    bool clean_permutation_matrix = false;
+};
 
 /*
- * Network-based parameters
+ * The encrypted output of a sort, together with what is needed to check it
  */
-int relu_degree;
-double input_scale;
+template <class Controller>
+struct SortOutcome {
+    typename Controller::Ctxt result;
+    optional<typename PermutationSorting<Controller>::Duplicates> duplicates;
+    vector<typename Controller::Ctxt> secondary_keys;  // With --then-by, the further keys in the order of result
+    vector<typename Controller::Ctxt> lanes;           // With --permutation --lanes 2, the second list, sorted on its own
+    int circuit_depth = 0;
+    double input_scale = 1.0;
+};
 
+SortOptions read_arguments(int argc, char *argv[]);
 
-/*
- * Experimental
- */
-bool clean_permutation_matrix;
+template <class Controller>
+SortOutcome<Controller> run_sorting(Controller& controller, const SortOptions& options);
+
+template <class Controller>
+void evaluate_sorting_accuracy(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome);
+
+template <class Controller>
+void run_external(Controller& controller, const SortOptions& options);
+
+int resident_runs(const SortOptions& options);
 
+template <class Controller>
+void offload_rotation_keys(Controller& controller, const string& directory);
+
+void apply_relu_options(NetworkParameters& parameters, const SortOptions& options, int n);
+
+vector<int> quantile_ranks(const vector<double>& quantiles, int n);
+
+template <class Controller>
+void evaluate_selection_accuracy(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome);
+
+template <class Controller>
+void evaluate_duplicates(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome);
+
+template <class Controller>
+void evaluate_lexicographic_accuracy(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome);
 
-SortingType sortingType = NONE;
 
 int main(int argc, char *argv[]) {
-    read_arguments(argc, argv);
+    SortOptions options = read_arguments(argc, argv);
 
     if (argc == 1 || (argc == 2 && string(argv[1]) == "--help"))
         return 0;
 
-    if (sortingType == NONE) {
-        cerr << "You must pick a sorting method. Add either --permutation or --network" << endl;
+    configure_threading(options.threading);
+    if (options.verbose) print_threading();
+
+    if (options.estimate_only || options.automatic_method || options.max_seconds > 0 || options.max_memory_mb > 0) {
+        CostCalibration calibration;
+        if (!options.calibration_file.empty()) calibration = CostCalibration::load(options.calibration_file);
+
+        if (options.automatic_method) {
+            options.method = choose_method(options.n, options.delta, options.tieoffset, options.toy, calibration,
+                                           options.comparator, on_grid(options.input_values, options.delta));
+            cout << "Selected sorting type: " << to_string(options.method) << endl;
+        }
+
+        if (options.method != NONE) {
+            CostEstimate estimate = estimate_sort(options.method, options.n, options.delta, options.tieoffset,
+                                                  options.toy, calibration, options.comparator, options.rescaling);
+            print_estimate(estimate);
+
+            if (options.estimate_only) return 0;
+
+            string reason;
+            if (!options.dry_run && !admit(estimate, options.max_seconds, options.max_memory_mb, reason)) {
+                cerr << "Refusing to sort: " << reason << endl;
+                return 2;
+            }
+        }
+    }
+
+    if (options.method == NONE) {
+        cerr << "You must pick a sorting method. Add either --permutation, --network, --counting or --auto" << endl;
+        return 1;
+    } else if (options.duplicates && (options.method != PERMUTATION || options.comparator == SWITCH_COMPARATOR
+                                      || options.ranks_only || !options.quantiles.empty() || !options.external_directory.empty())) {
+        cerr << "--duplicates requires the permutation-based sorting with the sigmoid comparison, and the sorted list as output" << endl;
+        return 1;
+    } else if (options.method == COUNTING && (!on_grid(options.input_values, options.delta) || grid_points(options.delta) > MAX_COUNTING_BUCKETS)) {
+        cerr << "--counting requires values on the grid of step δ, with at most " << MAX_COUNTING_BUCKETS << " points" << endl;
+        return 1;
+    } else if (options.method == COUNTING && counting_parameters(options.n, options.delta).slots > MAX_COUNTING_SLOTS) {
+        cerr << "--counting needs 2 n slots per point of the grid, the points rounded up to a power of two: at most "
+             << MAX_COUNTING_SLOTS << " fit a ciphertext" << endl;
+        return 1;
+    } else if (options.method == COUNTING && (options.finalize || !options.secondary_keys.empty())) {
+        cerr << "--counting sorts a single list: it excludes --finalize and --then-by" << endl;
+        return 1;
+    } else if (options.comparator == SWITCH_COMPARATOR && options.tieoffset) {
+        cerr << "--tieoffset requires the sigmoid comparison: exact comparisons have no tie band to detect" << endl;
+        return 1;
+    } else if ((options.ranks_only || !options.quantiles.empty()) && (options.method != PERMUTATION || !options.external_directory.empty())) {
+        cerr << "--ranks and --quantiles require the permutation-based sorting" << endl;
+        return 1;
+    } else if (options.finalize && (options.ranks_only || !options.quantiles.empty() || !options.external_directory.empty())) {
+        cerr << "--finalize applies to the sorted list, not to --ranks, --quantiles or --external" << endl;
+        return 1;
+    } else if (!options.secondary_keys.empty() && (options.lanes > 1 || options.finalize || options.duplicates || options.ranks_only
+                                                  || !options.quantiles.empty() || !options.external_directory.empty())) {
+        cerr << "--then-by sorts a single list of records: it excludes --lanes, --finalize, --duplicates, --ranks, --quantiles and --external" << endl;
+        return 1;
+    } else if (!options.secondary_keys.empty() && (options.method == PERMUTATION ? options.comparator == SWITCH_COMPARATOR
+                                                                                 : options.comparator != SIGN_COMPARATOR)) {
+        cerr << "--then-by requires the sigmoid comparison with --permutation, or --comparator sign with --network" << endl;
+        return 1;
+    } else if (options.half_packing && (options.method != PERMUTATION || (options.secondary_keys.empty() && options.lanes != 2)
+                                        || options.tieoffset)) {
+        cerr << "--half-packing applies to the permutation-based sorting with --then-by or --lanes 2, without --tieoffset" << endl;
+        return 1;
+    } else if (!options.checkpoint_directory.empty() && (options.method != NETWORK || !options.secondary_keys.empty()
+                                                       || !options.external_directory.empty())) {
+        cerr << "--checkpoint applies to the network-based sorting of a single key, not to --then-by or --external" << endl;
+        return 1;
+    } else if (!options.offload_directory.empty() && (options.method != NETWORK || !options.external_directory.empty())) {
+        cerr << "--low-memory applies to the network-based sorting, not to --external" << endl;
+        return 1;
+    } else if (options.max_displacement > 0 && (options.method != NETWORK || !options.secondary_keys.empty()
+                                                || !options.external_directory.empty())) {
+        cerr << "--max-displacement applies to the network-based sorting of a single key: a wrong rank of the permutation-based\n"
+                "sorting mixes values instead of moving them, and the merges of --external expect sorted runs" << endl;
+        return 1;
+    } else if (options.resume && (options.checkpoint_directory.empty() || options.comparator == SWITCH_COMPARATOR)) {
+        cerr << "--resume requires --checkpoint, and a comparator other than switch (its keys are not saved)" << endl;
+        return 1;
+    } else if (options.lanes > 1 && (options.method != NETWORK || options.n % options.lanes != 0)
+               && (options.method != PERMUTATION || options.lanes != 2 || !options.half_packing || options.ranks_only
+                   || !options.quantiles.empty())) {
+        cerr << "--lanes requires the network-based sorting and a number of values multiple of the lanes, or --lanes 2\n"
+                "with --permutation --half-packing and the sorted lists as output" << endl;
         return 1;
     } else {
-        if (verbose) cout << "Selected sorting type: " << to_string(sortingType) << endl;
+        if (options.verbose) cout << "Selected sorting type: " << to_string(options.method) << endl;
     }
 
-    Ctxt result;
+    if (!options.trace_file.empty()) Tracer::instance().set_spans(true);
+    if (options.memory_report) Tracer::instance().set_memory(true);
 
     auto start_time = steady_clock::now();
 
-    if (sortingType == PERMUTATION) {
-        if (sigmoid_scaling == 0 || degree_sigmoid == 0 || degree_sinc == 0) {
-            set_permutation_parameters(n, delta);
+    if (!options.external_directory.empty()) {
+        if (options.method != NETWORK || options.delta <= 0 || (options.run_size & (options.run_size - 1)) != 0) {
+            cerr << "--external requires the network-based sorting, --delta and a power-of-two --run-size" << endl;
+            return 1;
         }
 
-        if (verbose) cout << endl << "Ciphertext: " << endl << input_values << endl << endl << "δ: " << delta << ", ";
+        if (options.dry_run) {
+            PlainController plain;
+            if (options.dry_run_noise > 0) plain.set_noise(options.dry_run_noise, max(options.seed, 0));
+
+            run_external(plain, options);
+
+            DryRunStatistics statistics = plain.statistics();
+            cout << "Max level reached: " << statistics.max_level << "/" << statistics.depth << endl;
+            if (statistics.depth_exceeded) cout << RED_TEXT << "The circuit exceeds the available depth" << RESET_COLOR << endl;
+        } else {
+            FHEController controller(options.rescaling);
+
+            run_external(controller, options);
+        }
+
+        print_duration(start_time, "The external sorting took:");
+    } else if (options.dry_run) {
+        PlainController plain;
+        if (options.dry_run_noise > 0) plain.set_noise(options.dry_run_noise, max(options.seed, 0));
+
+        SortOutcome<PlainController> outcome = run_sorting(plain, options);
+
+        print_duration(start_time, "The dry run took:");
+
+        evaluate_sorting_accuracy(plain, options, outcome);
+        if (outcome.duplicates) evaluate_duplicates(plain, options, outcome);
+
+        DryRunStatistics statistics = plain.statistics();
+        cout << "Max level reached: " << statistics.max_level << "/" << statistics.depth << endl;
+        if (statistics.depth_exceeded) cout << RED_TEXT << "The circuit exceeds the available depth" << RESET_COLOR << endl;
+        if (statistics.out_of_range > 0) cout << YELLOW_TEXT << "Slots outside [-1, 1] in approximations or bootstrapping: " << statistics.out_of_range << RESET_COLOR << endl;
+    } else {
+        FHEController controller(options.rescaling);
+
+        SortOutcome<FHEController> outcome = run_sorting(controller, options);
+
+        print_duration(start_time, "The sorting took:");
+
+        evaluate_sorting_accuracy(controller, options, outcome);
+        if (outcome.duplicates) evaluate_duplicates(controller, options, outcome);
+    }
+
+    if (options.trace_summary || options.memory_report || !options.trace_file.empty()) Tracer::instance().print_summary();
+    if (options.memory_report) cout << "Resident set at the end: " << Tracer::resident_bytes() / 1048576.0 << " MB" << endl;
+    if (!options.trace_file.empty()) Tracer::instance().write_chrome_trace(options.trace_file);
+
+}
+
+/*
+ * Builds the context, encrypts the input and sorts it with the selected method. The
+ * controller is either the FHE one or the cleartext one used by --dry-run
+ */
+template <class Controller>
+SortOutcome<Controller> run_sorting(Controller& controller, const SortOptions& options) {
+    using Ctxt = typename Controller::Ctxt;
+
+    SortOutcome<Controller> outcome;
+
+    int n = options.n;
+    double delta = options.delta;
+    const vector<double>& input_values = options.input_values;
+    int keys = 1 + options.secondary_keys.size();
+
+    if (options.method == PERMUTATION) {
+        // With --lanes 2 each half of the input is an independent list, the permutation-based sorting spans one
+        int list_size = n / options.lanes;
+
+        PermutationConfig config = permutation_config(list_size, delta, options.tieoffset, options.toy, options.verbose,
+                                                      options.comparator == SWITCH_COMPARATOR, keys, options.half_packing);
+        config.clean_permutation_matrix = options.clean_permutation_matrix;
+
+        outcome.circuit_depth = config.parameters.circuit_depth;
+        if (options.finalize) outcome.circuit_depth += PermutationSorting<Controller>::FINALIZATION_LEVELS;
+
+        cout << setprecision(config.parameters.precision_digits) << fixed;
 
-        controller.generate_context_permutation(n * n, circuit_depth, toy, n, delta);
+        if (options.verbose) cout << "Circuit depth: " << outcome.circuit_depth << endl;
+
+        if (options.verbose) cout << endl << "Ciphertext: " << endl << input_values << endl << endl << "δ: " << delta << ", ";
+
+        controller.generate_context_permutation(list_size * list_size, outcome.circuit_depth, options.toy, list_size, delta);
 
         Ctxt c = controller.encrypt(input_values, 0, input_values.size());
 
-        Ptxt p = controller.decrypt(c);
+        auto p = controller.decrypt(c);
+
+        controller.generate_rotation_keys_permutation(list_size);
+        if (config.scheme_switching) controller.generate_scheme_switching_keys(list_size * list_size, options.toy);
+
+        PermutationSorting sorting(controller, config);
+
+        if (options.lanes > 1) {
+            vector<double> first(input_values.begin(), input_values.begin() + list_size);
+            vector<double> second(input_values.begin() + list_size, input_values.end());
+            auto slots = sorting.half_diagonal_slots(first, second, list_size);
+
+            int slots_count = list_size * list_size;
+            for (int index : sorting.half_packing_rotations()) controller.generate_rotation_key(index);
+
+            auto sorted = sorting.sort_packed(controller.encrypt(slots.first, 0, slots_count),
+                                              controller.encrypt(slots.second, 0, slots_count),
+                                              controller.encrypt_repeated(first, 0, slots_count, list_size),
+                                              controller.encrypt_repeated(second, 0, slots_count, list_size));
+
+            outcome.result = sorted.first;
+            outcome.lanes = {sorted.second};
+
+            if (options.finalize) {
+                for (int index : sorting.selection_rotations()) controller.generate_rotation_key(index);
 
-        for (int i = 0; i < log2(n); i++) {
-            controller.generate_rotation_key(pow(2, i) * n);
-            controller.generate_rotation_key(pow(2, i));
+                outcome.result = sorting.finalize(outcome.result);
+                outcome.lanes[0] = sorting.finalize(outcome.lanes[0]);
+            }
+
+            return outcome;
         }
 
         Ctxt in_exp = controller.encrypt_expanded(input_values, 0, n*n, n);
         Ctxt in_rep = controller.encrypt_repeated(input_values, 0, n*n, n);
 
-        PermutationSorting sorting =
-                PermutationSorting(controller, sigmoid_scaling, degree_sigmoid, degree_sinc, tieoffset, n, delta, toy, verbose, clean_permutation_matrix);
+        if (options.ranks_only) {
+            outcome.result = sorting.rank(in_exp, in_rep);
+        } else if (!options.quantiles.empty()) {
+            for (int index : sorting.selection_rotations()) controller.generate_rotation_key(index);
+
+            outcome.result = sorting.select(in_exp, in_rep, quantile_ranks(options.quantiles, n));
+        } else if (options.duplicates) {
+            auto sorted = sorting.sort_with_duplicates(in_exp, in_rep);
+
+            outcome.result = sorted.first;
+            outcome.duplicates = sorted.second;
+        } else if (keys > 1 && options.half_packing) {
+            vector<vector<double>> columns = {input_values};
+            columns.insert(columns.end(), options.secondary_keys.begin(), options.secondary_keys.end());
+
+            vector<Ctxt> pairs_left, pairs_right, keys_rep = {in_rep};
+
+            for (int k = 0; k < keys; k += 2) {
+                auto slots = sorting.half_diagonal_slots(columns[k], columns[min(k + 1, keys - 1)], n);
+
+                pairs_left.push_back(controller.encrypt(slots.first, 0, n*n));
+                pairs_right.push_back(controller.encrypt(slots.second, 0, n*n));
+            }
+            for (int k = 1; k < keys; k++) keys_rep.push_back(controller.encrypt_repeated(columns[k], 0, n*n, n));
+
+            for (int index : sorting.half_packing_rotations()) controller.generate_rotation_key(index);
+
+            vector<Ctxt> sorted = sorting.sort_lexicographic_packed(pairs_left, pairs_right, keys_rep);
+
+            outcome.result = sorted[0];
+            outcome.secondary_keys.assign(sorted.begin() + 1, sorted.end());
+        } else if (keys > 1) {
+            vector<Ctxt> keys_exp = {in_exp}, keys_rep = {in_rep};
+
+            for (const vector<double>& key : options.secondary_keys) {
+                keys_exp.push_back(controller.encrypt_expanded(key, 0, n*n, n));
+                keys_rep.push_back(controller.encrypt_repeated(key, 0, n*n, n));
+            }
+
+            vector<Ctxt> sorted = sorting.sort_lexicographic(keys_exp, keys_rep);
+
+            outcome.result = sorted[0];
+            outcome.secondary_keys.assign(sorted.begin() + 1, sorted.end());
+        } else {
+            outcome.result = sorting.sort(in_exp, in_rep);
+        }
+
+        if (options.finalize) {
+            for (int index : sorting.selection_rotations()) controller.generate_rotation_key(index);
+
+            outcome.result = sorting.finalize(outcome.result);
+        }
+
+    } else if (options.method == NETWORK) {
+        // Each lane is an independent list: the network only spans n / lanes values
+        NetworkConfig config = network_config(n / options.lanes, delta, options.toy, options.verbose, options.comparator, keys);
+        config.lanes = options.lanes;
+        config.checkpoint_directory = options.checkpoint_directory;
+        config.checkpoint_interval = options.checkpoint_interval;
+        config.truncated_stages = network_truncation(config.n, options.max_displacement);
+        apply_relu_options(config.parameters, options, config.n);
+
+        if (options.max_displacement > 0) {
+            cout << "Approximate sort: " << config.truncated_stages << " of " << network_plan(config.n).sorting_layers(config.n)
+                 << " layers skipped, displacement at most " << (1 << config.truncated_stages) - 1 << endl;
+        }
+
+        if (options.verbose) {
+            cout << "Comparator: " << to_string(config.parameters.comparator);
+            if (config.parameters.comparator == SIGN_COMPARATOR) {
+                const CompositeSign& sign = config.parameters.sign;
+                cout << " (" << sign.g_iterations << " × g" << sign.g_degree << ", " << sign.f_iterations << " × f" << sign.f_degree
+                     << ", " << sign.levels() << " levels, " << sign.products() << " products)";
+            }
+            cout << endl;
+        }
+
+        outcome.input_scale = config.parameters.input_scale;
 
-        result = sorting.sort(in_exp, in_rep);
+        cout << setprecision(config.parameters.precision_digits) << fixed;
 
-    } else if (sortingType == NETWORK) {
-        set_network_parameters(n, delta);
+        if (options.verbose) cout << endl << "Ciphertext: " << endl << input_values << endl << endl << "δ: " << delta << ", n: " << n << endl;
 
-        cout << setprecision(precision_digits) << fixed;
+        int levels_consumption = network_layer_levels(config.parameters);
 
-        if (verbose) cout << endl << "Ciphertext: " << endl << input_values << endl << endl << "δ: " << delta << ", n: " << n << endl;
+        NetworkSorting sorting(controller, config);
 
-        // Levels required by max(0, x) approximation
-        int levels_consumption = poly_evaluation_cost(relu_degree);
+        if (options.resume) {
+            // The checkpoints are encrypted under the keys of the interrupted run
+            outcome.circuit_depth = controller.load_keys(options.checkpoint_directory);
+            if (!options.offload_directory.empty()) offload_rotation_keys(controller, options.offload_directory);
 
-        // One more level for the masking operation
-        levels_consumption += 1;
+            outcome.result = sorting.resume();
+            if (options.finalize) outcome.result = sorting.finalize(outcome.result);
 
-        circuit_depth = controller.generate_context_network(n, levels_consumption, toy, delta);
+            return outcome;
+        }
+
+        outcome.circuit_depth = controller.generate_context_network(n, levels_consumption, options.toy, delta);
         controller.generate_rotation_keys_network(n);
+        if (config.parameters.comparator == SWITCH_COMPARATOR) controller.generate_scheme_switching_keys(n, options.toy);
 
-        for (std::size_t i = 0; i < input_values.size(); i++) {
-            input_values[i] *= input_scale;
+        if (!options.checkpoint_directory.empty()) {
+            filesystem::create_directories(options.checkpoint_directory);
+            controller.save_keys(options.checkpoint_directory);
         }
 
-        Ctxt in = controller.encrypt(input_values, circuit_depth - levels_consumption - 3, n);
+        if (!options.offload_directory.empty()) offload_rotation_keys(controller, options.offload_directory);
 
-        NetworkSorting sorting =
-                NetworkSorting(controller, n, relu_degree, verbose);
+        vector<double> scaled_values(input_values);
+        for (double& v : scaled_values) v *= outcome.input_scale;
 
-        result = sorting.sort(in);
-    }
+        Ctxt in = controller.encrypt(scaled_values, outcome.circuit_depth - levels_consumption - 3, n);
+
+        if (keys > 1) {
+            vector<Ctxt> encrypted_keys = {in};
+
+            for (vector<double> key : options.secondary_keys) {
+                for (double& v : key) v *= outcome.input_scale;
+                encrypted_keys.push_back(controller.encrypt(key, outcome.circuit_depth - levels_consumption - 3, n));
+            }
+
+            vector<Ctxt> sorted = sorting.sort_lexicographic(encrypted_keys);
+
+            outcome.result = sorted[0];
+            outcome.secondary_keys.assign(sorted.begin() + 1, sorted.end());
+        } else {
+            outcome.result = sorting.sort(in);
+        }
+
+        if (options.finalize) outcome.result = sorting.finalize(outcome.result);
+    } else if (options.method == COUNTING) {
+        CountingConfig config = counting_config(n, delta, options.toy, options.verbose);
+        const CountingParameters& parameters = config.parameters;
+
+        outcome.circuit_depth = parameters.circuit_depth;
+
+        cout << setprecision(parameters.precision_digits) << fixed;
+
+        if (options.verbose) {
+            cout << "Buckets: " << parameters.buckets << ", slots: " << parameters.slots << ", circuit depth: "
+                 << outcome.circuit_depth << endl;
+        }
 
-    print_duration(start_time, "The sorting took:");
+        // A leveled context, as the permutation-based one: nothing is bootstrapped
+        controller.generate_context_permutation(parameters.slots, outcome.circuit_depth, options.toy, n, delta);
+        controller.generate_rotation_keys_network(parameters.slots);
 
-    evaluate_sorting_accuracy(result);
+        Ctxt in = controller.encrypt_repeated(input_values, 0, parameters.slots, parameters.slots / (2 * n));
 
+        CountingSorting sorting(controller, config);
+        outcome.result = sorting.sort(in);
+    }
+
+    return outcome;
 }
 
 
-void evaluate_sorting_accuracy(const Ctxt& result) {
-    cout << endl << "Final level: " << result->GetLevel() << "/" << circuit_depth << endl;
+template <class Controller>
+void evaluate_sorting_accuracy(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome) {
+    if (options.ranks_only || !options.quantiles.empty()) {
+        evaluate_selection_accuracy(controller, options, outcome);
+        return;
+    }
+
+    if (!outcome.secondary_keys.empty()) {
+        evaluate_lexicographic_accuracy(controller, options, outcome);
+        return;
+    }
+
+    int n = options.n;
+    double delta = options.delta;
+
+    cout << endl << "Final level: " << outcome.result->GetLevel() << "/" << outcome.circuit_depth << endl;
 
-    vector<double> sorted_fhe = controller.decode(controller.decrypt(result));
+    vector<double> sorted_fhe = controller.decode(controller.decrypt(outcome.result));
 
     vector<double> results_fhe;
 
-    if (sortingType == PERMUTATION) {
-        for (int i = 0; i < n * n; i += n) {
-            results_fhe.push_back(sorted_fhe[i] / input_scale);
+    if (options.finalize) cout << "Finalized result: " << outcome.result->GetSlots() << " slots" << endl;
+
+    if (options.method == PERMUTATION) {
+        // Every list comes in its own ciphertext, its values every list_size slots unless finalized
+        int list_size = n / options.lanes;
+        vector<vector<double>> lists = {sorted_fhe};
+        for (const auto& lane : outcome.lanes) lists.push_back(controller.decode(controller.decrypt(lane)));
+
+        for (const vector<double>& list : lists) {
+            for (int i = 0; i < list_size; i++) {
+                results_fhe.push_back(list[options.finalize ? i : i * list_size]);
+            }
         }
-    } else if (sortingType == NETWORK){
-        for (int i = 0; i < n; i += 1) {
-            results_fhe.push_back(sorted_fhe[i]);
+    } else if (options.method == COUNTING) {
+        results_fhe.assign(sorted_fhe.begin(), sorted_fhe.begin() + n);
+    } else if (options.method == NETWORK){
+        sorted_fhe.resize(n);
+
+        for (const vector<double>& list : NetworkSorting<Controller>::unpack_lanes(sorted_fhe, n / options.lanes, options.lanes)) {
+            results_fhe.insert(results_fhe.end(), list.begin(), list.end());
         }
     }
 
-    sort(input_values.begin(), input_values.end());
+    // The network-based sorting works on scaled inputs, so it is compared against them
+    vector<double> expected(options.input_values);
+    for (double& v : expected) v *= outcome.input_scale;
+
+    // Every lane is sorted on its own
+    int list_size = n / options.lanes;
+    for (int lane = 0; lane < options.lanes; lane++) {
+        sort(expected.begin() + lane * list_size, expected.begin() + (lane + 1) * list_size);
+    }
 
-    if (verbose) cout << endl << "Expected:  " << input_values << endl;
-    if (verbose) cout << endl << "Obtained:  " << results_fhe << endl << endl;
+    if (options.verbose) cout << endl << "Expected:  " << expected << endl;
+    if (options.verbose) cout << endl << "Obtained:  " << results_fhe << endl << endl;
 
     int corrects = 0;
 
     for (int i = 0; i < n; i++) {
-        if (abs(input_values[i] - results_fhe[i]) < delta) corrects++;
+        if (abs(expected[i] - results_fhe[i]) < delta) corrects++;
     }
     cout << "Corrects (up to " << delta << "): " << GREEN_TEXT << corrects << RESET_COLOR "/" << GREEN_TEXT << n <<RESET_COLOR<< endl;
 
-    cout << "Precision bits: " << GREEN_TEXT << precision_bits(input_values, results_fhe) << RESET_COLOR << endl;
+    // How far from sorted, lane by lane: the measure of an approximate sort
+    Sortedness total;
+    for (int lane = 0; lane < options.lanes; lane++) {
+        Sortedness lane_sortedness = sortedness(vector<double>(expected.begin() + lane * list_size, expected.begin() + (lane + 1) * list_size),
+                                                vector<double>(results_fhe.begin() + lane * list_size, results_fhe.begin() + (lane + 1) * list_size),
+                                                delta);
+
+        total.max_displacement = max(total.max_displacement, lane_sortedness.max_displacement);
+        total.inversions += lane_sortedness.inversions;
+    }
+    cout << "Max displacement (up to " << delta << "): " << total.max_displacement << ", inversions: " << total.inversions << endl;
+
+    cout << "Precision bits: " << GREEN_TEXT << precision_bits(expected, results_fhe) << RESET_COLOR << endl;
 }
 
-void set_permutation_parameters(int n, double d) {
-    int partial_depth = 0;
-
-    if (d == 0.1) {
-        precision_digits = 1;
-        sigmoid_scaling = 650;
-        degree_sigmoid = 1006;
-        partial_depth = 10;
-
-    } else if (d == 0.01) {
-        precision_digits = 2;
-        sigmoid_scaling = 360;
-        degree_sigmoid = 495;
-        partial_depth = 9;
-        partial_depth += 4; // Metto due clean
-
-    } else if (d == 0.001) {
-        precision_digits = 3;
-        sigmoid_scaling = 2400;
-        degree_sigmoid = 2031;
-        partial_depth = 11;
-        partial_depth += 6; // Metto tre clean
-
-    } else if (d == 0.0001) {
-        precision_digits = 4;
-        sigmoid_scaling = 3500;
-        degree_sigmoid = 4030;
-        partial_depth = 12;
-        partial_depth += 14; // Metto sette clean
+/*
+ * --low-memory: only the bootstrapping keys stay resident, the rotation keys are loaded layer by layer
+ */
+template <class Controller>
+void offload_rotation_keys(Controller& controller, const string& directory) {
+    filesystem::create_directories(directory);
 
+    if constexpr (is_same_v<Controller, FHEController>) {
+        uint64_t before = Tracer::resident_bytes();
+        controller.offload_rotation_keys(directory);
 
-    } else {
-        cerr << "The required min distance '" << d << "' is too small!" << endl;
+        cout << "Rotation keys offloaded to " << directory << ": resident set " << before / 1048576.0 << " -> "
+             << Tracer::resident_bytes() / 1048576.0 << " MB" << endl;
     }
+}
 
-    if (tieoffset) partial_depth += 2; //Tieoffset derivative
+/*
+ * The ReLU degrees given by --relu, --relu-schedule or searched by --tune-relu, for lists of n values
+ */
+void apply_relu_options(NetworkParameters& parameters, const SortOptions& options, int n) {
+    if (parameters.comparator != RELU_COMPARATOR) return;
 
-    cout << setprecision(precision_digits) << fixed;
+    if (options.relu_degree > 0) parameters.relu_degree = options.relu_degree;
+    if (!options.relu_schedule.empty()) parameters.relu_schedule = options.relu_schedule;
 
-    if (n <= 8) {
-        degree_sinc = 59;
-        partial_depth += 6;
+    if (options.tune_relu) {
+        auto start_time = steady_clock::now();
 
+        NetworkParameters tuned = search_relu_schedule(n, options.delta, 8, 0, max(options.seed, 0));
+        parameters.relu_degree = tuned.relu_degree;
+        parameters.relu_schedule = tuned.relu_schedule;
 
-        if (delta == 0.0001) {
-            degree_sinc = 247;
-            partial_depth += 2;
-        }
-    } else if (n == 16) {
-        degree_sinc = 119;
-        partial_depth += 7;
+        print_duration(start_time, "The ReLU degree search took:");
+    }
+
+    if (!parameters.relu_schedule.empty()) {
+        cout << "ReLU degree of each layer: " << parameters.relu_schedule << endl;
+    }
+}
+
+/*
+ * Checks the output of --ranks (the rank of every value) or of --quantiles (the selected values)
+ */
+template <class Controller>
+void evaluate_selection_accuracy(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome) {
+    int n = options.n;
+    const vector<double>& values = options.input_values;
+
+    cout << endl << "Final level: " << outcome.result->GetLevel() << "/" << outcome.circuit_depth << endl;
 
-        if (delta == 0.0001) {
-            degree_sinc = 495;
-            partial_depth += 3;
+    vector<double> slots = controller.decode(controller.decrypt(outcome.result));
+
+    vector<double> expected, obtained;
+    double tolerance = options.delta;
+
+    if (options.ranks_only) {
+        // Ties are ranked in input order, as the tie-offset does
+        for (int j = 0; j < n; j++) {
+            int rank = 0;
+            for (int i = 0; i < n; i++) {
+                if (values[i] < values[j] || (values[i] == values[j] && i < j)) rank++;
+            }
+
+            expected.push_back(rank);
+            obtained.push_back(slots[j] * n);
         }
-    } else if (n == 32) {
-        degree_sinc = 247;
-        partial_depth += 8;
 
-        partial_depth += 2; //One clean
+        tolerance = 0.5;
+    } else {
+        vector<double> sorted_values(values);
+        sort(sorted_values.begin(), sorted_values.end());
 
-        if (delta == 0.0001) {
-            degree_sinc = 495;
-            partial_depth += 2;
+        vector<int> ranks = quantile_ranks(options.quantiles, n);
+        for (size_t r = 0; r < ranks.size(); r++) {
+            expected.push_back(sorted_values[ranks[r]]);
+            obtained.push_back(slots[r]);
         }
-    } else if (n == 64) {
-        degree_sinc = 495;
-        partial_depth += 9;
+    }
 
-        partial_depth += 2; //One clean
+    if (options.verbose) cout << endl << "Expected:  " << expected << endl;
+    if (options.verbose) cout << endl << "Obtained:  " << obtained << endl << endl;
+
+    int corrects = 0;
 
-    } else if (n == 128) {
-        degree_sinc = 495;
-        partial_depth += 9;
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (abs(expected[i] - obtained[i]) < tolerance) corrects++;
+    }
+    cout << "Corrects (up to " << tolerance << "): " << GREEN_TEXT << corrects << RESET_COLOR "/" << GREEN_TEXT << expected.size() << RESET_COLOR << endl;
 
-        partial_depth += 4; //Two clean
+    if (!options.ranks_only) cout << "Precision bits: " << GREEN_TEXT << precision_bits(expected, obtained) << RESET_COLOR << endl;
+}
 
-        if (delta == 0.0001) {
-            partial_depth += 2; //One clean
+/*
+ * Checks the output of --duplicates against the multiplicities, first occurrences and distinct
+ * count of the input
+ */
+template <class Controller>
+void evaluate_duplicates(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome) {
+    int n = options.n;
+    const vector<double>& values = options.input_values;
+    const auto& duplicates = *outcome.duplicates;
+
+    vector<double> multiplicity = controller.decode(controller.decrypt(duplicates.multiplicity));
+    vector<double> first = controller.decode(controller.decrypt(duplicates.first));
+    double distinct = controller.decode(controller.decrypt(duplicates.distinct))[0];
+
+    vector<double> expected_multiplicity, expected_first, obtained_multiplicity, obtained_first;
+    int expected_distinct = 0;
+
+    for (int j = 0; j < n; j++) {
+        int equal = 0, before = 0;
+        for (int i = 0; i < n; i++) {
+            if (values[i] == values[j]) equal++;
+            if (values[i] == values[j] && i < j) before++;
         }
+
+        expected_multiplicity.push_back(equal);
+        expected_first.push_back(before == 0 ? 1 : 0);
+        expected_distinct += before == 0;
+
+        obtained_multiplicity.push_back(multiplicity[j]);
+        obtained_first.push_back(first[j]);
+    }
+
+    cout << endl << "Duplicates, final level: " << duplicates.first->GetLevel() << "/" << outcome.circuit_depth << endl;
+
+    if (options.verbose) {
+        cout << endl << "Expected multiplicities:  " << expected_multiplicity << endl;
+        cout << "Obtained multiplicities:  " << obtained_multiplicity << endl;
+        cout << "Expected first occurrences:  " << expected_first << endl;
+        cout << "Obtained first occurrences:  " << obtained_first << endl << endl;
     }
 
-    input_scale = 1.0;
+    int multiplicity_corrects = 0, first_corrects = 0;
+
+    for (int j = 0; j < n; j++) {
+        if (abs(expected_multiplicity[j] - obtained_multiplicity[j]) < 0.5) multiplicity_corrects++;
+        if (abs(expected_first[j] - obtained_first[j]) < 0.5) first_corrects++;
+    }
+
+    cout << "Multiplicities (up to 0.5): " << GREEN_TEXT << multiplicity_corrects << RESET_COLOR "/" << GREEN_TEXT << n << RESET_COLOR << endl;
+    cout << "First occurrences (up to 0.5): " << GREEN_TEXT << first_corrects << RESET_COLOR "/" << GREEN_TEXT << n << RESET_COLOR << endl;
+    cout << "Distinct values: " << (abs(distinct - expected_distinct) < 0.5 ? GREEN_TEXT : RED_TEXT) << distinct
+         << RESET_COLOR << " (expected " << expected_distinct << ")" << endl;
+}
+
+/*
+ * Checks the output of --then-by: every key against the columns of the records, stably sorted by
+ * the primary key, then by the following ones
+ */
+template <class Controller>
+void evaluate_lexicographic_accuracy(Controller& controller, const SortOptions& options, const SortOutcome<Controller>& outcome) {
+    int n = options.n;
+    double delta = options.delta;
+
+    vector<vector<double>> columns = {options.input_values};
+    columns.insert(columns.end(), options.secondary_keys.begin(), options.secondary_keys.end());
+
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        for (const vector<double>& column : columns) {
+            if (column[a] != column[b]) return column[a] < column[b];
+        }
+        return false;
+    });
 
-    circuit_depth = partial_depth + 1; //For the last matrix mult
+    cout << endl << "Final level: " << outcome.result->GetLevel() << "/" << outcome.circuit_depth << endl;
 
-    if (verbose) cout << "Circuit depth: " << circuit_depth << endl;
+    vector<typename Controller::Ctxt> sorted = {outcome.result};
+    sorted.insert(sorted.end(), outcome.secondary_keys.begin(), outcome.secondary_keys.end());
 
+    int records_corrects = 0;
+    vector<bool> correct(n, true);
+
+    for (size_t k = 0; k < columns.size(); k++) {
+        vector<double> slots = controller.decode(controller.decrypt(sorted[k]));
+        vector<double> expected, obtained;
+
+        for (int i = 0; i < n; i++) {
+            // The permutation-based output is the first column of the n x n matrix
+            obtained.push_back(options.method == PERMUTATION ? slots[i * n] : slots[i]);
+            expected.push_back(columns[k][order[i]] * outcome.input_scale);
+
+            if (abs(expected[i] - obtained[i]) >= delta) correct[i] = false;
+        }
+
+        if (options.verbose) {
+            cout << endl << "Key " << k << ", expected:  " << expected << endl;
+            cout << "Key " << k << ", obtained:  " << obtained << endl;
+        }
+
+        cout << "Key " << k << " precision bits: " << GREEN_TEXT << precision_bits(expected, obtained) << RESET_COLOR << endl;
+    }
+
+    for (int i = 0; i < n; i++) records_corrects += correct[i];
+
+    cout << "Records with every key correct (up to " << delta << "): " << GREEN_TEXT << records_corrects << RESET_COLOR "/"
+         << GREEN_TEXT << n << RESET_COLOR << endl;
 }
 
-void set_network_parameters(int n, double d) {
-    if (d >= 0.1) {
-        precision_digits = 1;
-        relu_degree = 119;
-    } else if (d >= 0.01) {
-        precision_digits = 2;
-        relu_degree = 351;
+/*
+ * The rank of each quantile among n values, the nearest one to q (n - 1)
+ */
+vector<int> quantile_ranks(const vector<double>& quantiles, int n) {
+    vector<int> ranks;
+
+    for (double q : quantiles) ranks.push_back((int) lround(min(max(q, 0.0), 1.0) * (n - 1)));
+
+    return ranks;
+}
 
-        if (n > 1024) {
-            relu_degree = 495;
+/*
+ * Sorts the input in runs of run_size values kept in external_directory, then decrypts the runs
+ * one at a time, writing them to the output file and checking their order
+ */
+template <class Controller>
+void run_external(Controller& controller, const SortOptions& options) {
+    ExternalConfig config = external_config(options.external_directory, options.run_size, options.delta, options.toy,
+                                            options.verbose, options.comparator);
+    apply_relu_options(config.network.parameters, options, config.run_size);
+    if (options.memory_limit_mb > 0) config.max_resident = resident_runs(options);
+
+    cout << setprecision(config.network.parameters.precision_digits) << fixed;
+
+    if (options.verbose) cout << "Run size: " << config.run_size << ", resident runs: " << config.max_resident << endl;
+
+    // Runs live in the first half of their ciphertexts, the merges use the second one
+    int circuit_depth = controller.generate_context_network(2 * config.run_size, network_layer_levels(config.network.parameters),
+                                                            options.toy, options.delta);
+    controller.generate_rotation_keys_network(2 * config.run_size);
+    if (options.comparator == SWITCH_COMPARATOR) controller.generate_scheme_switching_keys(2 * config.run_size, options.toy);
+
+    ExternalSorting sorting(controller, config, circuit_depth);
+
+    if (!options.input_file.empty()) {
+        ifstream input(options.input_file);
+        if (!input) {
+            cerr << "Could not find \"" << options.input_file << "\"" << endl;
+            return;
         }
 
-    } else if (d >= 0.001) {
-        precision_digits = 3;
-        relu_degree = 495;
+        sorting.generate_runs(input);
     } else {
-        cerr << "The required min distance '" << d << "' is too small!" << endl;
+        ostringstream values;
+        for (double v : options.input_values) values << v << " ";
+
+        istringstream input(values.str());
+        sorting.generate_runs(input);
     }
 
-    input_scale = 0.95;
+    cout << "Runs: " << sorting.run_count() << " of " << config.run_size << " values" << endl;
+
+    sorting.merge_runs();
+
+    ofstream output;
+    if (!options.output_file.empty()) output.open(options.output_file);
+
+    // Only the first value_count() values are the input, the rest is padding
+    vector<double> expected(options.input_values);
+    sort(expected.begin(), expected.end());
+
+    long written = 0, out_of_order = 0, corrects = 0;
+    double previous = -1;
+
+    for (int run = 0; run < sorting.run_count() && written < sorting.value_count(); run++) {
+        for (double v : sorting.read_run(run)) {
+            if (written == sorting.value_count()) break;
+
+            if (v < previous - options.delta / 2) out_of_order++;
+            if (written < (long) expected.size() && abs(expected[written] - v) < options.delta) corrects++;
+
+            if (output.is_open()) output << v << endl;
+
+            previous = v;
+            written++;
+        }
+    }
+
+    cout << "Values: " << written << ", out of order: " << (out_of_order == 0 ? GREEN_TEXT : RED_TEXT) << out_of_order << RESET_COLOR << endl;
+    if (!expected.empty()) cout << "Corrects (up to " << options.delta << "): " << GREEN_TEXT << corrects << RESET_COLOR "/" << GREEN_TEXT << written << RESET_COLOR << endl;
+
+    sorting.remove_runs();
 }
 
-void read_arguments(int argc, char *argv[]) {
+/*
+ * How many run ciphertexts fit --memory-limit, next to the keys and the working set of a merge
+ */
+int resident_runs(const SortOptions& options) {
+    CostEstimate estimate = estimate_sort(NETWORK, 2 * options.run_size, options.delta, false, options.toy,
+                                          CostCalibration(), options.comparator, options.rescaling);
+
+    double ciphertext_bytes = 2.0 * (estimate.depth + 1) * estimate.ring_dim * sizeof(uint64_t);
+    double available = options.memory_limit_mb * 1048576.0 - estimate.key_bytes - estimate.peak_data_bytes;
+
+    return max(2, 2 + (int) (available / ciphertext_bytes));
+}
+
+SortOptions read_arguments(int argc, char *argv[]) {
+    SortOptions options;
+
     if (argc == 1) {
         cerr << "Usage: ./Sort [input] [sorting mode] [options]\n"
                 "\n"
@@ -289,6 +920,9 @@ void read_arguments(int argc, char *argv[]) {
                 "Required Sorting Mode (choose ONE):\n"
                 "  --network                 Use network-based sorting\n"
                 "  --permutation             Use permutation-based sorting\n"
+                "  --counting                Use counting-based sorting, for values on the grid of step δ (at most\n"
+                "                            128 points)\n"
+                "  --auto                    Use the method with the lowest predicted latency\n"
                 "\n"
                 "Optional Flags:\n"
                 "  --toy                     Enable toy mode\n"
@@ -296,6 +930,61 @@ void read_arguments(int argc, char *argv[]) {
                 "  --tieoffset               Apply tie-offset adjustment\n"
                 "  --delta <value>           Manually set the delta (value spacing)\n"
                 "  --relu <degree>           Set ReLU degree (integer parameter)\n"
+                "  --relu-schedule <d1,d2,...>\n"
+                "                            Network-based sorting: the ReLU degree of each layer (the later ones use --relu)\n"
+                "  --tune-relu               Network-based sorting: search the lowest ReLU degree of each layer by dry runs\n"
+                "  --comparator <relu|sign|switch>\n"
+                "                            Network-based comparator: one ReLU approximation (default), a composition\n"
+                "                            of low-degree sign polynomials tuned for δ, or exact comparisons in FHEW by\n"
+                "                            scheme switching (switch also applies to the permutation-based sorting)\n"
+                "  --rescaling <auto|autoext|manual>\n"
+                "                            Scaling technique: FLEXIBLEAUTO (default), FLEXIBLEAUTOEXT, or FIXEDMANUAL\n"
+                "                            with the rescalings placed only where an operation requires them\n"
+                "  --lanes <k>               Network-based sorting: sort the input as <k> independent lists of\n"
+                "                            n/k values packed in one ciphertext, sharing every bootstrapping\n"
+                "                            (--lanes 2 with --permutation --half-packing: two lists sharing a sigmoid)\n"
+                "  --ranks                   Permutation-based sorting: output the encrypted rank of every value instead\n"
+                "  --quantiles <q1,q2,...>   Permutation-based sorting: output only the values at these quantiles in [0, 1]\n"
+                "  --median                  Same as --quantiles 0.5\n"
+                "  --duplicates              Permutation-based sorting: also compute the multiplicity and the first\n"
+                "                            occurrence of every value and the number of distinct values (implies --tieoffset)\n"
+                "  --then-by <\"[a,b,...]\"|random>\n"
+                "                            Sort records lexicographically: the input is the primary key and every\n"
+                "                            --then-by adds a further key of n values (sign comparator with --network)\n"
+                "  --half-packing            With --permutation and --then-by or --lanes 2: compare the keys, or the two\n"
+                "                            lists, two by two, each in half of the slots, with one sigmoid per pair\n"
+                "                            (two more levels)\n"
+                "  --max-displacement <k>    Network-based sorting: approximate sort, each value within <k> positions of\n"
+                "                            its rank, skipping the last stages of the last round of the network\n"
+                "  --checkpoint <dir>        Network-based sorting: write the keys to <dir>, then the ciphertext after\n"
+                "                            the bootstrapping of every layer, in the background (<dir> holds the secret key)\n"
+                "  --checkpoint-every <k>    Checkpoint every <k> layers instead (default: 1)\n"
+                "  --resume                  Continue from the last checkpoint in the --checkpoint directory, with its keys\n"
+                "  --low-memory <dir>        Network-based sorting: keep the rotation keys in <dir>, loading only those\n"
+                "                            of the current layer and prefetching the next ones (implies --memory-report)\n"
+                "  --finalize                Return the sorted values densely packed, at the lowest modulus that keeps them\n"
+                "                            (smaller to send and faster to decrypt; two more levels with --permutation)\n"
+                "  --seed <value>            Seed of the random input generator (reproducible --random inputs)\n"
+                "  --threads <t>             Total thread budget (default: every available core)\n"
+                "  --task-threads <k>        Run up to <k> independent operations at once, each with <t>/<k> OpenFHE threads\n"
+                "  --pin                     Pin every thread to its own core\n"
+                "  --trace <file>            Export a Chrome/Perfetto trace of every FHE operation and print a summary\n"
+                "  --trace-summary           Print which operations and phases dominate the run\n"
+                "  --memory-report           Print the summary with the peak resident memory of every phase\n"
+                "  --dry-run                 Run the same circuit over cleartext slots (fast accuracy and depth check)\n"
+                "  --dry-run-noise <bits>    In a dry run, add a Gaussian error of 2^-bits after every operation\n"
+                "\n"
+                "External-memory sorting (network-based, inputs larger than a ciphertext):\n"
+                "  --external <dir>          Sort in runs written to <dir>, streaming the input file; requires --delta\n"
+                "  --run-size <n>            Values per run (a power of two, default 64)\n"
+                "  --memory-limit <MB>       Hold only the run ciphertexts that fit in <MB> next to the keys (default: 6)\n"
+                "  --output <file>           Write the sorted values, one per line\n"
+                "\n"
+                "Cost model:\n"
+                "  --estimate                Print the predicted operations, latency and memory, then exit\n"
+                "  --calibration <file>      Per-operation latencies of this machine (see Benchmark --calibrate)\n"
+                "  --max-seconds <s>         Refuse to sort if the predicted latency exceeds <s>\n"
+                "  --max-memory <MB>         Refuse to sort if the predicted memory exceeds <MB>\n"
                 "\n"
                 "Examples:\n"
                 "  ./program --random 8 --network\n"
@@ -307,7 +996,7 @@ void read_arguments(int argc, char *argv[]) {
                 "  - Exactly one input method and one sorting mode must be specified.\n"
                 "  - For --random, the number of values must be a power of two.\n"
                 "  - If reading from file, the file must contain space-, comma-, or newline-separated numbers." << endl;
-        return;
+        return options;
     }
 
     bool random_elements = false;
@@ -321,7 +1010,11 @@ void read_arguments(int argc, char *argv[]) {
             cerr << "The number of values must be a power of two" << endl;
         }
 
-        n = num_values;
+        options.n = num_values;
+
+    } else if (argc > 2 && string(argv[1]) == "--file" && find(argv, argv + argc, string("--external")) != argv + argc) {
+        // Streamed by the external sorting, which is given δ explicitly
+        options.input_file = argv[2];
 
     } else if (argc > 2 && string(argv[1]) == "--file") {
         ifstream f(argv[2]); //taking file as inputstream
@@ -333,11 +1026,11 @@ void read_arguments(int argc, char *argv[]) {
         } else {
             cout << "Could not find \"" << string(argv[2]) << "\"" << endl;
         }
-        input_values = parse_input_vector("[ " + str + " ]");
+        options.input_values = parse_input_vector("[ " + str + " ]");
 
-        n = input_values.size();
+        options.n = options.input_values.size();
 
-        vector<double> input_values_clone(input_values);
+        vector<double> input_values_clone(options.input_values);
         sort(input_values_clone.begin(), input_values_clone.end());
 
         double min_diff = 1.0;
@@ -349,26 +1042,26 @@ void read_arguments(int argc, char *argv[]) {
             }
         }
 
-        delta = min_diff;
+        options.delta = min_diff;
 
     }
     else if (argc > 2 && string(argv[1]) == "--inline" && string(argv[2]).front() == '[' && string(argv[2]).back() == ']') {
         try {
-            input_values = parse_input_vector(argv[2]);
-            n = input_values.size();
+            options.input_values = parse_input_vector(argv[2]);
+            options.n = options.input_values.size();
 
             double min_diff = 1.0;
 
-            for (std::size_t i = 1; i < input_values.size(); i++) {
-                double diff = input_values[i] - input_values[i - 1];
+            for (std::size_t i = 1; i < options.input_values.size(); i++) {
+                double diff = options.input_values[i] - options.input_values[i - 1];
                 if (abs(diff) < min_diff) {
                     min_diff = abs(diff);
                 }
             }
 
-            delta = min_diff;
+            options.delta = min_diff;
 
-            if (verbose) cout << "n: " << n << endl << "δ: " << delta << endl << endl;
+            if (options.verbose) cout << "n: " << options.n << endl << "δ: " << options.delta << endl << endl;
 
         } catch (...) {
             cerr << "A problem occured in parsing the input vector" << endl;
@@ -377,34 +1070,176 @@ void read_arguments(int argc, char *argv[]) {
 
     for (int i = 1; i < argc; i++) {
         if (string(argv[i]) == "--permutation") {
-            sortingType = PERMUTATION;
+            options.method = PERMUTATION;
         }
         if (string(argv[i]) == "--network") {
-            sortingType = NETWORK;
+            options.method = NETWORK;
+        }
+        if (string(argv[i]) == "--counting") {
+            options.method = COUNTING;
         }
         if (string(argv[i]) == "--toy") {
-            toy = true;
+            options.toy = true;
         }
         if (string(argv[i]) == "--verbose") {
-            verbose = true;
+            options.verbose = true;
         }
         if (string(argv[i]) == "--tieoffset") {
-            tieoffset = true;
+            options.tieoffset = true;
         }
         if (string(argv[i]) == "--delta") {
-            delta = stod(argv[i+1]);
+            options.delta = stod(argv[i+1]);
         }
         if (string(argv[i]) == "--relu") {
-            relu_degree = stoi(argv[i+1]);
+            options.relu_degree = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--relu-schedule") {
+            istringstream degrees(argv[i+1]);
+            string degree;
+            while (getline(degrees, degree, ',')) options.relu_schedule.push_back(stoi(degree));
+        }
+        if (string(argv[i]) == "--tune-relu") {
+            options.tune_relu = true;
+        }
+        if (string(argv[i]) == "--rescaling") {
+            options.rescaling = parse_rescaling(argv[i+1]);
+        }
+        if (string(argv[i]) == "--comparator") {
+            options.comparator = parse_comparator(argv[i+1]);
+        }
+        if (string(argv[i]) == "--lanes") {
+            options.lanes = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--seed") {
+            options.seed = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--trace") {
+            options.trace_file = argv[i+1];
+        }
+        if (string(argv[i]) == "--trace-summary") {
+            options.trace_summary = true;
+        }
+        if (string(argv[i]) == "--memory-report") {
+            options.memory_report = true;
+        }
+        if (string(argv[i]) == "--low-memory") {
+            options.offload_directory = argv[i+1];
+            options.memory_report = true;
+        }
+        if (string(argv[i]) == "--threads") {
+            options.threading.total_threads = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--task-threads") {
+            options.threading.task_threads = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--pin") {
+            options.threading.pin = true;
+        }
+        if (string(argv[i]) == "--auto") {
+            options.automatic_method = true;
+        }
+        if (string(argv[i]) == "--estimate") {
+            options.estimate_only = true;
+        }
+        if (string(argv[i]) == "--calibration") {
+            options.calibration_file = argv[i+1];
+        }
+        if (string(argv[i]) == "--max-seconds") {
+            options.max_seconds = stod(argv[i+1]);
+        }
+        if (string(argv[i]) == "--max-memory") {
+            options.max_memory_mb = stod(argv[i+1]);
+        }
+        if (string(argv[i]) == "--dry-run") {
+            options.dry_run = true;
+        }
+        if (string(argv[i]) == "--dry-run-noise") {
+            options.dry_run_noise = stod(argv[i+1]);
+        }
+        if (string(argv[i]) == "--external") {
+            options.external_directory = argv[i+1];
+        }
+        if (string(argv[i]) == "--run-size") {
+            options.run_size = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--memory-limit") {
+            options.memory_limit_mb = stod(argv[i+1]);
+        }
+        if (string(argv[i]) == "--output") {
+            options.output_file = argv[i+1];
+        }
+        if (string(argv[i]) == "--ranks") {
+            options.ranks_only = true;
+        }
+        if (string(argv[i]) == "--quantiles") {
+            // Any number of them: parse_input_vector only admits powers of two
+            istringstream quantiles(argv[i+1]);
+            string quantile;
+            while (getline(quantiles, quantile, ',')) options.quantiles.push_back(stod(quantile));
+        }
+        if (string(argv[i]) == "--finalize") {
+            options.finalize = true;
+        }
+        if (string(argv[i]) == "--duplicates") {
+            // The statistics come from the equality matrix of the tie-offset
+            options.duplicates = true;
+            options.tieoffset = true;
+        }
+        if (string(argv[i]) == "--then-by") {
+            options.then_by.push_back(argv[i+1]);
+        }
+        if (string(argv[i]) == "--half-packing") {
+            options.half_packing = true;
+        }
+        if (string(argv[i]) == "--checkpoint") {
+            options.checkpoint_directory = argv[i+1];
+        }
+        if (string(argv[i]) == "--max-displacement") {
+            options.max_displacement = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--checkpoint-every") {
+            options.checkpoint_interval = stoi(argv[i+1]);
+        }
+        if (string(argv[i]) == "--resume") {
+            options.resume = true;
+        }
+        if (string(argv[i]) == "--median") {
+            options.quantiles = {0.5};
         }
         if (string(argv[i]) == "--clean_permutation_matrix") {
-            clean_permutation_matrix = true;
+            options.clean_permutation_matrix = true;
         }
 
     }
 
     if (random_elements) {
-        input_values = generate_close_randoms(n, delta);
+        options.input_values = generate_close_randoms(options.n, options.delta, options.seed);
+
+        // A primary key of about n / 4 distinct values, so that the further keys decide some records
+        if (!options.then_by.empty()) {
+            int distinct = max(1, options.n / 4);
+            for (int i = distinct; i < options.n; i++) options.input_values[i] = options.input_values[i % distinct];
+
+            mt19937 gen(options.seed < 0 ? random_device{}() : static_cast<unsigned int>(options.seed));
+            shuffle(options.input_values.begin(), options.input_values.end(), gen);
+        }
     }
-}
 
+    for (size_t k = 0; k < options.then_by.size(); k++) {
+        const string& key = options.then_by[k];
+        int seed = options.seed < 0 ? -1 : options.seed + (int) k + 1;
+
+        vector<double> values = key == "random" ? generate_close_randoms(options.n, options.delta, seed) : parse_input_vector(key);
+
+        if ((int) values.size() != options.n) {
+            cerr << "Every --then-by key must have the " << options.n << " values of the input" << endl;
+            continue;
+        }
+
+        options.secondary_keys.push_back(values);
+    }
+
+    if (options.run_size == 0) options.run_size = random_elements ? min(options.n, 64) : 64;
+
+    return options;
+}
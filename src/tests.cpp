@@ -0,0 +1,686 @@
+#include "PlainController.h"
+#include "PermutationSorting.h"
+#include "NetworkSorting.h"
+#include "CountingSorting.h"
+#include "SortingParameters.h"
+#include "SortingPlan.h"
+#include "ExternalSorting.h"
+
+#include <filesystem>
+#include <numeric>
+
+/*
+ * Checks of the sorting circuits, all run in cleartext by PlainController: no key is generated, so
+ * the whole suite takes seconds. Every check prints a line, the failed ones in red, and the exit
+ * status is the number of failures (as CTest expects)
+ */
+
+int failures = 0;
+
+void check(bool condition, const string& what) {
+    if (!condition) failures++;
+
+    cout << (condition ? GREEN_TEXT "ok      " : RED_TEXT "FAILED  ") << RESET_COLOR << what << endl;
+}
+
+// Whether every value is within `tolerance` of the expected one (NaNs are not)
+bool close(const vector<double>& expected, const vector<double>& obtained, double tolerance) {
+    if (obtained.size() < expected.size()) return false;
+
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (!(abs(expected[i] - obtained[i]) < tolerance)) return false;
+    }
+
+    return true;
+}
+
+vector<double> sorted_copy(vector<double> values) {
+    sort(values.begin(), values.end());
+    return values;
+}
+
+/*
+ * A network-based sort through PlainController, set up as Sort does: the input scaled and
+ * encrypted at the level that leaves the depth of a layer
+ */
+vector<double> network_sort(const NetworkConfig& config, const vector<double>& values) {
+    PlainController plain;
+    int slots = values.size();
+    int levels = network_layer_levels(config.parameters);
+    int depth = plain.generate_context_network(slots, levels, true, config.delta);
+
+    vector<double> scaled(values);
+    for (double& v : scaled) v *= config.parameters.input_scale;
+
+    NetworkSorting sorting(plain, config);
+    vector<double> sorted = plain.decode(plain.decrypt(sorting.sort(plain.encrypt(scaled, depth - levels - 3, slots))));
+
+    for (double& v : sorted) v /= config.parameters.input_scale;
+    sorted.resize(slots);
+
+    return sorted;
+}
+
+/*
+ * A permutation-based sort through PlainController, as Sort sets it up
+ */
+struct PermutationRun {
+    PlainController plain;
+    PermutationConfig config;
+    PlainController::Ctxt in_exp, in_rep;
+
+    PermutationRun(const vector<double>& values, double delta, bool tieoffset, int extra_levels = 0, int keys = 1,
+                   bool half_packing = false, bool scheme_switching = false) {
+        int n = values.size();
+
+        config = permutation_config(n, delta, tieoffset, true, false, scheme_switching, keys, half_packing);
+        plain.generate_context_permutation(n * n, config.parameters.circuit_depth + extra_levels, true, n, delta);
+
+        in_exp = plain.encrypt_expanded(values, 0, n * n, n);
+        in_rep = plain.encrypt_repeated(values, 0, n * n, n);
+    }
+
+    vector<double> decrypt(const PlainController::Ctxt& c) { return plain.decode(plain.decrypt(c)); }
+};
+
+void test_composite_sign() {
+    int n = 16;
+    double delta = 0.01;
+    NetworkConfig config = network_config(n, delta, true, false, SIGN_COMPARATOR);
+    const CompositeSign& sign = config.parameters.sign;
+
+    // Differences from δ (scaled as the inputs) to 1, log-spaced, on both sides of zero
+    double min_difference = delta * config.parameters.input_scale;
+    int samples = 1024;
+    vector<double> points;
+    for (int i = 0; i <= samples; i++) points.push_back(min_difference * pow(1 / min_difference, (double) i / samples));
+    for (int i = 0; i <= samples; i++) points.push_back(-points[i]);
+
+    PlainController plain;
+    plain.generate_context_network(points.size(), sign.levels(), true, delta);
+
+    PlainController::Ctxt result = plain.composite_sign(plain.encrypt(points), sign);
+    vector<double> signs = plain.decode(plain.decrypt(result));
+
+    // The error on min(a, b) of composite_sign_parameters, with one bit of slack off its samples
+    double error = 0;
+    for (size_t i = 0; i < points.size(); i++) error = max(error, abs(points[i]) * abs((points[i] > 0 ? 1 : -1) - signs[i]) / 2);
+
+    check(error <= pow(2, -ceil(-log2(delta)) - 3) && (int) result->GetLevel() == sign.levels(),
+          "composite_sign approximates the sign down to δ, in CompositeSign::levels()");
+
+    vector<double> values = generate_close_randoms(n, delta, 9);
+    check(close(sorted_copy(values), network_sort(config, values), delta), "--comparator sign sorts");
+}
+
+void test_lanes() {
+    double delta = 0.01;
+
+    for (int lanes : {2, 4}) {
+        int n = 16;
+        vector<vector<double>> lists;
+        for (int lane = 0; lane < lanes; lane++) lists.push_back(generate_close_randoms(n, delta, lane));
+
+        vector<double> slots = NetworkSorting<PlainController>::pack_lanes(lists);
+        check((int) slots.size() == n * lanes && equal(lists[1].begin(), lists[1].end(), slots.begin() + n),
+              "pack_lanes lays " + to_string(lanes) + " lists side by side");
+
+        NetworkConfig config = network_config(n, delta, true);
+        config.lanes = lanes;
+
+        vector<vector<double>> sorted = NetworkSorting<PlainController>::unpack_lanes(network_sort(config, slots), n, lanes);
+
+        bool every_lane = (int) sorted.size() == lanes;
+        for (int lane = 0; lane < lanes && every_lane; lane++) every_lane = close(sorted_copy(lists[lane]), sorted[lane], delta);
+
+        check(every_lane, "--lanes " + to_string(lanes) + ": unpack_lanes returns every list sorted on its own");
+    }
+}
+
+void test_external() {
+    int run_size = 8;
+    double delta = 0.01;
+
+    // 5 runs, padded to 8; with max_resident < 4 the runs are written in the foreground
+    for (int max_resident : {6, 2}) {
+        vector<double> values = generate_close_randoms(5 * run_size - 3, delta, 10);
+
+        string directory = (filesystem::temp_directory_path() / "sorting-tests-external").string();
+        filesystem::remove_all(directory);
+
+        ExternalConfig config = external_config(directory, run_size, delta, true);
+        config.max_resident = max_resident;
+
+        PlainController plain;
+        int depth = plain.generate_context_network(2 * run_size, network_layer_levels(config.network.parameters), true, delta);
+
+        ExternalSorting sorting(plain, config, depth);
+
+        ostringstream text;
+        for (double v : values) text << v << " ";
+        istringstream input(text.str());
+        sorting.generate_runs(input);
+
+        // Even runs ascending in the first half of the slots, odd ones descending in the second half
+        bool alternating = sorting.run_count() == 8 && sorting.value_count() == (long) values.size();
+
+        for (int run = 0; run < sorting.run_count() && alternating; run++) {
+            vector<double> slots = plain.decode(plain.decrypt(plain.load(directory + "/run-" + to_string(run) + ".bin")));
+            int first = run % 2 == 0 ? 0 : run_size;
+
+            for (int i = 0; i < 2 * run_size && alternating; i++) {
+                bool inside = i >= first && i < first + run_size;
+                if (!inside) alternating = abs(slots[i]) < delta;
+            }
+
+            for (int i = first + 1; i < first + run_size && alternating; i++) {
+                alternating = run % 2 == 0 ? slots[i] >= slots[i - 1] - delta / 2 : slots[i] <= slots[i - 1] + delta / 2;
+            }
+        }
+
+        check(alternating, "ExternalSorting::generate_runs alternates ascending and descending runs, max_resident "
+                           + to_string(max_resident));
+
+        sorting.merge_runs();
+
+        vector<double> merged;
+        for (int run = 0; run < sorting.run_count(); run++) {
+            vector<double> slots = sorting.read_run(run);
+            merged.insert(merged.end(), slots.begin(), slots.end());
+        }
+
+        check(close(sorted_copy(values), merged, delta) && !plain.statistics().depth_exceeded,
+              "ExternalSorting::merge_runs merge-splits the runs into sorted order, max_resident " + to_string(max_resident));
+
+        sorting.remove_runs();
+        filesystem::remove_all(directory);
+    }
+}
+
+void test_compare_switch() {
+    // Differences from 2^-bits up to almost 1 keep their sign, smaller ones read as ties
+    double unit = pow(2, -SCHEME_SWITCH_PRECISION_BITS);
+    vector<double> differences = {unit, 3 * unit, 0.01, 0.5, 0.99, unit / 4, 0};
+    for (int i = 0; i < 5; i++) differences.push_back(-differences[i]);
+
+    vector<double> first(differences.size(), 0.5), second;
+    vector<double> expected;
+    for (double d : differences) {
+        second.push_back(0.5 - d);
+        expected.push_back(d <= -unit / 2 ? 1 : 0);
+    }
+
+    PlainController plain;
+    plain.generate_context_network(differences.size(), SCHEME_SWITCH_LEVELS, true, unit);
+
+    PlainController::Ctxt less = plain.compare_switch(plain.encrypt(first), plain.encrypt(second));
+
+    check(close(expected, plain.decode(plain.decrypt(less)), 1e-9) && (int) less->GetLevel() == SCHEME_SWITCH_LEVELS,
+          "compare_switch is 1 where c1 < c2 by at least 2^-" + to_string(SCHEME_SWITCH_PRECISION_BITS)
+          + ", at level SCHEME_SWITCH_LEVELS");
+
+    // Both methods, at a δ that the sigmoid and the ReLU do not reach in toy parameters
+    int n = 16;
+    double delta = 0.0001;
+    vector<double> values = generate_close_randoms(n, delta, 11);
+
+    NetworkConfig config = network_config(n, delta, true, false, SWITCH_COMPARATOR);
+    check(close(sorted_copy(values), network_sort(config, values), delta / 2), "--network --comparator switch sorts at δ = 0.0001");
+
+    PermutationRun run(values, delta, false, 0, 1, false, true);
+    PermutationSorting sorting(run.plain, run.config);
+
+    vector<double> slots = run.decrypt(sorting.sort(run.in_exp, run.in_rep)), sorted;
+    for (int i = 0; i < n; i++) sorted.push_back(slots[i * n]);
+
+    check(close(sorted_copy(values), sorted, delta / 2) && !run.plain.statistics().depth_exceeded,
+          "--permutation --comparator switch sorts at δ = 0.0001");
+}
+
+/*
+ * The mask generator of the first versions of NetworkSorting, which pushed the four masks slot by
+ * slot: the index of the mask selecting each slot
+ */
+vector<int> legacy_mask_pattern(int num_slots, int round, int stage) {
+    vector<int> pattern;
+
+    for (int i = 0; i < num_slots / (pow(2, round + 2)); i++) {
+        for (int times = 0; times < pow(2, stage); times++) {
+            for (int j = 0; j < pow(2, round); j++) pattern.push_back(0);
+            for (int j = 0; j < pow(2, round); j++) pattern.push_back(1);
+        }
+
+        if ((i + 1) * pow(2, stage + round + 1) >= num_slots) break;
+
+        for (int times = 0; times < pow(2, stage); times++) {
+            for (int j = 0; j < pow(2, round); j++) pattern.push_back(2);
+            for (int j = 0; j < pow(2, round); j++) pattern.push_back(3);
+        }
+
+        if ((i + 1) * pow(2, stage + round + 2) >= num_slots) break;
+    }
+
+    return pattern;
+}
+
+void test_plan_masks() {
+    // Past MAX_COMPILED_PLAN_SLOTS the plans are built at run time
+    for (int slots = 2; slots <= 4 * MAX_COMPILED_PLAN_SLOTS; slots *= 2) {
+        const NetworkSchedule& plan = network_plan(slots);
+        bool same = plan.slots == slots && plan.layer_count == plan.sorting_layers(slots);
+
+        for (int l = 0; l < plan.layer_count && same; l++) {
+            const NetworkLayer& layer = plan.layers[l];
+            vector<int> legacy = legacy_mask_pattern(slots, layer.round, layer.stage);
+
+            same = (int) legacy.size() == slots && plan.layer_index(layer.round, layer.stage) == l;
+            for (int slot = 0; slot < slots && same; slot++) same = plan.layer_masks(l)[slot] == legacy[slot];
+        }
+
+        check(same, "network_plan(" + to_string(slots) + ") masks match the legacy generator");
+    }
+}
+
+void test_select() {
+    int n = 16;
+    double delta = 0.01;
+    vector<double> values = generate_close_randoms(n, delta, 12);
+    vector<double> expected = sorted_copy(values);
+
+    PermutationRun run(values, delta, false);
+    PermutationSorting sorting(run.plain, run.config);
+
+    // rank(x_j) / n at slot j of every block of n slots
+    vector<double> ranks = run.decrypt(sorting.rank(run.in_exp, run.in_rep)), expected_ranks;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            expected_ranks.push_back(lower_bound(expected.begin(), expected.end(), values[j]) - expected.begin());
+            expected_ranks.back() /= n;
+        }
+    }
+
+    check(close(expected_ranks, ranks, 0.25 / n), "PermutationSorting::rank gives rank(x_j) / n in every block");
+
+    // Output r gathers the slots r + j (n - 1): with n - 1 ranks they fill all but n slots, and must stay disjoint
+    vector<vector<int>> requests = {{n / 2}, {0, n / 4, n / 2, n - 1}, {}};
+    for (int k = n - 1; k >= 1; k--) requests.back().push_back(k);
+
+    for (const vector<int>& request : requests) {
+        PermutationRun selection(values, delta, false);
+        PermutationSorting selector(selection.plain, selection.config);
+
+        vector<double> selected = selection.decrypt(selector.select(selection.in_exp, selection.in_rep, request)), wanted;
+        for (int k : request) wanted.push_back(expected[k]);
+
+        check(close(wanted, selected, delta) && !selection.plain.statistics().depth_exceeded,
+              "PermutationSorting::select returns " + to_string(request.size()) + " of " + to_string(n)
+              + " values in the first slots, within the depth");
+    }
+}
+
+void test_finalize() {
+    int n = 16;
+    double delta = 0.01;
+    vector<double> values = generate_close_randoms(n, delta, 1);
+
+    PermutationRun run(values, delta, false, PermutationSorting<PlainController>::FINALIZATION_LEVELS);
+    PermutationSorting sorting(run.plain, run.config);
+
+    PlainController::Ctxt finalized = sorting.finalize(sorting.sort(run.in_exp, run.in_rep));
+
+    check((int) finalized->GetSlots() == n && close(sorted_copy(values), run.decrypt(finalized), delta)
+          && !run.plain.statistics().depth_exceeded,
+          "PermutationSorting::finalize repacks the sorted values in n slots, within its levels");
+
+    NetworkConfig config = network_config(n, delta, true);
+    PlainController plain;
+    int levels = network_layer_levels(config.parameters);
+    int depth = plain.generate_context_network(n, levels, true, delta);
+
+    vector<double> scaled(values);
+    for (double& v : scaled) v *= config.parameters.input_scale;
+
+    NetworkSorting network(plain, config);
+    PlainController::Ctxt compressed = network.finalize(network.sort(plain.encrypt(scaled, depth - levels - 3, n)));
+
+    vector<double> expected = sorted_copy(scaled);
+    check((int) compressed->GetSlots() == n && close(expected, plain.decode(plain.decrypt(compressed)), delta),
+          "NetworkSorting::finalize keeps the sorted values");
+}
+
+void test_even_chebyshev() {
+    int n = 16;
+    int samples = 2001;
+    vector<double> points;
+    for (int i = 0; i < samples; i++) points.push_back(-1 + 2.0 * i / (samples - 1));
+
+    struct Target {
+        string name;
+        function<double(double)> f;
+        function<PlainController::Ctxt(PlainController&, const PlainController::Ctxt&, int)> evaluate;
+    };
+
+    vector<Target> targets = {
+            {"sinc", sinc_function(n), [n](PlainController& plain, const PlainController::Ctxt& in, int degree) { return plain.sinc(in, degree, n); }},
+            {"double_sinc", double_sinc_function(n), [n](PlainController& plain, const PlainController::Ctxt& in, int degree) { return plain.double_sinc(in, degree, n); }},
+            {"relu", relu_function(), [n](PlainController& plain, const PlainController::Ctxt& in, int degree) { return plain.relu(in, degree, n); }},
+    };
+
+    // Degrees where the series in x^2 fits the depth of the full one
+    for (int degree : {119, 351, 495}) {
+        for (const Target& target : targets) {
+            PlainController plain;
+            plain.generate_context_network(samples, poly_evaluation_cost(degree), true, 0.01);
+
+            PlainController::Ctxt result = target.evaluate(plain, plain.encrypt(points), degree);
+            vector<double> even = plain.decode(plain.decrypt(result));
+
+            vector<double> coefficients = chebyshev_coefficients(target.f, -1, 1, degree);
+            double full_error = 0, difference = 0;
+
+            for (int i = 0; i < samples; i++) {
+                double full = evaluate_chebyshev_series(coefficients, -1, 1, points[i]);
+                full_error = max(full_error, abs(full - target.f(points[i])));
+                difference = max(difference, abs(full - even[i]));
+            }
+
+            ostringstream what;
+            what << target.name << " of degree " << degree << " in x^2 is within twice the error of the full series ("
+                 << scientific << setprecision(1) << difference << " from it, " << full_error << " from f), in its levels";
+
+            check(even_evaluation_fits(degree) && difference <= 2 * full_error + 1e-9
+                  && (int) result->GetLevel() <= poly_evaluation_cost(degree), what.str());
+        }
+    }
+}
+
+void test_duplicates() {
+    int n = 16;
+    double delta = 0.01;
+
+    // A quarter of the values repeat others
+    vector<double> values = generate_close_randoms(n, delta, 4);
+    for (int i = 0; i < n / 4; i++) values[n - 1 - 2 * i] = values[2 * i];
+
+    PermutationRun run(values, delta, true);
+    PermutationSorting sorting(run.plain, run.config);
+
+    auto [sorted, duplicates] = sorting.sort_with_duplicates(run.in_exp, run.in_rep);
+
+    vector<double> multiplicity = run.decrypt(duplicates.multiplicity), first = run.decrypt(duplicates.first);
+    double distinct = run.decrypt(duplicates.distinct)[0];
+
+    vector<double> expected_multiplicity, expected_first;
+    int expected_distinct = 0;
+
+    for (int j = 0; j < n; j++) {
+        int equal = 0, before = 0;
+        for (int i = 0; i < n; i++) {
+            if (values[i] == values[j]) equal++;
+            if (values[i] == values[j] && i < j) before++;
+        }
+
+        expected_multiplicity.push_back(equal);
+        expected_first.push_back(before == 0);
+        expected_distinct += before == 0;
+    }
+
+    vector<double> sorted_values;
+    vector<double> sorted_slots = run.decrypt(sorted);
+    for (int i = 0; i < n; i++) sorted_values.push_back(sorted_slots[i * n]);
+
+    check(expected_distinct < n, "the duplicates input has repeated values");
+    check(close(expected_multiplicity, multiplicity, 0.5), "sort_with_duplicates: multiplicities");
+    check(close(expected_first, first, 0.5), "sort_with_duplicates: first occurrences");
+    check(abs(distinct - expected_distinct) < 0.5, "sort_with_duplicates: distinct count");
+    check(close(sorted_copy(values), sorted_values, delta), "sort_with_duplicates: sorted values, ties included");
+}
+
+void test_lexicographic() {
+    int n = 16;
+    double delta = 0.01;
+
+    // A primary key with n/4 distinct values, so that the secondary one decides
+    vector<double> primary(n), secondary = generate_close_randoms(n, delta, 5);
+    for (int i = 0; i < n; i++) primary[i] = 4 * delta * ((i * 7) % (n / 4));
+
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return primary[a] != primary[b] ? primary[a] < primary[b] : secondary[a] < secondary[b];
+    });
+
+    vector<double> expected_primary, expected_secondary;
+    for (int i : order) {
+        expected_primary.push_back(primary[i]);
+        expected_secondary.push_back(secondary[i]);
+    }
+
+    // The network-based sorting combines the signs of the keys into one selector per swap
+    NetworkConfig config = network_config(n, delta, true, false, SIGN_COMPARATOR, 2);
+    PlainController plain;
+    int levels = network_layer_levels(config.parameters);
+    int depth = plain.generate_context_network(n, levels, true, delta);
+    double scale = config.parameters.input_scale;
+
+    vector<PlainController::Ctxt> keys;
+    for (vector<double> key : {primary, secondary}) {
+        for (double& v : key) v *= scale;
+        keys.push_back(plain.encrypt(key, depth - levels - 3, n));
+    }
+
+    NetworkSorting network(plain, config);
+    vector<PlainController::Ctxt> sorted = network.sort_lexicographic(keys);
+
+    vector<double> obtained_primary = plain.decode(plain.decrypt(sorted[0])), obtained_secondary = plain.decode(plain.decrypt(sorted[1]));
+    for (int i = 0; i < n; i++) {
+        obtained_primary[i] /= scale;
+        obtained_secondary[i] /= scale;
+    }
+
+    check(close(expected_primary, obtained_primary, delta) && close(expected_secondary, obtained_secondary, delta),
+          "NetworkSorting::sort_lexicographic orders the records by the selector of both keys");
+
+    // The permutation-based sorting, with the lexicographic comparison matrix
+    PermutationRun run(primary, delta, false, 0, 2);
+    PermutationSorting sorting(run.plain, run.config);
+
+    vector<PlainController::Ctxt> result = sorting.sort_lexicographic({run.in_exp, run.plain.encrypt_expanded(secondary, 0, n * n, n)},
+                                                                       {run.in_rep, run.plain.encrypt_repeated(secondary, 0, n * n, n)});
+
+    vector<double> first_slots = run.decrypt(result[0]), second_slots = run.decrypt(result[1]);
+    vector<double> first_key, second_key;
+    for (int i = 0; i < n; i++) {
+        first_key.push_back(first_slots[i * n]);
+        second_key.push_back(second_slots[i * n]);
+    }
+
+    check(close(expected_primary, first_key, delta) && close(expected_secondary, second_key, delta),
+          "PermutationSorting::sort_lexicographic orders the records by both keys");
+}
+
+void test_checkpoint() {
+    int n = 16;
+    double delta = 0.01;
+    vector<double> values = generate_close_randoms(n, delta, 8);
+
+    string directory = (filesystem::temp_directory_path() / "sorting-tests-checkpoint").string();
+    filesystem::remove_all(directory);
+    filesystem::create_directories(directory);
+
+    NetworkConfig config = network_config(n, delta, true);
+    config.checkpoint_directory = directory;
+    config.checkpoint_interval = 3;
+
+    PlainController plain;
+    int levels = network_layer_levels(config.parameters);
+    int depth = plain.generate_context_network(n, levels, true, delta);
+    plain.save_keys(directory);
+
+    vector<double> scaled(values);
+    for (double& v : scaled) v *= config.parameters.input_scale;
+
+    NetworkSorting sorting(plain, config);
+    vector<double> sorted = plain.decode(plain.decrypt(sorting.sort(plain.encrypt(scaled, depth - levels - 3, n))));
+
+    // A new process: the level budget and the checkpoint are read back from the directory
+    PlainController resumed_plain;
+    int resumed_depth = resumed_plain.load_keys(directory);
+
+    NetworkSorting resumed_sorting(resumed_plain, config);
+    bool available = resumed_sorting.has_checkpoint();
+    vector<double> resumed = available ? resumed_plain.decode(resumed_plain.decrypt(resumed_sorting.resume())) : vector<double>();
+
+    check(available && resumed_depth == depth && close(sorted, resumed, 1e-9),
+          "NetworkSorting::resume continues from the last checkpoint to the output of sort()");
+
+    // A sort with another δ, or another truncation, must not continue this circuit
+    for (int variant = 0; variant < 2; variant++) {
+        NetworkConfig other = variant == 0 ? network_config(n, delta / 2, true) : config;
+        other.checkpoint_directory = directory;
+        if (variant == 1) other.truncated_stages = 1;
+
+        NetworkSorting other_sorting(resumed_plain, other);
+        bool rejected = false;
+
+        try {
+            other_sorting.resume();
+        } catch (const runtime_error&) {
+            rejected = true;
+        }
+
+        check(rejected, string("NetworkSorting::resume rejects a checkpoint of a sort with another ") + (variant == 0 ? "δ" : "truncation"));
+    }
+
+    filesystem::remove_all(directory);
+}
+
+void test_half_packing() {
+    int n = 16;
+    double delta = 0.01;
+    vector<double> first = generate_close_randoms(n, delta, 2), second = generate_close_randoms(n, delta, 3);
+
+    PermutationRun run(first, delta, false, 0, 1, true);
+    PermutationSorting sorting(run.plain, run.config);
+
+    auto slots = PermutationSorting<PlainController>::half_diagonal_slots(first, second, n);
+    PlainController::Ctxt left = run.plain.encrypt(slots.first, 0, n * n), right = run.plain.encrypt(slots.second, 0, n * n);
+
+    // The ranks from the diagonals are the ones of the full matrix, in every block of n slots
+    vector<double> full = run.decrypt(sorting.compute_indexing(sorting.compute_comparison(run.in_exp, run.in_rep)));
+    vector<double> half = run.decrypt(sorting.compute_half_indexing(sorting.compute_comparison(left, right)));
+
+    check(close(full, half, 0.25 / n), "compute_half_indexing gives the ranks of compute_indexing");
+
+    auto sorted = sorting.sort_packed(left, right, run.in_rep, run.plain.encrypt_repeated(second, 0, n * n, n));
+    vector<double> sorted_first, sorted_second;
+    vector<double> first_slots = run.decrypt(sorted.first), second_slots = run.decrypt(sorted.second);
+
+    for (int i = 0; i < n; i++) {
+        sorted_first.push_back(first_slots[i * n]);
+        sorted_second.push_back(second_slots[i * n]);
+    }
+
+    check(close(sorted_copy(first), sorted_first, delta) && close(sorted_copy(second), sorted_second, delta)
+          && !run.plain.statistics().depth_exceeded,
+          "sort_packed sorts two lists with one comparison, within permutation_parameters(..., 1, true)");
+
+    // Two keys of the same records, whose comparisons share the sigmoid
+    vector<double> primary(n);
+    for (int i = 0; i < n; i++) primary[i] = 4 * delta * ((i * 7) % (n / 4));
+
+    vector<int> order(n);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return primary[a] != primary[b] ? primary[a] < primary[b] : second[a] < second[b];
+    });
+
+    PermutationRun lexicographic(primary, delta, false, 0, 2, true);
+    PermutationSorting lexicographic_sorting(lexicographic.plain, lexicographic.config);
+
+    auto key_slots = PermutationSorting<PlainController>::half_diagonal_slots(primary, second, n);
+    vector<PlainController::Ctxt> result = lexicographic_sorting.sort_lexicographic_packed(
+            {lexicographic.plain.encrypt(key_slots.first, 0, n * n)}, {lexicographic.plain.encrypt(key_slots.second, 0, n * n)},
+            {lexicographic.in_rep, lexicographic.plain.encrypt_repeated(second, 0, n * n, n)});
+
+    vector<double> primary_slots = lexicographic.decrypt(result[0]), secondary_slots = lexicographic.decrypt(result[1]);
+    bool ordered = true;
+    for (int i = 0; i < n; i++) {
+        ordered = ordered && abs(primary_slots[i * n] - primary[order[i]]) < delta && abs(secondary_slots[i * n] - second[order[i]]) < delta;
+    }
+
+    check(ordered, "PermutationSorting::sort_lexicographic_packed orders the records by both keys");
+}
+
+void test_truncation() {
+    double delta = 0.01;
+
+    for (int n : {16, 64}) {
+        vector<double> values = generate_close_randoms(n, delta, 7);
+        vector<double> expected = sorted_copy(values);
+
+        for (int max_displacement : {1, 3, 7, 15}) {
+            NetworkConfig config = network_config(n, delta, true);
+            config.truncated_stages = network_truncation(n, max_displacement);
+
+            Sortedness obtained = sortedness(expected, network_sort(config, values), delta);
+
+            check((1 << config.truncated_stages) - 1 <= max_displacement && obtained.max_displacement <= max_displacement,
+                  "n = " + to_string(n) + ", --max-displacement " + to_string(max_displacement) + ": "
+                  + to_string(config.truncated_stages) + " stages skipped, displacement " + to_string(obtained.max_displacement));
+        }
+    }
+}
+
+void test_counting_offsets() {
+    int n = 16;
+    double delta = 0.1;
+    vector<double> values = generate_close_randoms(n, delta, 6);
+
+    CountingConfig config = counting_config(n, delta, true);
+    const CountingParameters& parameters = config.parameters;
+
+    PlainController plain;
+    plain.generate_context_permutation(parameters.slots, parameters.circuit_depth, true, n, delta);
+
+    CountingSorting sorting(plain, config);
+    PlainController::Ctxt in = plain.encrypt_repeated(values, 0, parameters.slots, parameters.slots / (2 * n));
+
+    // Slot b n + p: (C_b - p - 1/2) / n, C_b counting the values in the buckets before b
+    vector<double> offsets = plain.decode(plain.decrypt(sorting.compute_offsets(sorting.compute_indicators(in))));
+    bool offsets_correct = true;
+
+    for (int b = 0; b < parameters.buckets; b++) {
+        int before = 0;
+        for (double v : values) before += lround(v / delta) < b;
+
+        for (int p = 0; p < n; p++) {
+            if (abs(offsets[b * n + p] - (before - p - 0.5) / n) >= 0.25 / n) offsets_correct = false;
+        }
+    }
+
+    check(offsets_correct, "CountingSorting::compute_offsets counts the values before every bucket");
+    check(close(sorted_copy(values), plain.decode(plain.decrypt(sorting.sort(in))), delta),
+          "CountingSorting::sort sorts repeated values");
+}
+
+int main() {
+    test_composite_sign();
+    test_lanes();
+    test_external();
+    test_compare_switch();
+    test_plan_masks();
+    test_select();
+    test_finalize();
+    test_even_chebyshev();
+    test_duplicates();
+    test_lexicographic();
+    test_checkpoint();
+    test_half_packing();
+    test_truncation();
+    test_counting_offsets();
+
+    cout << endl << (failures == 0 ? GREEN_TEXT "All checks passed" : RED_TEXT "Failed checks: " + to_string(failures)) << RESET_COLOR << endl;
+
+    return failures;
+}